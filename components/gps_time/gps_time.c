@@ -15,8 +15,6 @@
  */
 #include "gps_time.h"
 
-static const char *TAG = "gps_time";
-
 void gps_time_init(gps_time_t **pointer) {
   *pointer = malloc(sizeof(gps_time_t));
   gps_time_fill(*pointer);
@@ -25,133 +23,354 @@ void gps_time_init(gps_time_t **pointer) {
 void gps_time_fill(gps_time_t *pointer) {
   pointer->status = GPS_TIME_NONE;
   pointer->lag = 0;
+  pointer->microsecond = 0;
+  memset(&(pointer->ubx), 0, sizeof(pointer->ubx));
+  gps_time_clock_fill(&(pointer->clock));
+}
+
+// Commits a fully parsed date, time and fix, every CONFIG_GPS_TIME_LAG of them
+// disciplines the time of day.
+static void gps_time_sync(gps_time_t *pointer, int64_t arrival_us) {
+  if (((pointer->status & GPS_TIME_READY) == GPS_TIME_READY)) {
+    pointer->status &= ~(GPS_TIME_DATE_IS_CURRENT | GPS_TIME_TIME_IS_CURRENT);
+    if (pointer->lag == 0) {
+      const int64_t epoch_us =
+          gps_time_utc_to_epoch(pointer->year + 2000, pointer->month,
+                                pointer->day, pointer->hour, pointer->minute,
+                                pointer->second) *
+              1000000 +
+          pointer->microsecond;
+      gps_time_clock_discipline(&(pointer->clock), epoch_us, arrival_us);
+      pointer->lag = CONFIG_GPS_TIME_LAG;
+    }
+    (pointer->lag)--;
+  }
+}
+
+static int32_t gps_time_hex_digit(char c) {
+  if (c >= '0' && c <= '9') {
+    return c - '0';
+  } else if (c >= 'A' && c <= 'F') {
+    return c - 'A' + 10;
+  } else if (c >= 'a' && c <= 'f') {
+    return c - 'a' + 10;
+  }
+  return -1;
 }
 
 void gps_time_nmea_read(gps_time_t *pointer, const char *sentence) {
   if (sentence[0] != '$' || !CONFIG_GPS_TIME_SYNC) {
     return;
   }
-  uint32_t end = 0;
-  uint32_t copy_point = 0;
-  char current_sentence[GPS_TIME_MAX_SENTENCE_LENGTH];
-  // Prepare the copied sentence to be strtok'd, which is destructive to the
-  // original sentence data.
-  for (uint32_t i = 0; i < GPS_TIME_MAX_SENTENCE_LENGTH; i++) {
-    if (end != 0) {
-      // Encountered null, or a line break
+  // Any two letter talker is fine (GP, GL, GA, GB, GN...), but only GGA and
+  // RMC carry anything we want, so bail out on the rest before going further.
+  if (sentence[1] < 'A' || sentence[1] > 'Z' || sentence[2] < 'A' ||
+      sentence[2] > 'Z') {
+    return;
+  }
+  uint32_t sentence_type = GPS_TIME_SENTENCE_TYPE_OTHER;
+  const char *type = sentence + 3;
+  if (type[0] == 'G' && type[1] == 'G' && type[2] == 'A' && type[3] == ',') {
+    sentence_type = GPS_TIME_SENTENCE_TYPE_GPGGA;
+  } else if (type[0] == 'R' && type[1] == 'M' && type[2] == 'C' &&
+             type[3] == ',') {
+    sentence_type = GPS_TIME_SENTENCE_TYPE_GPRMC;
+  } else {
+    return;
+  }
+  const int64_t arrival_us = esp_timer_get_time();
+
+  // The checksum covers everything between the '$' and the '*'
+  uint8_t checksum = 0;
+  for (uint32_t i = 1; i < 7; i++) {
+    checksum ^= (uint8_t)(sentence[i]);
+  }
+
+  // Fields are scanned in place, nothing is committed until the checksum
+  // checks out.
+  uint32_t field = 1;
+  uint32_t value = 0;
+  uint32_t digits = 0;
+  uint32_t integer_done = 0;
+  uint32_t fraction = 0, fraction_digits = 0, in_fraction = 0;
+  uint32_t time = 0, time_valid = 0;
+  uint32_t date = 0, date_valid = 0;
+  uint32_t fix = 0;
+  uint32_t checked = 0;
+  for (uint32_t i = 7; i < GPS_TIME_MAX_SENTENCE_LENGTH; i++) {
+    const char c = sentence[i];
+    if (c >= '0' && c <= '9') {
+      if (in_fraction != 0) {
+        if (fraction_digits < 6) {
+          fraction = fraction * 10 + (uint32_t)(c - '0');
+          fraction_digits++;
+        }
+      } else if (integer_done == 0 && digits < 9) {
+        // Nothing we read is longer than 6 digits, stop before it overflows
+        value = value * 10 + (uint32_t)(c - '0');
+        digits++;
+      }
+    } else if (c == ',' || c == '*') {
+      if (field == 1) {
+        // hhmmss.ss
+        for (; fraction_digits < 6; fraction_digits++) {
+          fraction *= 10;
+        }
+        time = value;
+        time_valid = (digits == 6);
+      } else if (field == 6 && sentence_type == GPS_TIME_SENTENCE_TYPE_GPGGA) {
+        fix = (digits > 0) ? value : 0;
+      } else if (field == 9 && sentence_type == GPS_TIME_SENTENCE_TYPE_GPRMC) {
+        date = value;
+        date_valid = (digits == 6);
+      }
+      if (c == '*') {
+        const int32_t high = gps_time_hex_digit(sentence[i + 1]);
+        const int32_t low = (high < 0) ? -1 : gps_time_hex_digit(sentence[i + 2]);
+        if (low < 0 || (uint32_t)((high << 4) | low) != checksum) {
+          return;
+        }
+        checked = 1;
+        break;
+      }
+      field++;
+      value = 0;
+      digits = 0;
+      integer_done = 0;
+      fraction = 0;
+      fraction_digits = 0;
+      in_fraction = 0;
+    } else if (c == '\0' || c == '\r' || c == '\n') {
+      // Ran out of sentence without a checksum
+      return;
+    } else {
+      in_fraction = (c == '.' && integer_done == 0);
+      integer_done = 1;
+    }
+    checksum ^= (uint8_t)(c);
+  }
+  if (checked == 0) {
+    // Over-long sentence
+    return;
+  }
+
+  if (time_valid) {
+    pointer->hour = time / 10000;
+    pointer->minute = (time / 100) % 100;
+    pointer->second = time % 100;
+    pointer->microsecond = (int32_t)(fraction);
+  }
+  if (sentence_type == GPS_TIME_SENTENCE_TYPE_GPGGA) {
+    if (fix > 0) {
+      pointer->status |= (GPS_TIME_HAS_FIX | GPS_TIME_TIME_IS_CURRENT);
+    } else {
+      pointer->status &= ~GPS_TIME_HAS_FIX;
+    }
+  } else if (date_valid) {
+    pointer->day = date / 10000;
+    pointer->month = (date / 100) % 100;
+    pointer->year = date % 100;
+    pointer->status |= GPS_TIME_DATE_IS_CURRENT;
+  }
+
+  gps_time_sync(pointer, arrival_us);
+}
+
+static uint16_t gps_time_ubx_u16(const uint8_t *payload) {
+  return (uint16_t)(payload[0]) | ((uint16_t)(payload[1]) << 8);
+}
+
+static int32_t gps_time_ubx_i32(const uint8_t *payload) {
+  return (int32_t)((uint32_t)(payload[0]) | ((uint32_t)(payload[1]) << 8) |
+                   ((uint32_t)(payload[2]) << 16) |
+                   ((uint32_t)(payload[3]) << 24));
+}
+
+static void gps_time_ubx_put_u32(uint8_t *payload, uint32_t value) {
+  payload[0] = value & 0xFF;
+  payload[1] = (value >> 8) & 0xFF;
+  payload[2] = (value >> 16) & 0xFF;
+  payload[3] = (value >> 24) & 0xFF;
+}
+
+// Fills in the date and time from a checked UBX-NAV-PVT or UBX-NAV-TIMEUTC
+static void gps_time_ubx_dispatch(gps_time_t *pointer) {
+  const gps_time_ubx_t *ubx = &(pointer->ubx);
+  const uint8_t *payload = ubx->payload;
+  if (ubx->message_class != GPS_TIME_UBX_CLASS_NAV) {
+    return;
+  }
+  const int64_t arrival_us = esp_timer_get_time();
+
+  uint32_t date_valid = 0, time_valid = 0, fix = 0;
+  int32_t nano = 0;
+  if (ubx->message_id == GPS_TIME_UBX_NAV_PVT && ubx->length == 92) {
+    nano = gps_time_ubx_i32(payload + 16);
+    payload += 4;
+    // valid: validDate, validTime, fullyResolved
+    date_valid = (payload[7] & 0x01) != 0;
+    time_valid = (payload[7] & 0x06) == 0x06;
+    // flags: gnssFixOK, fixType: 2D or better
+    fix = (payload[17] & 0x01) != 0 && payload[16] >= 2;
+  } else if (ubx->message_id == GPS_TIME_UBX_NAV_TIMEUTC &&
+             ubx->length == 20) {
+    nano = gps_time_ubx_i32(payload + 8);
+    payload += 12;
+    // valid: validUTC, there's no fix status in this message
+    date_valid = (payload[7] & 0x04) != 0;
+    time_valid = date_valid;
+    fix = date_valid;
+  } else {
+    return;
+  }
+
+  // Same layout from here on in both messages
+  if (date_valid) {
+    pointer->year = gps_time_ubx_u16(payload) - 2000;
+    pointer->month = payload[2];
+    pointer->day = payload[3];
+    pointer->status |= GPS_TIME_DATE_IS_CURRENT;
+  }
+  if (time_valid) {
+    pointer->hour = payload[4];
+    pointer->minute = payload[5];
+    pointer->second = payload[6];
+    // Can be negative, the seconds are rounded to the nearest
+    pointer->microsecond = nano / 1000;
+  }
+  if (fix && time_valid) {
+    pointer->status |= (GPS_TIME_HAS_FIX | GPS_TIME_TIME_IS_CURRENT);
+  } else {
+    pointer->status &= ~GPS_TIME_HAS_FIX;
+  }
+
+  gps_time_sync(pointer, arrival_us);
+}
+
+void gps_time_ubx_read(gps_time_t *pointer, const uint8_t *data,
+                       size_t length) {
+  gps_time_ubx_t *ubx = &(pointer->ubx);
+  for (size_t i = 0; i < length; i++) {
+    const uint8_t byte = data[i];
+    // The checksum covers the class, ID, length and payload
+    if (ubx->state >= 2 && ubx->state <= 6) {
+      ubx->checksum_a += byte;
+      ubx->checksum_b += ubx->checksum_a;
+    }
+    switch (ubx->state) {
+    case 0: {
+      if (byte == GPS_TIME_UBX_SYNC_1) {
+        ubx->state = 1;
+      }
       break;
     }
-    // Switch based on NMEA sentence point.
-    switch (sentence[i]) {
-    case '\0':
-    case '\r':
-    case '\n': {
-      current_sentence[copy_point] = '\0';
-      end = 1;
+    case 1: {
+      if (byte == GPS_TIME_UBX_SYNC_2) {
+        ubx->checksum_a = 0;
+        ubx->checksum_b = 0;
+        ubx->state = 2;
+      } else {
+        ubx->state = (byte == GPS_TIME_UBX_SYNC_1) ? 1 : 0;
+      }
       break;
     }
-    case '$':
-    case '!': {
-      continue;
+    case 2: {
+      ubx->message_class = byte;
+      ubx->state = 3;
+      break;
     }
-    default: {
-      current_sentence[copy_point] = sentence[i];
-      copy_point++;
+    case 3: {
+      ubx->message_id = byte;
+      ubx->state = 4;
       break;
     }
+    case 4: {
+      ubx->length = byte;
+      ubx->state = 5;
+      break;
     }
-  }
-  // Get the NMEA sentence's tokens...
-  char *state;
-  char *nmea_token = strtok_r(current_sentence, ",", &state);
-  uint32_t sentence_type = GPS_TIME_SENTENCE_TYPE_OTHER;
-  uint32_t token_count = 0;
-  while (nmea_token != NULL) {
-    switch (token_count) {
-    case 0: {
-      if (strlen(nmea_token) == 5) {
-        if (strcmp(nmea_token + 2, "GGA") == 0) {
-          sentence_type = GPS_TIME_SENTENCE_TYPE_GPGGA;
-        } else if (strcmp(nmea_token + 2, "GLL") == 0) {
-          sentence_type = GPS_TIME_SENTENCE_TYPE_GPGLL;
-        } else if (strcmp(nmea_token + 2, "GSA") == 0) {
-          sentence_type = GPS_TIME_SENTENCE_TYPE_GPGSA;
-        } else if (strcmp(nmea_token + 2, "GSV") == 0) {
-          sentence_type = GPS_TIME_SENTENCE_TYPE_GPGSV;
-        } else if (strcmp(nmea_token + 2, "RMC") == 0) {
-          sentence_type = GPS_TIME_SENTENCE_TYPE_GPRMC;
-        } else if (strcmp(nmea_token + 2, "VTG") == 0) {
-          sentence_type = GPS_TIME_SENTENCE_TYPE_GPVTG;
-        }
-      }
+    case 5: {
+      ubx->length |= ((uint16_t)(byte)) << 8;
+      ubx->index = 0;
+      ubx->state = (ubx->length > 0) ? 6 : 7;
       break;
     }
-    case 1: {
-      if (sentence_type == GPS_TIME_SENTENCE_TYPE_GPGGA ||
-          sentence_type == GPS_TIME_SENTENCE_TYPE_GPRMC) {
-        sscanf(nmea_token, "%02" PRIu32 "%02" PRIu32 "%02" PRIu32,
-               &(pointer->hour), &(pointer->minute), &(pointer->second));
-        // printf("Got time code: %s\n", nmea_token);
+    case 6: {
+      // Payloads we don't care about can be longer than the buffer, they
+      // still need to be walked through for the checksum.
+      if (ubx->index < GPS_TIME_UBX_MAX_PAYLOAD) {
+        ubx->payload[ubx->index] = byte;
+      }
+      (ubx->index)++;
+      if (ubx->index == ubx->length) {
+        ubx->state = 7;
       }
       break;
     }
-    case 4: {
-      if (sentence_type == GPS_TIME_SENTENCE_TYPE_GPGGA) {
-        uint32_t fix = 0;
-        int num = sscanf(nmea_token, "%" PRIu32, &fix);
-        if (num == 1 && fix > 0) {
-          pointer->status |= (GPS_TIME_HAS_FIX | GPS_TIME_TIME_IS_CURRENT);
-          // printf("Got fix\n");
-        } else {
-          pointer->status &= ~GPS_TIME_HAS_FIX;
-          // printf("No fix, date and time are no longer valid\n");
-        }
+    case 7: {
+      ubx->state = (byte == ubx->checksum_a) ? 8 : 0;
+      if (ubx->state == 0) {
+        (ubx->errors)++;
       }
       break;
     }
     case 8: {
-      if (sentence_type == GPS_TIME_SENTENCE_TYPE_GPRMC) {
-        sscanf(nmea_token, "%02" PRIu32 "%02" PRIu32 "%02" PRIu32,
-               &(pointer->day), &(pointer->month), &(pointer->year));
-        pointer->status |= GPS_TIME_DATE_IS_CURRENT;
-        // printf("Got date code: %s\n", nmea_token);
+      ubx->state = 0;
+      if (byte != ubx->checksum_b) {
+        (ubx->errors)++;
+      } else if (ubx->length <= GPS_TIME_UBX_MAX_PAYLOAD) {
+        (ubx->frames)++;
+        gps_time_ubx_dispatch(pointer);
       }
       break;
     }
     default: {
+      ubx->state = 0;
       break;
     }
     }
-
-    nmea_token = strtok_r(NULL, ",", &state);
-    token_count++;
   }
+}
 
-  if (((pointer->status & GPS_TIME_READY) == GPS_TIME_READY)) {
-    pointer->status &= ~(GPS_TIME_DATE_IS_CURRENT | GPS_TIME_TIME_IS_CURRENT);
-    if (pointer->lag == 0) {
-      struct tm time;
-
-      time.tm_year = pointer->year + 100; // Y2K much?
-      time.tm_mon = pointer->month - 1;
-      time.tm_mday = pointer->day;
-
-      time.tm_hour = pointer->hour;
-      time.tm_min = pointer->minute;
-      time.tm_sec = pointer->second;
+size_t gps_time_ubx_frame(uint8_t *frame, uint8_t message_class,
+                          uint8_t message_id, const uint8_t *payload,
+                          uint16_t length) {
+  frame[0] = GPS_TIME_UBX_SYNC_1;
+  frame[1] = GPS_TIME_UBX_SYNC_2;
+  frame[2] = message_class;
+  frame[3] = message_id;
+  frame[4] = length & 0xFF;
+  frame[5] = length >> 8;
+  memcpy(frame + 6, payload, length);
 
-      time_t secs = mktime(&time);
-      const struct timeval tval = {.tv_sec = secs, .tv_usec = 0};
+  uint8_t checksum_a = 0, checksum_b = 0;
+  for (size_t i = 2; i < 6 + (size_t)(length); i++) {
+    checksum_a += frame[i];
+    checksum_b += checksum_a;
+  }
+  frame[6 + length] = checksum_a;
+  frame[7 + length] = checksum_b;
+  return 8 + (size_t)(length);
+}
 
-      char buf[128];
-      strftime(buf, 127, "%c", &time);
-      ESP_LOGI(TAG, "Time of day will be set: %s", buf);
+size_t gps_time_ubx_cfg_msg(uint8_t *frame, uint8_t message_class,
+                            uint8_t message_id, uint8_t rate) {
+  const uint8_t payload[3] = {message_class, message_id, rate};
+  return gps_time_ubx_frame(frame, GPS_TIME_UBX_CLASS_CFG, GPS_TIME_UBX_CFG_MSG,
+                            payload, sizeof(payload));
+}
 
-      settimeofday(&tval, NULL);
-      pointer->lag = CONFIG_GPS_TIME_LAG;
-    }
-    (pointer->lag)--;
-  }
+size_t gps_time_ubx_cfg_prt(uint8_t *frame, uint32_t baud_rate) {
+  uint8_t payload[20] = {0};
+  payload[0] = 1; // UART1
+  // 8N1
+  gps_time_ubx_put_u32(payload + 4, 0x000008D0);
+  gps_time_ubx_put_u32(payload + 8, baud_rate);
+  // Take in UBX and NMEA, only put out UBX
+  payload[12] = 0x03;
+  payload[14] = 0x01;
+  return gps_time_ubx_frame(frame, GPS_TIME_UBX_CLASS_CFG, GPS_TIME_UBX_CFG_PRT,
+                            payload, sizeof(payload));
 }
 
 void gps_time_free(gps_time_t *pointer) { free(pointer); }
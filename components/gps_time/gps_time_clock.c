@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "gps_time.h"
+
+static const char *TAG = "gps_time_clock";
+
+// Drift beyond this is no oscillator's, and spans longer than this aren't
+// compared at all
+#define GPS_TIME_DRIFT_MAX_PPM 1000
+#define GPS_TIME_DRIFT_SPAN_MAX_US ((int64_t)(86400) * 1000000)
+
+// Days since 1970-01-01 of a proleptic Gregorian date
+static int64_t gps_time_days_from_civil(int32_t year, uint32_t month,
+                                        uint32_t day) {
+  year -= (month <= 2);
+  const int32_t era = ((year >= 0) ? year : (year - 399)) / 400;
+  const uint32_t year_of_era = (uint32_t)(year - era * 400);
+  const uint32_t day_of_year =
+      (153 * ((month > 2) ? (month - 3) : (month + 9)) + 2) / 5 + day - 1;
+  const uint32_t day_of_era = year_of_era * 365 + year_of_era / 4 -
+                              year_of_era / 100 + day_of_year;
+  return (int64_t)(era) * 146097 + (int64_t)(day_of_era) - 719468;
+}
+
+int64_t gps_time_utc_to_epoch(uint32_t year, uint32_t month, uint32_t day,
+                              uint32_t hour, uint32_t minute, uint32_t second) {
+  return gps_time_days_from_civil((int32_t)(year), month, day) * 86400 +
+         (int64_t)(hour) * 3600 + (int64_t)(minute) * 60 + (int64_t)(second);
+}
+
+void gps_time_clock_fill(gps_time_clock_t *pointer) {
+  pointer->epoch_us = 0;
+  pointer->arrival_us = 0;
+  pointer->offset_us = 0;
+  pointer->drift_ppb = 0;
+  pointer->samples = 0;
+  pointer->steps = 0;
+  pointer->slews = 0;
+}
+
+void gps_time_clock_resume(gps_time_clock_t *pointer) {
+  pointer->epoch_us = 0;
+  pointer->arrival_us = 0;
+}
+
+void gps_time_clock_discipline(gps_time_clock_t *pointer, int64_t epoch_us,
+                               int64_t arrival_us) {
+  // Work out what the system clock read when the epoch arrived
+  struct timeval now;
+  gettimeofday(&now, NULL);
+  const int64_t elapsed_us = esp_timer_get_time() - arrival_us;
+  const int64_t local_us =
+      (int64_t)(now.tv_sec) * 1000000 + now.tv_usec - elapsed_us;
+  const int64_t offset_us = local_us - epoch_us;
+
+  // esp_timer is never adjusted, so it shows the oscillator's drift against
+  // GPS time between disciplines. Filter it, arrival jitter is a few ms.
+  if (pointer->samples > 0 && pointer->arrival_us > 0) {
+    const int64_t gps_span_us = epoch_us - pointer->epoch_us;
+    const int64_t error_us = (arrival_us - pointer->arrival_us) - gps_span_us;
+    // Past GPS_TIME_DRIFT_MAX_PPM it's the date that jumped, not the
+    // oscillator. The bounds also keep the sums below in range.
+    if (gps_span_us > 0 && gps_span_us <= GPS_TIME_DRIFT_SPAN_MAX_US &&
+        llabs(error_us) <= gps_span_us / (1000000 / GPS_TIME_DRIFT_MAX_PPM)) {
+      const int32_t drift_ppb =
+          (int32_t)((error_us * 1000000000) / gps_span_us);
+      if (pointer->samples == 1) {
+        pointer->drift_ppb = drift_ppb;
+      } else {
+        pointer->drift_ppb += (drift_ppb - pointer->drift_ppb) / 8;
+      }
+    } else if (gps_span_us > 0) {
+      ESP_LOGW(TAG, "esp_timer is %" PRId64 " us off GPS time, keeping drift",
+               error_us);
+    }
+  }
+  pointer->epoch_us = epoch_us;
+  pointer->arrival_us = arrival_us;
+  pointer->offset_us = offset_us;
+  (pointer->samples)++;
+
+  if (pointer->steps == 0 ||
+      llabs(offset_us) > (int64_t)(CONFIG_GPS_TIME_STEP_THRESHOLD_MS) * 1000) {
+    // Too far off to slew in a sensible time, jump there
+    const int64_t target_us = epoch_us + elapsed_us;
+    const struct timeval tval = {.tv_sec = target_us / 1000000,
+                                 .tv_usec = target_us % 1000000};
+    settimeofday(&tval, NULL);
+    (pointer->steps)++;
+
+    const time_t secs = tval.tv_sec;
+    struct tm time;
+    char buf[128];
+    gmtime_r(&secs, &time);
+    strftime(buf, 127, "%c", &time);
+    ESP_LOGI(TAG, "Time of day was set: %s UTC (was %" PRId64 " us off)", buf,
+             offset_us);
+  } else {
+    const struct timeval delta = {.tv_sec = -offset_us / 1000000,
+                                  .tv_usec = -offset_us % 1000000};
+    adjtime(&delta, NULL);
+    (pointer->slews)++;
+    ESP_LOGI(TAG, "Slewing %" PRId64 " us, drift is %" PRId32 " ppb",
+             -offset_us, pointer->drift_ppb);
+  }
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "gps_time.h"
+
+int __wrap_settimeofday(const struct timeval *tv, const struct timezone *tz) {
+  return 0;
+}
+
+int __wrap_adjtime(const struct timeval *delta, struct timeval *old) {
+  return 0;
+}
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+  // State carries over between inputs like it does between sentences
+  static gps_time_t state;
+  static int ready = 0;
+  if (ready == 0) {
+    gps_time_fill(&state);
+    ready = 1;
+  }
+
+  // Sized exactly so any read past the terminator is caught
+  char *sentence = malloc(size + 1);
+  memcpy(sentence, data, size);
+  sentence[size] = '\0';
+  gps_time_nmea_read(&state, sentence);
+  free(sentence);
+
+  gps_time_ubx_read(&state, data, size);
+  return 0;
+}
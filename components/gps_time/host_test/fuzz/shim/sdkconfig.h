@@ -0,0 +1,5 @@
+#pragma once
+#define CONFIG_GPS_TIME_SYNC 1
+#define CONFIG_GPS_TIME_LAG 1
+#define CONFIG_GPS_TIME_STEP_THRESHOLD_MS 500
+#define CONFIG_GPS_TIME_PROTOCOL_NMEA 1
@@ -0,0 +1,57 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "gps_time_bench.h"
+#include "gps_time.h"
+#include <time.h>
+
+#define GPS_TIME_BENCH_ROUNDS 200000
+
+// One epoch of the SAM-M8Q's default NMEA output, as the GPS task hands it
+// over (line feed stripped, carriage return left in)
+static const char *epoch[] = {
+    "$GPRMC,123519.00,A,4807.03800,N,01131.00000,E,0.004,,230394,,,A*74\r",
+    "$GPVTG,,T,,M,0.004,N,0.008,K,A*2F\r",
+    "$GPGGA,123519.00,4807.03800,N,01131.00000,E,1,08,0.90,545.4,M,46.9,M,,"
+    "*59\r",
+    "$GPGSA,A,3,04,05,09,12,24,25,29,,,,,,1.55,0.90,1.26*0E\r",
+    "$GPGSV,3,1,11,04,20,048,31,05,55,283,38,09,23,215,27,12,30,090,41*73\r",
+    "$GPGSV,3,2,11,24,41,310,40,25,67,148,45,29,18,112,35,31,06,030,*76\r",
+    "$GPGSV,3,3,11,18,05,332,,20,12,250,22,26,03,160,*41\r",
+    "$GPGLL,4807.03800,N,01131.00000,E,123519.00,A,A*66\r",
+};
+
+void gps_time_bench(void) {
+  const uint32_t count = sizeof(epoch) / sizeof(epoch[0]);
+  gps_time_t data;
+  gps_time_fill(&data);
+  // Every epoch syncs in the host build, don't time the logging
+  esp_log_level_set("gps_time_clock", ESP_LOG_WARN);
+
+  struct timespec begin, end;
+  clock_gettime(CLOCK_MONOTONIC, &begin);
+  for (uint32_t round = 0; round < GPS_TIME_BENCH_ROUNDS; round++) {
+    for (uint32_t i = 0; i < count; i++) {
+      gps_time_nmea_read(&data, epoch[i]);
+    }
+  }
+  clock_gettime(CLOCK_MONOTONIC, &end);
+
+  const double seconds = (double)(end.tv_sec - begin.tv_sec) +
+                         (double)(end.tv_nsec - begin.tv_nsec) / 1e9;
+  const double sentences = (double)GPS_TIME_BENCH_ROUNDS * count;
+  printf("%.0f sentences in %.3f s: %.0f sentences/s, %.1f ns/sentence\n",
+         sentences, seconds, sentences / seconds, seconds * 1e9 / sentences);
+}
@@ -0,0 +1,196 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "gps_time.h"
+#include "gps_time_bench.h"
+#include "unity.h"
+
+extern const char fix_loss_start[] asm("_binary_fix_loss_nmea_start");
+extern const char date_rollover_start[] asm("_binary_date_rollover_nmea_start");
+extern const char malformed_start[] asm("_binary_malformed_nmea_start");
+extern const char multi_gnss_start[] asm("_binary_multi_gnss_nmea_start");
+
+// esp_timer and the system clock are faked so replays are deterministic, the
+// system clock runs off esp_timer like it does on the ESP32.
+static int64_t fake_timer_us = 0;
+static int64_t fake_clock_us = 0;
+static int64_t fake_clock_at_us = 0;
+
+static uint32_t settimeofday_calls = 0;
+static uint32_t adjtime_calls = 0;
+
+int64_t __wrap_esp_timer_get_time(void) { return fake_timer_us; }
+
+int __wrap_gettimeofday(struct timeval *tv, void *tz) {
+  const int64_t now_us = fake_clock_us + (fake_timer_us - fake_clock_at_us);
+  tv->tv_sec = now_us / 1000000;
+  tv->tv_usec = now_us % 1000000;
+  return 0;
+}
+
+int __wrap_settimeofday(const struct timeval *tv, const struct timezone *tz) {
+  fake_clock_us = (int64_t)(tv->tv_sec) * 1000000 + tv->tv_usec;
+  fake_clock_at_us = fake_timer_us;
+  settimeofday_calls++;
+  return 0;
+}
+
+int __wrap_adjtime(const struct timeval *delta, struct timeval *old) {
+  // Slews happen all at once here
+  fake_clock_us += (int64_t)(delta->tv_sec) * 1000000 + delta->tv_usec;
+  adjtime_calls++;
+  return 0;
+}
+
+static int64_t fake_clock_now(void) {
+  return fake_clock_us + (fake_timer_us - fake_clock_at_us);
+}
+
+// Feeds a corpus through gps_time_nmea_read the way the GPS task does, a line
+// at a time with the line feed cut off. esp_timer moves on by a second, off
+// by drift_ppb, at each RMC since that starts an epoch on the SAM-M8Q.
+static void replay(gps_time_t *data, const char *corpus, int64_t drift_ppb) {
+  char line[256];
+  const char *cursor = corpus;
+  while (*cursor != '\0') {
+    const char *end = strchr(cursor, '\n');
+    size_t length = (end != NULL) ? (size_t)(end - cursor) : strlen(cursor);
+    const size_t advance = (end != NULL) ? length + 1 : length;
+    if (length >= sizeof(line)) {
+      length = sizeof(line) - 1;
+    }
+    memcpy(line, cursor, length);
+    line[length] = '\0';
+    if (length > 6 && strncmp(line + 3, "RMC", 3) == 0) {
+      fake_timer_us += 1000000 + drift_ppb / 1000;
+    }
+    gps_time_nmea_read(data, line);
+    cursor += advance;
+  }
+}
+
+static gps_time_t data;
+
+void setUp(void) {
+  fake_timer_us = 1000000;
+  fake_clock_us = 0;
+  fake_clock_at_us = 0;
+  settimeofday_calls = 0;
+  adjtime_calls = 0;
+  gps_time_fill(&data);
+}
+
+void tearDown(void) {}
+
+static void test_fix_loss(void) {
+  replay(&data, fix_loss_start, 0);
+  // 15 epochs with the middle 5 lacking a fix
+  TEST_ASSERT_EQUAL_UINT32(10, data.clock.samples);
+  TEST_ASSERT_EQUAL_UINT32(1, settimeofday_calls);
+  TEST_ASSERT_EQUAL_UINT32(9, adjtime_calls);
+  TEST_ASSERT_EQUAL_INT64(0, data.clock.offset_us);
+  TEST_ASSERT_EQUAL_UINT32(GPS_TIME_HAS_FIX, data.status);
+  TEST_ASSERT_EQUAL_UINT32(14, data.second);
+}
+
+static void test_date_rollover(void) {
+  replay(&data, date_rollover_start, 0);
+  TEST_ASSERT_EQUAL_UINT32(27, data.year);
+  TEST_ASSERT_EQUAL_UINT32(1, data.month);
+  TEST_ASSERT_EQUAL_UINT32(1, data.day);
+  TEST_ASSERT_EQUAL_UINT32(0, data.hour);
+  TEST_ASSERT_EQUAL_UINT32(0, data.minute);
+  TEST_ASSERT_EQUAL_UINT32(2, data.second);
+  TEST_ASSERT_EQUAL_UINT32(6, data.clock.samples);
+  TEST_ASSERT_EQUAL_UINT32(1, settimeofday_calls);
+
+  const int64_t expected_us =
+      gps_time_utc_to_epoch(2027, 1, 1, 0, 0, 2) * 1000000;
+  TEST_ASSERT_EQUAL_INT64(expected_us, data.clock.epoch_us);
+  TEST_ASSERT_EQUAL_INT64(expected_us, fake_clock_now());
+}
+
+static void test_malformed(void) {
+  replay(&data, malformed_start, 0);
+  // Only the leading RMC gets through, nothing can complete a fix
+  TEST_ASSERT_EQUAL_UINT32(0, settimeofday_calls);
+  TEST_ASSERT_EQUAL_UINT32(0, adjtime_calls);
+  TEST_ASSERT_EQUAL_UINT32(GPS_TIME_DATE_IS_CURRENT, data.status);
+  TEST_ASSERT_EQUAL_UINT32(9, data.hour);
+  TEST_ASSERT_EQUAL_UINT32(30, data.minute);
+}
+
+static void test_multi_gnss(void) {
+  replay(&data, multi_gnss_start, 0);
+  TEST_ASSERT_EQUAL_UINT32(5, data.clock.samples);
+  TEST_ASSERT_EQUAL_UINT32(26, data.year);
+  TEST_ASSERT_EQUAL_UINT32(6, data.month);
+  TEST_ASSERT_EQUAL_UINT32(4, data.second);
+}
+
+static void test_drift(void) {
+  // An oscillator running 100 ppm fast
+  replay(&data, fix_loss_start, 100000);
+  TEST_ASSERT_EQUAL_UINT32(1, settimeofday_calls);
+  TEST_ASSERT_EQUAL_UINT32(9, adjtime_calls);
+  TEST_ASSERT_INT32_WITHIN(1000, 100000, data.clock.drift_ppb);
+  TEST_ASSERT_INT64_WITHIN(1000, 0, fake_clock_now() - data.clock.epoch_us);
+}
+
+static void test_resume(void) {
+  replay(&data, fix_loss_start, 100000);
+  const int32_t drift_ppb = data.clock.drift_ppb;
+
+  // Deep sleep: esp_timer starts over while the system clock carries on
+  const int64_t now_us = fake_clock_now();
+  fake_timer_us = 1000000;
+  fake_clock_us = now_us;
+  fake_clock_at_us = fake_timer_us;
+  gps_time_clock_resume(&data.clock);
+
+  // The first epoch after waking can't be compared with the last one
+  replay(&data, date_rollover_start, 100000);
+  TEST_ASSERT_EQUAL_UINT32(16, data.clock.samples);
+  TEST_ASSERT_EQUAL_UINT32(2, settimeofday_calls);
+  TEST_ASSERT_INT32_WITHIN(1000, drift_ppb, data.clock.drift_ppb);
+  TEST_ASSERT_INT64_WITHIN(1000, 0, fake_clock_now() - data.clock.epoch_us);
+}
+
+static void test_date_jump(void) {
+  replay(&data, fix_loss_start, 100000);
+  const int32_t drift_ppb = data.clock.drift_ppb;
+
+  // The receiver's date leaps months ahead while esp_timer moves a second
+  replay(&data, date_rollover_start, 100000);
+  TEST_ASSERT_EQUAL_UINT32(16, data.clock.samples);
+  TEST_ASSERT_EQUAL_UINT32(2, settimeofday_calls);
+  TEST_ASSERT_INT32_WITHIN(1000, drift_ppb, data.clock.drift_ppb);
+  TEST_ASSERT_INT64_WITHIN(1000, 0, fake_clock_now() - data.clock.epoch_us);
+}
+
+void app_main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_fix_loss);
+  RUN_TEST(test_date_rollover);
+  RUN_TEST(test_malformed);
+  RUN_TEST(test_multi_gnss);
+  RUN_TEST(test_drift);
+  RUN_TEST(test_resume);
+  RUN_TEST(test_date_jump);
+  const int failures = UNITY_END();
+
+  gps_time_bench();
+  exit(failures);
+}
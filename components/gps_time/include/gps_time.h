@@ -23,6 +23,7 @@
 #include <time.h>
 
 #include "esp_log.h"
+#include "esp_timer.h"
 
 #define GPS_TIME_SENTENCE_TYPE_GPGGA (((uint32_t)(1)) << 0)
 #define GPS_TIME_SENTENCE_TYPE_GPGLL (((uint32_t)(1)) << 1)
@@ -42,6 +43,46 @@
 #define GPS_TIME_MAX_SENTENCE_LENGTH 80
 #define GPS_TIME_UPDATE_INTERVAL 60
 
+#define GPS_TIME_UBX_SYNC_1 0xB5
+#define GPS_TIME_UBX_SYNC_2 0x62
+#define GPS_TIME_UBX_CLASS_NAV 0x01
+#define GPS_TIME_UBX_CLASS_CFG 0x06
+#define GPS_TIME_UBX_CLASS_NMEA 0xF0
+#define GPS_TIME_UBX_NAV_PVT 0x07
+#define GPS_TIME_UBX_NAV_TIMEUTC 0x21
+#define GPS_TIME_UBX_CFG_PRT 0x00
+#define GPS_TIME_UBX_CFG_MSG 0x01
+#define GPS_TIME_UBX_MAX_PAYLOAD 92
+#define GPS_TIME_UBX_MAX_FRAME (GPS_TIME_UBX_MAX_PAYLOAD + 8)
+
+typedef struct {
+  // GPS time and esp_timer time of the last disciplined epoch
+  int64_t epoch_us;
+  int64_t arrival_us;
+  // System clock minus GPS time at the last epoch
+  int64_t offset_us;
+  // How fast esp_timer runs against GPS time, filtered
+  int32_t drift_ppb;
+
+  uint32_t samples;
+  uint32_t steps;
+  uint32_t slews;
+} gps_time_clock_t;
+
+typedef struct {
+  uint32_t state;
+  uint8_t message_class;
+  uint8_t message_id;
+  uint16_t length;
+  uint16_t index;
+  uint8_t checksum_a;
+  uint8_t checksum_b;
+  uint8_t payload[GPS_TIME_UBX_MAX_PAYLOAD];
+
+  uint32_t frames;
+  uint32_t errors;
+} gps_time_ubx_t;
+
 typedef struct {
   uint32_t year;
   uint32_t month;
@@ -49,9 +90,13 @@ typedef struct {
   uint32_t hour;
   uint32_t minute;
   uint32_t second;
+  int32_t microsecond;
 
   uint32_t status;
   uint32_t lag;
+
+  gps_time_ubx_t ubx;
+  gps_time_clock_t clock;
 } gps_time_t;
 
 // Dynamic allocation of gps_time_t structs
@@ -60,8 +105,37 @@ void gps_time_init(gps_time_t **);
 // Static fill of gps_time_t structs
 void gps_time_fill(gps_time_t *);
 
-// Read a NMEA line
+// Read a NMEA line in place, only GGA and RMC sentences with a good checksum
+// are used
 void gps_time_nmea_read(gps_time_t *, const char *);
 
+// Read a chunk of the UBX binary stream, frames may span several chunks
+void gps_time_ubx_read(gps_time_t *, const uint8_t *, size_t);
+
+// Build a UBX frame around a payload, returns the frame's size
+size_t gps_time_ubx_frame(uint8_t *, uint8_t, uint8_t, const uint8_t *,
+                          uint16_t);
+
+// Build a UBX-CFG-MSG frame setting a message's rate on the current port
+size_t gps_time_ubx_cfg_msg(uint8_t *, uint8_t, uint8_t, uint8_t);
+
+// Build a UBX-CFG-PRT frame switching UART1 to UBX output at a baud rate
+size_t gps_time_ubx_cfg_prt(uint8_t *, uint32_t);
+
+// Seconds since the epoch of a UTC date and time, independent of TZ
+int64_t gps_time_utc_to_epoch(uint32_t, uint32_t, uint32_t, uint32_t, uint32_t,
+                              uint32_t);
+
+// Static fill of gps_time_clock_t structs
+void gps_time_clock_fill(gps_time_clock_t *);
+
+// Keeps the drift and counters of a clock restored after deep sleep, but not
+// its last epoch, as esp_timer starts over on every wake
+void gps_time_clock_resume(gps_time_clock_t *);
+
+// Slews (or steps, if too far off) the time of day towards a GPS epoch in
+// microseconds that arrived at an esp_timer time in microseconds
+void gps_time_clock_discipline(gps_time_clock_t *, int64_t, int64_t);
+
 // Dynamic free of gps_time_t structs
 void gps_time_free(gps_time_t *);
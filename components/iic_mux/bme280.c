@@ -0,0 +1,290 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "bme280.h"
+#include "sdkconfig.h"
+
+typedef enum {
+  BME280_LAYOUT_U16,
+  BME280_LAYOUT_S16,
+  BME280_LAYOUT_U8,
+  BME280_LAYOUT_S8,
+  // 12 bit values packed around a shared nibble of 0xE5
+  BME280_LAYOUT_H4,
+  BME280_LAYOUT_H5,
+} bme280_layout_t;
+
+// Where each coefficient lives in the raw trimming registers
+static const struct {
+  uint8_t offset;
+  uint8_t layout;
+  const char *name;
+} bme280_calibration_layout[BME280_DIG_COUNT] = {
+    [BME280_DIG_T1] = {0, BME280_LAYOUT_U16, "dig_T1"},
+    [BME280_DIG_T2] = {2, BME280_LAYOUT_S16, "dig_T2"},
+    [BME280_DIG_T3] = {4, BME280_LAYOUT_S16, "dig_T3"},
+    [BME280_DIG_P1] = {6, BME280_LAYOUT_U16, "dig_P1"},
+    [BME280_DIG_P2] = {8, BME280_LAYOUT_S16, "dig_P2"},
+    [BME280_DIG_P3] = {10, BME280_LAYOUT_S16, "dig_P3"},
+    [BME280_DIG_P4] = {12, BME280_LAYOUT_S16, "dig_P4"},
+    [BME280_DIG_P5] = {14, BME280_LAYOUT_S16, "dig_P5"},
+    [BME280_DIG_P6] = {16, BME280_LAYOUT_S16, "dig_P6"},
+    [BME280_DIG_P7] = {18, BME280_LAYOUT_S16, "dig_P7"},
+    [BME280_DIG_P8] = {20, BME280_LAYOUT_S16, "dig_P8"},
+    [BME280_DIG_P9] = {22, BME280_LAYOUT_S16, "dig_P9"},
+    [BME280_DIG_H1] = {25, BME280_LAYOUT_U8, "dig_H1"},
+    [BME280_DIG_H2] = {26, BME280_LAYOUT_S16, "dig_H2"},
+    [BME280_DIG_H3] = {28, BME280_LAYOUT_U8, "dig_H3"},
+    [BME280_DIG_H4] = {29, BME280_LAYOUT_H4, "dig_H4"},
+    [BME280_DIG_H5] = {30, BME280_LAYOUT_H5, "dig_H5"},
+    [BME280_DIG_H6] = {32, BME280_LAYOUT_S8, "dig_H6"},
+};
+
+void bme280_calibration_decode(bme280_calibration_t *pointer,
+                               const uint8_t *raw) {
+  for (uint32_t i = 0; i < BME280_DIG_COUNT; i++) {
+    const uint8_t *at = raw + bme280_calibration_layout[i].offset;
+    int32_t value = 0;
+    switch (bme280_calibration_layout[i].layout) {
+    case BME280_LAYOUT_U16: {
+      value = (uint16_t)(((uint16_t)(at[1]) << 8) | at[0]);
+      break;
+    }
+    case BME280_LAYOUT_S16: {
+      value = (int16_t)(((uint16_t)(at[1]) << 8) | at[0]);
+      break;
+    }
+    case BME280_LAYOUT_U8: {
+      value = at[0];
+      break;
+    }
+    case BME280_LAYOUT_S8: {
+      value = (int8_t)(at[0]);
+      break;
+    }
+    case BME280_LAYOUT_H4: {
+      value = ((int32_t)((int8_t)(at[0])) * 16) | (at[1] & 0x0F);
+      break;
+    }
+    case BME280_LAYOUT_H5: {
+      value = ((int32_t)((int8_t)(at[1])) * 16) | (at[0] >> 4);
+      break;
+    }
+    default: {
+      break;
+    }
+    }
+    pointer->dig[i] = value;
+  }
+}
+
+const char *bme280_calibration_name(bme280_dig_t dig) {
+  return (dig < BME280_DIG_COUNT) ? bme280_calibration_layout[dig].name : "?";
+}
+
+// Compensation per Bosch BME280 datasheet section 4.2.3
+int32_t bme280_compensate_temperature(const bme280_calibration_t *pointer,
+                                      int32_t adc_T, int32_t *t_fine) {
+  const int32_t dig_T1 = pointer->dig[BME280_DIG_T1];
+  const int32_t dig_T2 = pointer->dig[BME280_DIG_T2];
+  const int32_t dig_T3 = pointer->dig[BME280_DIG_T3];
+  // https://github.com/boschsensortec/BME280_SensorAPI/blob/c90d419492e26dd95586598a794e65eb2760753a/bme280.c#L1247
+  int32_t t_var1, t_var2;
+  t_var1 = ((adc_T / 8) - (dig_T1 * 2));
+  t_var1 = (t_var1 * dig_T2) / 2048;
+  t_var2 = ((adc_T / 16) - dig_T1);
+  t_var2 = (((t_var2 * t_var2) / 4096) * dig_T3) / 16384;
+  *t_fine = t_var1 + t_var2;
+  return (*t_fine * 5 + 128) / 256;
+}
+
+uint32_t bme280_compensate_pressure(const bme280_calibration_t *pointer,
+                                    int32_t t_fine, uint32_t adc_P) {
+#if defined(CONFIG_I2CMUX_BME280_PRESSURE_INT32)
+  return bme280_compensate_pressure_int32(pointer, t_fine, adc_P);
+#elif defined(CONFIG_I2CMUX_BME280_PRESSURE_FLOAT)
+  return bme280_compensate_pressure_float(pointer, t_fine, adc_P);
+#else
+  return bme280_compensate_pressure_int64(pointer, t_fine, adc_P);
+#endif
+}
+
+uint32_t bme280_compensate_pressure_int64(const bme280_calibration_t *pointer,
+                                          int32_t t_fine, uint32_t adc_P) {
+  const int64_t dig_P1 = pointer->dig[BME280_DIG_P1];
+  const int64_t dig_P2 = pointer->dig[BME280_DIG_P2];
+  const int64_t dig_P3 = pointer->dig[BME280_DIG_P3];
+  const int64_t dig_P4 = pointer->dig[BME280_DIG_P4];
+  const int64_t dig_P5 = pointer->dig[BME280_DIG_P5];
+  const int64_t dig_P6 = pointer->dig[BME280_DIG_P6];
+  const int64_t dig_P7 = pointer->dig[BME280_DIG_P7];
+  const int64_t dig_P8 = pointer->dig[BME280_DIG_P8];
+  const int64_t dig_P9 = pointer->dig[BME280_DIG_P9];
+  // https://github.com/boschsensortec/BME280_SensorAPI/blob/c90d419492e26dd95586598a794e65eb2760753a/bme280.c#L1281
+  int64_t p_var1, p_var2, p_var3, p_var4;
+  p_var1 = ((int64_t)t_fine) - 128000;
+  p_var2 = p_var1 * p_var1 * dig_P6;
+  p_var2 = p_var2 + ((p_var1 * dig_P5) * 131072);
+  p_var2 = p_var2 + (dig_P4 * 34359738368);
+  p_var1 = ((p_var1 * p_var1 * dig_P3) / 256) + ((p_var1 * dig_P2) * 4096);
+  p_var3 = ((int64_t)1) * 140737488355328;
+  p_var1 = (p_var3 + p_var1) * dig_P1 / 8589934592;
+  if (p_var1 == 0) {
+    return 0;
+  }
+  p_var4 = 1048576 - (int64_t)adc_P;
+  p_var4 = (((p_var4 * (int64_t)2147483648) - p_var2) * 3125) / p_var1;
+  p_var1 = (dig_P9 * (p_var4 / 8192) * (p_var4 / 8192)) / 33554432;
+  p_var2 = (dig_P8 * p_var4) / 524288;
+  p_var4 = ((p_var4 + p_var1 + p_var2) / 256) + (dig_P7 * 16);
+  return (uint32_t)(((p_var4 / 2) * 100) / 128);
+}
+
+// The int64_t divisions above are software routines on the LX6, this only
+// needs its hardware 32 bit divider
+uint32_t bme280_compensate_pressure_int32(const bme280_calibration_t *pointer,
+                                          int32_t t_fine, uint32_t adc_P) {
+  const int32_t dig_P1 = pointer->dig[BME280_DIG_P1];
+  const int32_t dig_P2 = pointer->dig[BME280_DIG_P2];
+  const int32_t dig_P3 = pointer->dig[BME280_DIG_P3];
+  const int32_t dig_P4 = pointer->dig[BME280_DIG_P4];
+  const int32_t dig_P5 = pointer->dig[BME280_DIG_P5];
+  const int32_t dig_P6 = pointer->dig[BME280_DIG_P6];
+  const int32_t dig_P7 = pointer->dig[BME280_DIG_P7];
+  const int32_t dig_P8 = pointer->dig[BME280_DIG_P8];
+  const int32_t dig_P9 = pointer->dig[BME280_DIG_P9];
+  // per compensate_pressure without BME280_64BIT_ENABLE in the same Bosch
+  // BME280_SensorAPI revision
+  int32_t p_var1, p_var2, p_var3, p_var4;
+  uint32_t p_var5, pressure;
+  p_var1 = (t_fine / 2) - (int32_t)64000;
+  p_var2 = (((p_var1 / 4) * (p_var1 / 4)) / 2048) * dig_P6;
+  p_var2 = p_var2 + ((p_var1 * dig_P5) * 2);
+  p_var2 = (p_var2 / 4) + (dig_P4 * 65536);
+  p_var3 = (dig_P3 * (((p_var1 / 4) * (p_var1 / 4)) / 8192)) / 8;
+  p_var4 = (dig_P2 * p_var1) / 2;
+  p_var1 = (p_var3 + p_var4) / 262144;
+  p_var1 = ((32768 + p_var1) * dig_P1) / 32768;
+  if (p_var1 == 0) {
+    return 0;
+  }
+  p_var5 = (uint32_t)1048576 - adc_P;
+  pressure = ((uint32_t)(p_var5 - (uint32_t)(p_var2 / 4096))) * 3125;
+  if (pressure < 0x80000000) {
+    pressure = (pressure << 1) / ((uint32_t)p_var1);
+  } else {
+    pressure = (pressure / (uint32_t)p_var1) * 2;
+  }
+  p_var1 = (dig_P9 * ((int32_t)(((pressure / 8) * (pressure / 8)) / 8192))) /
+           4096;
+  p_var2 = (((int32_t)(pressure / 4)) * dig_P8) / 8192;
+  pressure = (uint32_t)((int32_t)pressure + ((p_var1 + p_var2 + dig_P7) / 16));
+  return pressure * 100;
+}
+
+// Divisions by powers of two are exact, only the one by p_var1 is a real
+// division on the FPU
+uint32_t bme280_compensate_pressure_float(const bme280_calibration_t *pointer,
+                                          int32_t t_fine, uint32_t adc_P) {
+  const float dig_P1 = (float)pointer->dig[BME280_DIG_P1];
+  const float dig_P2 = (float)pointer->dig[BME280_DIG_P2];
+  const float dig_P3 = (float)pointer->dig[BME280_DIG_P3];
+  const float dig_P4 = (float)pointer->dig[BME280_DIG_P4];
+  const float dig_P5 = (float)pointer->dig[BME280_DIG_P5];
+  const float dig_P6 = (float)pointer->dig[BME280_DIG_P6];
+  const float dig_P7 = (float)pointer->dig[BME280_DIG_P7];
+  const float dig_P8 = (float)pointer->dig[BME280_DIG_P8];
+  const float dig_P9 = (float)pointer->dig[BME280_DIG_P9];
+  // per compensate_pressure with BME280_DOUBLE_ENABLE in the same Bosch
+  // BME280_SensorAPI revision
+  float p_var1, p_var2, p_var3, pressure;
+  p_var1 = ((float)t_fine / 2.0f) - 64000.0f;
+  p_var2 = p_var1 * p_var1 * dig_P6 / 32768.0f;
+  p_var2 = p_var2 + p_var1 * dig_P5 * 2.0f;
+  p_var2 = (p_var2 / 4.0f) + (dig_P4 * 65536.0f);
+  p_var3 = dig_P3 * p_var1 * p_var1 / 524288.0f;
+  p_var1 = (p_var3 + dig_P2 * p_var1) / 524288.0f;
+  p_var1 = (1.0f + p_var1 / 32768.0f) * dig_P1;
+  if (!(p_var1 > 0.0f)) {
+    return 0;
+  }
+  pressure = 1048576.0f - (float)adc_P;
+  pressure = (pressure - (p_var2 / 4096.0f)) * 6250.0f / p_var1;
+  p_var1 = dig_P9 * pressure * pressure / 2147483648.0f;
+  p_var2 = pressure * dig_P8 / 32768.0f;
+  pressure = pressure + (p_var1 + p_var2 + dig_P7) / 16.0f;
+  if (!(pressure > 0.0f)) {
+    return 0;
+  }
+  return (uint32_t)(pressure * 100.0f + 0.5f);
+}
+
+bme280_pressure_fn_t bme280_pressure_backend(bme280_pressure_t backend) {
+  switch (backend) {
+  case BME280_PRESSURE_INT32: {
+    return bme280_compensate_pressure_int32;
+  }
+  case BME280_PRESSURE_FLOAT: {
+    return bme280_compensate_pressure_float;
+  }
+  default: {
+    return bme280_compensate_pressure_int64;
+  }
+  }
+}
+
+const char *bme280_pressure_name(bme280_pressure_t backend) {
+  switch (backend) {
+  case BME280_PRESSURE_INT64: {
+    return "int64";
+  }
+  case BME280_PRESSURE_INT32: {
+    return "int32";
+  }
+  case BME280_PRESSURE_FLOAT: {
+    return "float";
+  }
+  default: {
+    return "?";
+  }
+  }
+}
+
+uint32_t bme280_compensate_humidity(const bme280_calibration_t *pointer,
+                                    int32_t t_fine, int32_t adc_H) {
+  const int32_t dig_H1 = pointer->dig[BME280_DIG_H1];
+  const int32_t dig_H2 = pointer->dig[BME280_DIG_H2];
+  const int32_t dig_H3 = pointer->dig[BME280_DIG_H3];
+  const int32_t dig_H4 = pointer->dig[BME280_DIG_H4];
+  const int32_t dig_H5 = pointer->dig[BME280_DIG_H5];
+  const int32_t dig_H6 = pointer->dig[BME280_DIG_H6];
+  // per compensate_humidity in the same Bosch BME280_SensorAPI revision
+  int32_t h_var1, h_var2, h_var3, h_var4, h_var5;
+  h_var1 = t_fine - ((int32_t)76800);
+  h_var2 = (int32_t)(adc_H * 16384);
+  h_var3 = (int32_t)(dig_H4 * 1048576);
+  h_var4 = dig_H5 * h_var1;
+  h_var5 = (((h_var2 - h_var3) - h_var4) + (int32_t)16384) / 32768;
+  h_var2 = (h_var1 * dig_H6) / 1024;
+  h_var3 = (h_var1 * dig_H3) / 2048;
+  h_var4 = ((h_var2 * (h_var3 + (int32_t)32768)) / 1024) + (int32_t)2097152;
+  h_var2 = ((h_var4 * dig_H2) + 8192) / 16384;
+  h_var3 = h_var5 * h_var2;
+  h_var4 = ((h_var3 / 32768) * (h_var3 / 32768)) / 128;
+  h_var5 = h_var3 - ((h_var4 * dig_H1) / 16);
+  h_var5 = (h_var5 < 0 ? 0 : h_var5);
+  h_var5 = (h_var5 > 419430400 ? 419430400 : h_var5);
+  return (uint32_t)(h_var5 / 4096);
+}
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "bme280_bench.h"
+#include "sdkconfig.h"
+
+#ifdef CONFIG_IDF_TARGET_LINUX
+#include <time.h>
+
+#define BME280_BENCH_UNIT "ns"
+
+static uint32_t bme280_bench_now(void) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (uint32_t)(now.tv_sec * 1000000000LL + now.tv_nsec);
+}
+#else
+#include "esp_cpu.h"
+
+#define BME280_BENCH_UNIT "cycles"
+
+static uint32_t bme280_bench_now(void) { return esp_cpu_get_cycle_count(); }
+#endif
+
+// Readings to sweep per round, enough to defeat constant folding but few
+// enough that the loop overhead stays negligible
+#define BME280_BENCH_READINGS 16
+
+void bme280_bench(const bme280_calibration_t *calibration, uint32_t rounds,
+                  bme280_bench_t *result) {
+  // 25 C, 1013 hPa give or take with typical trimming
+  int32_t t_fine;
+  bme280_compensate_temperature(calibration, 519888, &t_fine);
+  volatile uint32_t sink = 0;
+  for (uint32_t backend = 0; backend < BME280_PRESSURE_COUNT; backend++) {
+    const bme280_pressure_fn_t compensate = bme280_pressure_backend(backend);
+    uint32_t sum = 0;
+    // Wrapping subtraction keeps a 32 bit cycle counter usable
+    const uint32_t begin = bme280_bench_now();
+    for (uint32_t round = 0; round < rounds; round++) {
+      for (uint32_t i = 0; i < BME280_BENCH_READINGS; i++) {
+        sum += compensate(calibration, t_fine, 380000 + i * 4096);
+      }
+    }
+    const uint32_t elapsed = bme280_bench_now() - begin;
+    sink += sum;
+    result->per_call[backend] =
+        (float)elapsed / ((float)rounds * BME280_BENCH_READINGS);
+  }
+  (void)sink;
+  result->unit = BME280_BENCH_UNIT;
+}
@@ -0,0 +1,185 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "bme280.h"
+#include "bme280_bench.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Trimming values from the Bosch BME280 datasheet's compensation example,
+// humidity values are typical of a real part.
+static const int32_t reference[BME280_DIG_COUNT] = {
+    [BME280_DIG_T1] = 27504, [BME280_DIG_T2] = 26435, [BME280_DIG_T3] = -1000,
+    [BME280_DIG_P1] = 36477, [BME280_DIG_P2] = -10685, [BME280_DIG_P3] = 3024,
+    [BME280_DIG_P4] = 2855,  [BME280_DIG_P5] = 140,    [BME280_DIG_P6] = -7,
+    [BME280_DIG_P7] = 15500, [BME280_DIG_P8] = -14600, [BME280_DIG_P9] = 6000,
+    [BME280_DIG_H1] = 75,    [BME280_DIG_H2] = 362,    [BME280_DIG_H3] = 0,
+    [BME280_DIG_H4] = 313,   [BME280_DIG_H5] = 50,     [BME280_DIG_H6] = 30,
+};
+
+static void put16(uint8_t *raw, int32_t value) {
+  raw[0] = (uint8_t)(value & 0xFF);
+  raw[1] = (uint8_t)((value >> 8) & 0xFF);
+}
+
+// Lays out coefficients the way the BME280 stores them, 0x88 to 0xA1 then
+// 0xE1 to 0xE7
+static void encode(uint8_t *raw, const int32_t *dig) {
+  memset(raw, 0, BME280_CALIBRATION_RAW_SIZE);
+  for (uint32_t i = BME280_DIG_T1; i <= BME280_DIG_P9; i++) {
+    put16(raw + i * 2, dig[i]);
+  }
+  raw[25] = (uint8_t)(dig[BME280_DIG_H1]);
+  put16(raw + 26, dig[BME280_DIG_H2]);
+  raw[28] = (uint8_t)(dig[BME280_DIG_H3]);
+  raw[29] = (uint8_t)((dig[BME280_DIG_H4] >> 4) & 0xFF);
+  raw[30] = (uint8_t)((dig[BME280_DIG_H4] & 0x0F) |
+                      ((dig[BME280_DIG_H5] & 0x0F) << 4));
+  raw[31] = (uint8_t)((dig[BME280_DIG_H5] >> 4) & 0xFF);
+  raw[32] = (uint8_t)(dig[BME280_DIG_H6]);
+}
+
+// Allowed deviation from the 64 bit reference in hundredths of a Pa, under
+// the sensor's own +-12 Pa relative accuracy
+#define PRESSURE_BUDGET 1000
+
+#define BENCH_ROUNDS 100000
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+static void test_decode(void) {
+  uint8_t raw[BME280_CALIBRATION_RAW_SIZE];
+  bme280_calibration_t calibration;
+  encode(raw, reference);
+  bme280_calibration_decode(&calibration, raw);
+  TEST_ASSERT_EQUAL_INT32_ARRAY(reference, calibration.dig, BME280_DIG_COUNT);
+}
+
+// dig_H4 and dig_H5 share 0xE5, a negative value must not spill into the other
+static void test_decode_negative_nibbles(void) {
+  int32_t dig[BME280_DIG_COUNT];
+  memcpy(dig, reference, sizeof(dig));
+  dig[BME280_DIG_H4] = -291;
+  dig[BME280_DIG_H5] = -1;
+  dig[BME280_DIG_H6] = -30;
+  uint8_t raw[BME280_CALIBRATION_RAW_SIZE];
+  bme280_calibration_t calibration;
+  encode(raw, dig);
+  bme280_calibration_decode(&calibration, raw);
+  TEST_ASSERT_EQUAL_INT32_ARRAY(dig, calibration.dig, BME280_DIG_COUNT);
+}
+
+static void test_compensate(void) {
+  uint8_t raw[BME280_CALIBRATION_RAW_SIZE];
+  bme280_calibration_t calibration;
+  encode(raw, reference);
+  bme280_calibration_decode(&calibration, raw);
+
+  // 25.08 C and 100653.27 Pa in the datasheet example. The datasheet's
+  // t_fine of 128422 comes from arithmetic shifts, the SensorAPI divides and
+  // rounds the negative dig_T3 term the other way.
+  int32_t t_fine;
+  TEST_ASSERT_EQUAL_INT32(
+      2508, bme280_compensate_temperature(&calibration, 519888, &t_fine));
+  TEST_ASSERT_EQUAL_INT32(128423, t_fine);
+  TEST_ASSERT_EQUAL_UINT32(
+      10065328, bme280_compensate_pressure(&calibration, t_fine, 415148));
+  // 55.00 %RH from the datasheet's floating point formula
+  TEST_ASSERT_EQUAL_UINT32(
+      56317, bme280_compensate_humidity(&calibration, t_fine, 30000));
+}
+
+static void test_compensate_invalid(void) {
+  bme280_calibration_t calibration;
+  memset(&calibration, 0, sizeof(calibration));
+  TEST_ASSERT_EQUAL_UINT32(0,
+                           bme280_compensate_pressure(&calibration, 0, 415148));
+}
+
+// Worst deviation from the 64 bit reference over the ADC range, where the
+// temperature is -40 to 85 C and the reference 300 to 1100 hPa as the
+// sensor is specified. UINT32_MAX if nothing was in range.
+static uint32_t pressure_error(bme280_pressure_t backend) {
+  uint8_t raw[BME280_CALIBRATION_RAW_SIZE];
+  bme280_calibration_t calibration;
+  encode(raw, reference);
+  bme280_calibration_decode(&calibration, raw);
+  const bme280_pressure_fn_t compensate = bme280_pressure_backend(backend);
+
+  uint32_t worst = 0, samples = 0;
+  for (int32_t adc_T = 0; adc_T < (1 << 20); adc_T += 4096) {
+    int32_t t_fine;
+    const int32_t temperature =
+        bme280_compensate_temperature(&calibration, adc_T, &t_fine);
+    if (temperature < -4000 || temperature > 8500) {
+      continue;
+    }
+    for (uint32_t adc_P = 0; adc_P < (1 << 20); adc_P += 97) {
+      const uint32_t expected =
+          bme280_compensate_pressure_int64(&calibration, t_fine, adc_P);
+      if (expected < 3000000 || expected > 11000000) {
+        continue;
+      }
+      const uint32_t actual = compensate(&calibration, t_fine, adc_P);
+      const uint32_t error =
+          (actual > expected) ? actual - expected : expected - actual;
+      worst = (error > worst) ? error : worst;
+      samples++;
+    }
+  }
+  return (samples > 0) ? worst : UINT32_MAX;
+}
+
+static void test_pressure_int32(void) {
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(PRESSURE_BUDGET,
+                                   pressure_error(BME280_PRESSURE_INT32));
+}
+
+static void test_pressure_float(void) {
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(PRESSURE_BUDGET,
+                                   pressure_error(BME280_PRESSURE_FLOAT));
+}
+
+static void bench(void) {
+  uint8_t raw[BME280_CALIBRATION_RAW_SIZE];
+  bme280_calibration_t calibration;
+  encode(raw, reference);
+  bme280_calibration_decode(&calibration, raw);
+  bme280_bench_t result;
+  bme280_bench(&calibration, BENCH_ROUNDS, &result);
+  for (uint32_t i = 0; i < BME280_PRESSURE_COUNT; i++) {
+    printf("%s: %.1f %s/compensation, %.2f Pa worst error\n",
+           bme280_pressure_name(i), result.per_call[i], result.unit,
+           (i == BME280_PRESSURE_INT64) ? 0.0 : pressure_error(i) / 100.0);
+  }
+}
+
+void app_main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_decode);
+  RUN_TEST(test_decode_negative_nibbles);
+  RUN_TEST(test_compensate);
+  RUN_TEST(test_compensate_invalid);
+  RUN_TEST(test_pressure_int32);
+  RUN_TEST(test_pressure_float);
+  const int failures = UNITY_END();
+
+  bench();
+  exit(failures);
+}
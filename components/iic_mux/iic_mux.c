@@ -17,18 +17,285 @@
 #include "driver/i2c_master.h"
 #include "esp_err.h"
 #include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/timers.h"
+#include <stdbool.h>
 #include <stdint.h>
+#include <string.h>
+#include <sys/time.h>
 
 static const char *TAG = "iic_mux";
 
+// Pended alongside the i2c_master events when the conversion wait is over
+#define I2CMUX_WAKE 0xFF
+// How long a conversion gets to finish past its declared time, per recheck
+#define I2CMUX_RECHECK_US 1000
+#define I2CMUX_RECHECKS 3
+// A transaction may wait behind a full queue of others before its own turn
+#define I2CMUX_WATCHDOG_US                                                     \
+  ((uint64_t)(CONFIG_I2CMUX_TIMEOUT_MS) * 1000 * (I2CMUX_QUEUE_DEPTH + 1))
+
+static void iic_mux_begin(iic_mux_device_t *);
+
+// Ends the sample, compensating it if the bus delivered
+static void iic_mux_finish(iic_mux_device_t *device, esp_err_t ret) {
+  const int64_t latency_us = esp_timer_get_time() - device->begin_us;
+  device->latency_us = latency_us;
+  if (latency_us > device->latency_max_us) {
+    device->latency_max_us = latency_us;
+  }
+
+  if (ret == ESP_OK) {
+    (device->samples)++;
+    ESP_LOGI(TAG,
+             "%s sample took %" PRIu32 " transactions, %" PRId64
+             " us on the bus, %" PRId64 " us overall",
+             device->driver->name, device->transactions, device->bus_us,
+             latency_us);
+  } else {
+    (device->errors)++;
+    ESP_LOGW(TAG, "%s sample failed: %s", device->driver->name,
+             esp_err_to_name(ret));
+  }
+
+  // Nothing of this sample may wake the device once it's idle
+  esp_timer_stop(device->timer);
+  iic_mux_callback_t callback = device->callback;
+  void *user_data = device->user_data;
+  device->state = I2CMUX_STATE_IDLE;
+  device->busy = false;
+  if (callback != NULL) {
+    callback(device, ret, user_data);
+  }
+}
+
+// Arms the device's timer, replacing whatever it was armed for
+static esp_err_t iic_mux_arm(iic_mux_device_t *device, uint64_t wait_us) {
+  esp_timer_stop(device->timer);
+  device->timer_due_us = esp_timer_get_time() + (int64_t)(wait_us);
+  return esp_timer_start_once(device->timer, wait_us);
+}
+
+// Starts the sample over while retries last
+static void iic_mux_retry(iic_mux_device_t *device, esp_err_t ret) {
+  if (device->retries_left == 0) {
+    iic_mux_finish(device, ret);
+    return;
+  }
+  (device->retries_left)--;
+  (device->retries)++;
+  ESP_LOGW(TAG, "%s transaction failed: %s, retrying", device->driver->name,
+           esp_err_to_name(ret));
+  iic_mux_begin(device);
+}
+
+// Has the driver queue a transaction, its completion comes back through the
+// ISR
+static void iic_mux_issue(iic_mux_device_t *device, iic_mux_state_t state) {
+  device->state = state;
+  device->issue_us = esp_timer_get_time();
+  (device->transactions)++;
+  // Fails the sample if the completion never comes back. Armed first, as
+  // the completion may be pended before the driver call returns.
+  if (iic_mux_arm(device, I2CMUX_WATCHDOG_US) != ESP_OK) {
+    ESP_LOGW(TAG, "%s transaction has no watchdog", device->driver->name);
+  }
+  const esp_err_t ret = (state == I2CMUX_STATE_TRIGGER)
+                            ? device->driver->trigger(device)
+                            : device->driver->read(device);
+  if (ret != ESP_OK) {
+    esp_timer_stop(device->timer);
+    iic_mux_retry(device, ret);
+  }
+}
+
+static void iic_mux_begin(iic_mux_device_t *device) {
+  device->rechecks = 0;
+  iic_mux_issue(device, (device->driver->trigger != NULL)
+                            ? I2CMUX_STATE_TRIGGER
+                            : I2CMUX_STATE_READ);
+}
+
+// Pended by iic_mux_sample, so samples start in the timer service task too
+static void iic_mux_launch(void *user_data, uint32_t unused) {
+  iic_mux_begin(user_data);
+}
+
+// Waits without a task, the wake is pended like a bus event
+static void iic_mux_sleep(iic_mux_device_t *device, uint64_t wait_us) {
+  device->state = I2CMUX_STATE_WAIT;
+  const esp_err_t ret = iic_mux_arm(device, wait_us);
+  if (ret != ESP_OK) {
+    iic_mux_retry(device, ret);
+  }
+}
+
+static void iic_mux_complete(iic_mux_device_t *device) {
+  if (!device->busy) {
+    return;
+  }
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  device->record.timestamp_us =
+      (int64_t)(time.tv_sec) * 1000000 + time.tv_usec;
+  device->record.mask = 0;
+  const esp_err_t ret = device->driver->compensate(device);
+  if (ret == ESP_ERR_NOT_FINISHED && device->rechecks < I2CMUX_RECHECKS) {
+    (device->rechecks)++;
+    iic_mux_sleep(device, I2CMUX_RECHECK_US);
+    return;
+  }
+  iic_mux_finish(device, ret);
+}
+
+// Runs in the timer service task, everything but the ISR happens here
+static void iic_mux_advance(void *user_data, uint32_t event) {
+  iic_mux_device_t *device = user_data;
+  // A completion that turns up after the watchdog ended its sample
+  if (device->state == I2CMUX_STATE_IDLE) {
+    return;
+  }
+  if (event == I2CMUX_WAKE) {
+    // Left over from an earlier arming of the timer
+    if (esp_timer_get_time() < device->timer_due_us) {
+      return;
+    }
+    // The watchdog, the transaction's completion never came back
+    if (device->state == I2CMUX_STATE_TRIGGER ||
+        device->state == I2CMUX_STATE_READ) {
+      device->bus_us += esp_timer_get_time() - device->issue_us;
+      iic_mux_finish(device, ESP_ERR_TIMEOUT);
+      return;
+    }
+  } else {
+    esp_timer_stop(device->timer);
+    device->bus_us += esp_timer_get_time() - device->issue_us;
+    if (event != I2C_EVENT_DONE) {
+      iic_mux_retry(device, (event == I2C_EVENT_TIMEOUT) ? ESP_ERR_TIMEOUT
+                                                         : ESP_FAIL);
+      return;
+    }
+  }
+
+  switch (device->state) {
+  case I2CMUX_STATE_TRIGGER: {
+    iic_mux_sleep(device, device->conversion_us);
+    break;
+  }
+  case I2CMUX_STATE_WAIT: {
+    iic_mux_issue(device, I2CMUX_STATE_READ);
+    break;
+  }
+  case I2CMUX_STATE_READ: {
+    iic_mux_complete(device);
+    break;
+  }
+  default: {
+    break;
+  }
+  }
+}
+
+static bool iic_mux_done(i2c_master_dev_handle_t handle,
+                         const i2c_master_event_data_t *event,
+                         void *user_data) {
+  if (event->event == I2C_EVENT_ALIVE) {
+    return false;
+  }
+  BaseType_t woken = pdFALSE;
+  if (xTimerPendFunctionCallFromISR(iic_mux_advance, user_data, event->event,
+                                    &woken) != pdPASS) {
+    // The timer command queue is full, the watchdog ends the sample
+    iic_mux_device_t *device = user_data;
+    (device->errors)++;
+  }
+  return woken == pdTRUE;
+}
+
+static void iic_mux_wake(void *user_data) {
+  xTimerPendFunctionCall(iic_mux_advance, user_data, I2CMUX_WAKE,
+                         portMAX_DELAY);
+}
+
+// Brings one registered device up, false if it has to be dropped
+static bool iic_mux_device_start(iic_mux_t *pointer,
+                                 iic_mux_device_t *device) {
+  const iic_mux_driver_t *driver = device->driver;
+  i2c_device_config_t config = {
+      .dev_addr_length = I2C_ADDR_BIT_LEN_7,
+      .device_address = driver->address,
+      .scl_speed_hz = driver->scl_speed_hz,
+  };
+  device->bus_handle = pointer->bus_handle;
+  esp_err_t ret =
+      i2c_master_bus_add_device(pointer->bus_handle, &config, &device->handle);
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "Can't add %s: %s", driver->name, esp_err_to_name(ret));
+    return false;
+  }
+
+  device->context = calloc(1, driver->context_size);
+  ret = (device->context == NULL) ? ESP_ERR_NO_MEM : driver->probe(device);
+  if (ret == ESP_OK) {
+    ret = driver->start(device);
+  }
+  if (ret == ESP_OK) {
+    const esp_timer_create_args_t timer_config = {
+        .callback = iic_mux_wake,
+        .arg = device,
+        .name = driver->name,
+    };
+    ret = esp_timer_create(&timer_config, &device->timer);
+  }
+  if (ret == ESP_OK) {
+    // The device is done with blocking transactions, samples from here on
+    // finish in the ISR
+    const i2c_master_event_callbacks_t callbacks = {
+        .on_trans_done = iic_mux_done,
+    };
+    ret = i2c_master_register_event_callbacks(device->handle, &callbacks,
+                                              device);
+    if (ret != ESP_OK) {
+      esp_timer_delete(device->timer);
+    }
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "Dropping %s at 0x%02x: %s", driver->name, driver->address,
+             esp_err_to_name(ret));
+    i2c_master_bus_rm_device(device->handle);
+    free(device->context);
+    return false;
+  }
+
+  device->period_us = (int64_t)(driver->period_ms) * 1000;
+  device->deadline_us = esp_timer_get_time();
+  ESP_LOGI(TAG, "%s is up, sampling every %" PRIu32 " ms", driver->name,
+           driver->period_ms);
+  return true;
+}
+
 void iic_mux_init(iic_mux_t **pointer) {
   *pointer = malloc(sizeof(iic_mux_t));
   iic_mux_fill(*pointer);
 }
 
-void iic_mux_fill(iic_mux_t *pointer) {
-  pointer->bme280_pressure = 0;
-  pointer->bme280_temperature = 0;
+void iic_mux_fill(iic_mux_t *pointer) { pointer->device_count = 0; }
+
+esp_err_t iic_mux_register(iic_mux_t *pointer,
+                           const iic_mux_driver_t *driver) {
+  if (pointer->device_count == I2CMUX_DEVICES_MAX) {
+    return ESP_ERR_NO_MEM;
+  }
+  iic_mux_device_t *device = calloc(1, sizeof(iic_mux_device_t));
+  if (device == NULL) {
+    return ESP_ERR_NO_MEM;
+  }
+  device->driver = driver;
+  pointer->devices[pointer->device_count] = device;
+  (pointer->device_count)++;
+  return ESP_OK;
 }
 
 void iic_mux_start(iic_mux_t *pointer) {
@@ -39,149 +306,133 @@ void iic_mux_start(iic_mux_t *pointer) {
       .scl_io_num = GPIO_NUM_22,
       .sda_io_num = GPIO_NUM_21,
       .glitch_ignore_cnt = 7,
+      // Transactions are queued and finish in the ISR
+      .trans_queue_depth = I2CMUX_QUEUE_DEPTH,
       .flags.enable_internal_pullup = true,
   };
 
   ESP_ERROR_CHECK(i2c_new_master_bus(&i2c_config, &pointer->bus_handle));
 
-#ifdef CONFIG_I2CMUX_BME280
-  ESP_LOGI(TAG, "BME280 is enabled");
-  i2c_device_config_t bme280_config = {
-      .dev_addr_length = I2C_ADDR_BIT_LEN_7,
-      .device_address = 0x77,
-      .scl_speed_hz = 400000,
-  };
-  ESP_ERROR_CHECK(i2c_master_bus_add_device(pointer->bus_handle, &bme280_config,
-                                            &pointer->bme280_handle));
-
-  ESP_LOGI(TAG, "Handling BME280 settings...");
-  const uint8_t write_iir[2] = {0xf5, 0b000100000};
-  ESP_ERROR_CHECK(
-      i2c_master_transmit(pointer->bme280_handle, write_iir, 2, 500));
-
-  ESP_LOGI(TAG, "Reading BME280 temperature calibration data...");
-  const uint8_t read_dig_T[1] = {0x88};
-  ESP_ERROR_CHECK(i2c_master_transmit_receive(
-      pointer->bme280_handle, read_dig_T, 1, pointer->bme280_buf_dig_T,
-      I2CMUX_DIG_TEMPERATURE_SIZE * 2, 1000));
-  pointer->bme280_temperature_coeff_1 = pointer->bme280_buf_dig_T[1];
-  pointer->bme280_temperature_coeff_1 <<= 8;
-  pointer->bme280_temperature_coeff_1 |= pointer->bme280_buf_dig_T[0];
-  ESP_LOGI(TAG, "| dig_T1 |  %5hu |", pointer->bme280_temperature_coeff_1);
-  for (uint32_t i = 1; i < I2CMUX_DIG_TEMPERATURE_SIZE; i++) {
-    uint16_t calibration = pointer->bme280_buf_dig_T[i * 2 + 1];
-    calibration <<= 8;
-    calibration |= pointer->bme280_buf_dig_P[i * 2 + 0];
-    pointer->bme280_temperature_coeffs[i] = (int16_t)(calibration);
-    ESP_LOGI(TAG, "| dig_T%01u | %6hd |", i + 1,
-             pointer->bme280_temperature_coeffs[i - 1]);
-  }
-
-  ESP_LOGI(TAG, "Reading BME280 pressure calibration data...");
-  const uint8_t read_dig_P[1] = {0x8E};
-  ESP_ERROR_CHECK(i2c_master_transmit_receive(
-      pointer->bme280_handle, read_dig_P, 1, pointer->bme280_buf_dig_P,
-      I2CMUX_DIG_PRESSURE_SIZE * 2, 1000));
-  pointer->bme280_pressure_coeff_1 = pointer->bme280_buf_dig_P[1];
-  pointer->bme280_pressure_coeff_1 <<= 8;
-  pointer->bme280_pressure_coeff_1 |= pointer->bme280_buf_dig_P[0];
-  ESP_LOGI(TAG, "| dig_P1 |  %5hu |", pointer->bme280_pressure_coeff_1);
-  for (uint32_t i = 1; i < I2CMUX_DIG_PRESSURE_SIZE; i++) {
-    uint16_t calibration = pointer->bme280_buf_dig_P[i * 2 + 1];
-    calibration <<= 8;
-    calibration |= pointer->bme280_buf_dig_P[i * 2 + 0];
-    pointer->bme280_pressure_coeffs[i] = (int16_t)(calibration);
-    ESP_LOGI(TAG, "| dig_P%01u | %6hd |", i + 1,
-             pointer->bme280_pressure_coeffs[i - 1]);
-  }
-#else
-  ESP_LOGI(TAG, "BME280 is disabled");
-#endif
-}
-
-void iic_mux_refresh(iic_mux_t *pointer) {
-#ifdef CONFIG_I2CMUX_BME280
-  ESP_LOGI(TAG, "Handling BME280 now...");
-  const uint8_t write_oversampling[2] = {0xf4, 0b10110101};
-  ESP_ERROR_CHECK(
-      i2c_master_transmit(pointer->bme280_handle, write_oversampling, 2, 500));
-
-  const uint8_t read_temperature[1] = {0xFA};
-  ESP_ERROR_CHECK(i2c_master_transmit_receive(
-      pointer->bme280_handle, read_temperature, 1,
-      pointer->bme280_buf_temperature, I2CMUX_BUF_TEMPERATURE_SIZE, 250));
-  const uint8_t read_pressure[1] = {0xF7};
-  ESP_ERROR_CHECK(i2c_master_transmit_receive(
-      pointer->bme280_handle, read_pressure, 1, pointer->bme280_buf_pressure,
-      I2CMUX_BUF_PRESSURE_SIZE, 250));
-  uint32_t adc_Tu = 0;
-  adc_Tu |= pointer->bme280_buf_temperature[0];
-  adc_Tu <<= 8;
-  adc_Tu |= pointer->bme280_buf_temperature[1];
-  adc_Tu <<= 8;
-  adc_Tu |= pointer->bme280_buf_temperature[2];
-  adc_Tu >>= 4;
-  int32_t adc_T = (int32_t)(adc_Tu);
-  uint32_t adc_P = 0;
-  adc_P |= pointer->bme280_buf_pressure[0];
-  adc_P <<= 8;
-  adc_P |= pointer->bme280_buf_pressure[1];
-  adc_P <<= 8;
-  adc_P |= pointer->bme280_buf_pressure[2];
-  adc_P >>= 4;
-
-  // store pressure and temperature compensated per Bosch BME280 datasheet
-  // section 4.2.3
-  // temperature is needed first
-  int32_t t_var1, t_var2, t_fine;
-  const uint16_t dig_T1 = pointer->bme280_temperature_coeff_1;
-  const int16_t dig_T2 = pointer->bme280_temperature_coeffs[0];
-  const int16_t dig_T3 = pointer->bme280_temperature_coeffs[1];
-  // https://github.com/boschsensortec/BME280_SensorAPI/blob/c90d419492e26dd95586598a794e65eb2760753a/bme280.c#L1247
-  t_var1 = ((adc_T / 8) - ((int32_t)dig_T1 * 2));
-  t_var1 = (t_var1 * ((int32_t)dig_T2)) / 2048;
-  t_var2 = ((adc_T / 16) - ((int32_t)dig_T1));
-  t_var2 = (((t_var2 * t_var2) / 4096) * ((int32_t)dig_T3)) / 16384;
-  t_fine = t_var1 + t_var2;
-  pointer->bme280_temperature = (t_fine * 5 + 128) / 256;
-
-  // get pressure next
-  int64_t p_var1, p_var2, p_var3, p_var4;
-  const uint16_t dig_P1 = pointer->bme280_pressure_coeff_1;
-  const int16_t dig_P2 = pointer->bme280_pressure_coeffs[0];
-  const int16_t dig_P3 = pointer->bme280_pressure_coeffs[1];
-  const int16_t dig_P4 = pointer->bme280_pressure_coeffs[2];
-  const int16_t dig_P5 = pointer->bme280_pressure_coeffs[3];
-  const int16_t dig_P6 = pointer->bme280_pressure_coeffs[4];
-  const int16_t dig_P7 = pointer->bme280_pressure_coeffs[5];
-  const int16_t dig_P8 = pointer->bme280_pressure_coeffs[6];
-  const int16_t dig_P9 = pointer->bme280_pressure_coeffs[7];
-  // https://github.com/boschsensortec/BME280_SensorAPI/blob/c90d419492e26dd95586598a794e65eb2760753a/bme280.c#L1281
-  p_var1 = ((int64_t)t_fine) - 128000;
-  p_var2 = p_var1 * p_var1 * (int64_t)dig_P6;
-  p_var2 = p_var2 + ((p_var1 * (int64_t)dig_P5) * 131072);
-  p_var2 = p_var2 + (((int64_t)dig_P4) * 34359738368);
-  p_var1 = ((p_var1 * p_var1 * (int64_t)dig_P3) / 256) +
-           ((p_var1 * ((int64_t)dig_P2) * 4096));
-  p_var3 = ((int64_t)1) * 140737488355328;
-  p_var1 = (p_var3 + p_var1) * ((int64_t)dig_P1) / 8589934592;
-  if (p_var1 != 0) {
-    p_var4 = 1048576 - adc_P;
-    p_var4 = (((p_var4 * (int64_t)2147483648) - p_var2) * 3125) / p_var1;
-    p_var1 = (((int64_t)dig_P9) * (p_var4 / 8192) * (p_var4 / 8192)) / 33554432;
-    p_var2 = (((int64_t)dig_P8) * p_var4) / 524288;
-    p_var4 = ((p_var4 + p_var1 + p_var2) / 256) + (((int64_t)dig_P7) * 16);
-    pointer->bme280_pressure = (uint32_t)(((p_var4 / 2) * 100) / 128);
-  } else {
-    ESP_LOGI(TAG, "Read an invalid pressure from BME280");
+  // Devices that don't come up are dropped, the rest close ranks
+  uint32_t started = 0;
+  for (uint32_t i = 0; i < pointer->device_count; i++) {
+    iic_mux_device_t *device = pointer->devices[i];
+    ESP_LOGI(TAG, "Probing %s...", device->driver->name);
+    if (iic_mux_device_start(pointer, device)) {
+      pointer->devices[started] = device;
+      started++;
+    } else {
+      free(device);
+    }
   }
-#endif
+  pointer->device_count = started;
+  ESP_LOGI(TAG, "%" PRIu32 " I2C devices started", started);
+}
+
+int64_t iic_mux_service(iic_mux_t *pointer, iic_mux_callback_t callback,
+                        void *user_data) {
+  const int64_t now = esp_timer_get_time();
+  // Everything due starts together, earliest deadline first, so the reads
+  // queue back to back on the bus instead of each waking it separately
+  while (true) {
+    iic_mux_device_t *due = NULL;
+    for (uint32_t i = 0; i < pointer->device_count; i++) {
+      iic_mux_device_t *device = pointer->devices[i];
+      if (device->deadline_us <= now &&
+          (due == NULL || device->deadline_us < due->deadline_us)) {
+        due = device;
+      }
+    }
+    if (due == NULL) {
+      break;
+    }
+    if (iic_mux_sample(due, callback, user_data) != ESP_OK) {
+      (due->overruns)++;
+    }
+    // Stay on the period's grid, but don't try to catch up on missed ones
+    due->deadline_us += due->period_us;
+    if (due->deadline_us <= now) {
+      due->deadline_us = now + due->period_us;
+    }
+  }
+
+  int64_t next = INT64_MAX;
+  for (uint32_t i = 0; i < pointer->device_count; i++) {
+    if (pointer->devices[i]->deadline_us < next) {
+      next = pointer->devices[i]->deadline_us;
+    }
+  }
+  return next;
+}
+
+esp_err_t iic_mux_sample(iic_mux_device_t *device, iic_mux_callback_t callback,
+                         void *user_data) {
+  if (device->busy) {
+    return ESP_ERR_INVALID_STATE;
+  }
+  device->busy = true;
+  device->callback = callback;
+  device->user_data = user_data;
+  device->transactions = 0;
+  device->bus_us = 0;
+  device->retries_left = CONFIG_I2CMUX_RETRIES;
+  device->begin_us = esp_timer_get_time();
+  if (xTimerPendFunctionCall(iic_mux_launch, device, 0, 0) != pdPASS) {
+    device->busy = false;
+    return ESP_ERR_TIMEOUT;
+  }
+  return ESP_OK;
+}
+
+// Blocking transactions are queued like the rest and then waited out
+esp_err_t iic_mux_device_read(iic_mux_device_t *device, uint8_t reg,
+                              uint8_t *buffer, size_t size) {
+  esp_err_t ret = i2c_master_transmit_receive(device->handle, &reg, 1, buffer,
+                                              size, 1000);
+  if (ret == ESP_OK) {
+    ret = i2c_master_bus_wait_all_done(device->bus_handle, 1000);
+  }
+  return ret;
+}
+
+esp_err_t iic_mux_device_write(iic_mux_device_t *device,
+                               const uint8_t *buffer, size_t size) {
+  esp_err_t ret = i2c_master_transmit(device->handle, buffer, size, 1000);
+  if (ret == ESP_OK) {
+    ret = i2c_master_bus_wait_all_done(device->bus_handle, 1000);
+  }
+  return ret;
+}
+
+esp_err_t iic_mux_device_queue_read(iic_mux_device_t *device, uint8_t reg,
+                                    size_t size) {
+  device->write[0] = reg;
+  return i2c_master_transmit_receive(device->handle, device->write, 1,
+                                     device->buffer, size,
+                                     CONFIG_I2CMUX_TIMEOUT_MS);
+}
+
+esp_err_t iic_mux_device_queue_write(iic_mux_device_t *device, uint8_t reg,
+                                     uint8_t value) {
+  device->write[0] = reg;
+  device->write[1] = value;
+  return i2c_master_transmit(device->handle, device->write, 2,
+                             CONFIG_I2CMUX_TIMEOUT_MS);
 }
 
 void iic_mux_free(iic_mux_t *pointer) {
-#ifdef CONFIG_I2CMUX_BME280
-  ESP_ERROR_CHECK(i2c_master_bus_rm_device(pointer->bme280_handle));
-#endif
+  ESP_ERROR_CHECK(i2c_master_bus_wait_all_done(pointer->bus_handle, -1));
+  for (uint32_t i = 0; i < pointer->device_count; i++) {
+    iic_mux_device_t *device = pointer->devices[i];
+    esp_timer_stop(device->timer);
+    ESP_ERROR_CHECK(esp_timer_delete(device->timer));
+    const i2c_master_event_callbacks_t callbacks = {.on_trans_done = NULL};
+    ESP_ERROR_CHECK(
+        i2c_master_register_event_callbacks(device->handle, &callbacks, NULL));
+    ESP_ERROR_CHECK(i2c_master_bus_rm_device(device->handle));
+    free(device->context);
+    free(device);
+  }
   ESP_ERROR_CHECK(i2c_del_master_bus(pointer->bus_handle));
   free(pointer);
-}
\ No newline at end of file
+}
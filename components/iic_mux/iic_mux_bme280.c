@@ -0,0 +1,306 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "iic_mux_bme280.h"
+#include "bme280.h"
+#include "bme280_bench.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_rom_crc.h"
+#include "nvs.h"
+#include "sdkconfig.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#ifdef CONFIG_I2CMUX_BME280
+static const char *TAG = "iic_mux_bme280";
+
+#define I2CMUX_BME280_MODE_SLEEP 0b00
+#define I2CMUX_BME280_MODE_FORCED 0b01
+#define I2CMUX_BME280_MODE_NORMAL 0b11
+#define I2CMUX_BME280_ADDRESS 0x77
+#define I2CMUX_NVS_NAMESPACE "iic_mux"
+
+// Status (forced mode only) then pressure, temperature and humidity from one
+// burst of 0xF3 to 0xFE
+#define I2CMUX_BME280_STATUS_SIZE 4
+#define I2CMUX_BME280_DATA_SIZE 8
+
+typedef struct {
+  // ctrl_meas without the mode bits
+  uint8_t ctrl_meas;
+  // Trimming registers, decoded or loaded from the NVS cache
+  uint8_t chip_id;
+  uint8_t buf_dig[BME280_CALIBRATION_RAW_SIZE];
+  bme280_calibration_t calibration;
+} iic_mux_bme280_t;
+
+// Decoded calibration as kept in NVS
+typedef struct {
+  uint8_t chip_id;
+  uint8_t address;
+  bme280_calibration_t calibration;
+  uint32_t crc;
+} iic_mux_bme280_cache_t;
+
+// The same again in RTC memory, so waking from deep sleep skips NVS too
+static RTC_DATA_ATTR iic_mux_bme280_cache_t iic_mux_bme280_rtc_cache;
+
+// Oversampling factor from an osrs_x setting, 0 means skipped
+static uint32_t iic_mux_bme280_oversampling(uint32_t setting) {
+  return (setting == 0) ? 0 : (1 << (setting - 1));
+}
+
+// Maximum measurement time per the BME280 datasheet appendix B. The IIR
+// filter only smooths between conversions, it doesn't lengthen them.
+static uint32_t iic_mux_bme280_measure_us(void) {
+  const uint32_t osrs_t =
+      iic_mux_bme280_oversampling(CONFIG_I2CMUX_BME280_OSRS_T);
+  const uint32_t osrs_p =
+      iic_mux_bme280_oversampling(CONFIG_I2CMUX_BME280_OSRS_P);
+  const uint32_t osrs_h =
+      iic_mux_bme280_oversampling(CONFIG_I2CMUX_BME280_OSRS_H);
+  uint32_t measure_us = 1250 + 2300 * osrs_t;
+  if (osrs_p > 0) {
+    measure_us += 2300 * osrs_p + 575;
+  }
+  if (osrs_h > 0) {
+    measure_us += 2300 * osrs_h + 575;
+  }
+  return measure_us;
+}
+
+static uint32_t iic_mux_bme280_cache_crc(const iic_mux_bme280_cache_t *cache) {
+  return esp_rom_crc32_le(0, (const uint8_t *)cache,
+                          offsetof(iic_mux_bme280_cache_t, crc));
+}
+
+// Cached calibration is keyed by chip ID and bus address
+static void iic_mux_bme280_cache_key(const iic_mux_bme280_t *bme280,
+                                     char *key, size_t size) {
+  snprintf(key, size, "bme280_%02x_%02x", bme280->chip_id,
+           I2CMUX_BME280_ADDRESS);
+}
+
+static bool iic_mux_bme280_cache_valid(const iic_mux_bme280_t *bme280,
+                                       const iic_mux_bme280_cache_t *cache) {
+  return cache->chip_id == bme280->chip_id &&
+         cache->address == I2CMUX_BME280_ADDRESS &&
+         cache->crc == iic_mux_bme280_cache_crc(cache);
+}
+
+// Loads the calibration from RTC memory or NVS, false if missing or
+// mismatched
+static bool iic_mux_bme280_cache_load(iic_mux_bme280_t *bme280) {
+  if (iic_mux_bme280_cache_valid(bme280, &iic_mux_bme280_rtc_cache)) {
+    bme280->calibration = iic_mux_bme280_rtc_cache.calibration;
+    return true;
+  }
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  iic_mux_bme280_cache_key(bme280, key, sizeof(key));
+  nvs_handle_t handle;
+  if (nvs_open(I2CMUX_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+    return false;
+  }
+  iic_mux_bme280_cache_t cache;
+  size_t size = sizeof(cache);
+  esp_err_t ret = nvs_get_blob(handle, key, &cache, &size);
+  nvs_close(handle);
+  if (ret != ESP_OK || size != sizeof(cache) ||
+      !iic_mux_bme280_cache_valid(bme280, &cache)) {
+    return false;
+  }
+  bme280->calibration = cache.calibration;
+  iic_mux_bme280_rtc_cache = cache;
+  return true;
+}
+
+// Stores the calibration to NVS, a failure only costs a read next boot
+static void iic_mux_bme280_cache_store(const iic_mux_bme280_t *bme280) {
+  char key[NVS_KEY_NAME_MAX_SIZE];
+  iic_mux_bme280_cache_key(bme280, key, sizeof(key));
+  iic_mux_bme280_cache_t cache;
+  // Padding goes into the CRC, keep it deterministic
+  memset(&cache, 0, sizeof(cache));
+  cache.chip_id = bme280->chip_id;
+  cache.address = I2CMUX_BME280_ADDRESS;
+  cache.calibration = bme280->calibration;
+  cache.crc = iic_mux_bme280_cache_crc(&cache);
+  iic_mux_bme280_rtc_cache = cache;
+  nvs_handle_t handle;
+  esp_err_t ret = nvs_open(I2CMUX_NVS_NAMESPACE, NVS_READWRITE, &handle);
+  if (ret == ESP_OK) {
+    ret = nvs_set_blob(handle, key, &cache, sizeof(cache));
+    if (ret == ESP_OK) {
+      ret = nvs_commit(handle);
+    }
+    nvs_close(handle);
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "Couldn't cache BME280 calibration: %s",
+             esp_err_to_name(ret));
+  }
+}
+
+static esp_err_t iic_mux_bme280_probe(iic_mux_device_t *device) {
+  iic_mux_bme280_t *bme280 = device->context;
+  esp_err_t ret = iic_mux_device_read(device, 0xD0, &bme280->chip_id, 1);
+  if (ret != ESP_OK) {
+    return ret;
+  }
+  ESP_LOGI(TAG, "BME280 chip ID is 0x%02x", bme280->chip_id);
+  return (bme280->chip_id == BME280_CHIP_ID) ? ESP_OK : ESP_ERR_NOT_FOUND;
+}
+
+static esp_err_t iic_mux_bme280_start(iic_mux_device_t *device) {
+  iic_mux_bme280_t *bme280 = device->context;
+  esp_err_t ret;
+
+  ESP_LOGI(TAG, "Handling BME280 settings...");
+  bme280->ctrl_meas =
+      (CONFIG_I2CMUX_BME280_OSRS_T << 5) | (CONFIG_I2CMUX_BME280_OSRS_P << 2);
+  device->conversion_us = iic_mux_bme280_measure_us();
+#ifdef CONFIG_I2CMUX_BME280_MODE_NORMAL
+  const uint8_t mode = I2CMUX_BME280_MODE_NORMAL;
+  const uint8_t standby = CONFIG_I2CMUX_BME280_STANDBY_CODE;
+#else
+  // Conversions only start when we ask, sleep until then
+  const uint8_t mode = I2CMUX_BME280_MODE_SLEEP;
+  const uint8_t standby = 0;
+#endif
+  // ctrl_hum only takes effect after a ctrl_meas write, so it goes first
+  const uint8_t write_settings[6] = {
+      0xf2, CONFIG_I2CMUX_BME280_OSRS_H,
+      0xf5, (standby << 5) | (CONFIG_I2CMUX_BME280_FILTER << 2),
+      0xf4, bme280->ctrl_meas | mode};
+  ret = iic_mux_device_write(device, write_settings, sizeof(write_settings));
+  if (ret != ESP_OK) {
+    return ret;
+  }
+  ESP_LOGI(TAG, "BME280 conversions take up to %" PRIu32 " us",
+           device->conversion_us);
+
+  if (iic_mux_bme280_cache_load(bme280)) {
+    ESP_LOGI(TAG, "Loaded cached BME280 calibration data");
+  } else {
+    ESP_LOGI(TAG, "Reading BME280 calibration data...");
+    ret = iic_mux_device_read(device, BME280_CALIBRATION_TP_REGISTER,
+                              bme280->buf_dig, BME280_CALIBRATION_TP_SIZE);
+    if (ret == ESP_OK) {
+      ret = iic_mux_device_read(
+          device, BME280_CALIBRATION_H_REGISTER,
+          bme280->buf_dig + BME280_CALIBRATION_TP_SIZE,
+          BME280_CALIBRATION_H_SIZE);
+    }
+    if (ret != ESP_OK) {
+      return ret;
+    }
+    bme280_calibration_decode(&bme280->calibration, bme280->buf_dig);
+    iic_mux_bme280_cache_store(bme280);
+  }
+  for (uint32_t i = 0; i < BME280_DIG_COUNT; i++) {
+    ESP_LOGI(TAG, "| %s | %6" PRId32 " |", bme280_calibration_name(i),
+             bme280->calibration.dig[i]);
+  }
+
+#ifdef CONFIG_I2CMUX_BME280_BENCHMARK
+  bme280_bench_t bench;
+  bme280_bench(&bme280->calibration, 1000, &bench);
+  for (uint32_t i = 0; i < BME280_PRESSURE_COUNT; i++) {
+    ESP_LOGI(TAG, "BME280 %s pressure compensation takes %.1f %s",
+             bme280_pressure_name(i), bench.per_call[i], bench.unit);
+  }
+#endif
+  return ESP_OK;
+}
+
+#ifdef CONFIG_I2CMUX_BME280_MODE_FORCED
+static esp_err_t iic_mux_bme280_trigger(iic_mux_device_t *device) {
+  const iic_mux_bme280_t *bme280 = device->context;
+  return iic_mux_device_queue_write(device, 0xF4,
+                                    bme280->ctrl_meas |
+                                        I2CMUX_BME280_MODE_FORCED);
+}
+#endif
+
+static esp_err_t iic_mux_bme280_read(iic_mux_device_t *device) {
+#ifdef CONFIG_I2CMUX_BME280_MODE_FORCED
+  // The status register rides along in the same burst, it only costs a
+  // second read if the conversion somehow isn't done yet.
+  return iic_mux_device_queue_read(
+      device, 0xF3, I2CMUX_BME280_STATUS_SIZE + I2CMUX_BME280_DATA_SIZE);
+#else
+  // The sensor is in normal mode, one burst gets a consistent set of
+  // pressure, temperature and humidity from the latest conversion.
+  return iic_mux_device_queue_read(device, 0xF7, I2CMUX_BME280_DATA_SIZE);
+#endif
+}
+
+static esp_err_t iic_mux_bme280_compensate(iic_mux_device_t *device) {
+  const iic_mux_bme280_t *bme280 = device->context;
+#ifdef CONFIG_I2CMUX_BME280_MODE_FORCED
+  if ((device->buffer[0] & 0b00001000) != 0) {
+    return ESP_ERR_NOT_FINISHED;
+  }
+  const uint8_t *data = device->buffer + I2CMUX_BME280_STATUS_SIZE;
+#else
+  const uint8_t *data = device->buffer;
+#endif
+  const uint32_t adc_P = ((uint32_t)(data[0]) << 12) |
+                         ((uint32_t)(data[1]) << 4) | (data[2] >> 4);
+  const int32_t adc_T = (int32_t)(((uint32_t)(data[3]) << 12) |
+                                  ((uint32_t)(data[4]) << 4) | (data[5] >> 4));
+  const int32_t adc_H = (int32_t)(((uint32_t)(data[6]) << 8) | data[7]);
+
+  // temperature is needed first, its t_fine feeds the other two
+  sample_ring_record_t *record = &device->record;
+  int32_t t_fine;
+  record->value[SAMPLE_RING_TEMPERATURE] =
+      bme280_compensate_temperature(&bme280->calibration, adc_T, &t_fine);
+  record->value[SAMPLE_RING_HUMIDITY] = (int32_t)bme280_compensate_humidity(
+      &bme280->calibration, t_fine, adc_H);
+  record->mask |= SAMPLE_RING_MASK(SAMPLE_RING_TEMPERATURE) |
+                  SAMPLE_RING_MASK(SAMPLE_RING_HUMIDITY);
+  const uint32_t pressure =
+      bme280_compensate_pressure(&bme280->calibration, t_fine, adc_P);
+  if (pressure != 0) {
+    record->value[SAMPLE_RING_PRESSURE] = (int32_t)pressure;
+    record->mask |= SAMPLE_RING_MASK(SAMPLE_RING_PRESSURE);
+  } else {
+    ESP_LOGI(TAG, "Read an invalid pressure from BME280");
+  }
+  return ESP_OK;
+}
+
+const iic_mux_driver_t iic_mux_bme280_driver = {
+    .name = "BME280",
+    .address = I2CMUX_BME280_ADDRESS,
+    .scl_speed_hz = 400000,
+    .period_ms = CONFIG_I2CMUX_BME280_PERIOD_MS,
+    .context_size = sizeof(iic_mux_bme280_t),
+    .probe = iic_mux_bme280_probe,
+    .start = iic_mux_bme280_start,
+#ifdef CONFIG_I2CMUX_BME280_MODE_FORCED
+    .trigger = iic_mux_bme280_trigger,
+#else
+    .trigger = NULL,
+#endif
+    .read = iic_mux_bme280_read,
+    .compensate = iic_mux_bme280_compensate,
+};
+#endif
@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+#include <inttypes.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define BME280_CHIP_ID 0x60
+
+// Trimming registers as read, 0x88 to 0xA1 followed by 0xE1 to 0xE7
+#define BME280_CALIBRATION_TP_REGISTER 0x88
+#define BME280_CALIBRATION_TP_SIZE 26
+#define BME280_CALIBRATION_H_REGISTER 0xE1
+#define BME280_CALIBRATION_H_SIZE 7
+#define BME280_CALIBRATION_RAW_SIZE                                            \
+  (BME280_CALIBRATION_TP_SIZE + BME280_CALIBRATION_H_SIZE)
+
+typedef enum {
+  BME280_DIG_T1,
+  BME280_DIG_T2,
+  BME280_DIG_T3,
+  BME280_DIG_P1,
+  BME280_DIG_P2,
+  BME280_DIG_P3,
+  BME280_DIG_P4,
+  BME280_DIG_P5,
+  BME280_DIG_P6,
+  BME280_DIG_P7,
+  BME280_DIG_P8,
+  BME280_DIG_P9,
+  BME280_DIG_H1,
+  BME280_DIG_H2,
+  BME280_DIG_H3,
+  BME280_DIG_H4,
+  BME280_DIG_H5,
+  BME280_DIG_H6,
+  BME280_DIG_COUNT
+} bme280_dig_t;
+
+typedef struct {
+  int32_t dig[BME280_DIG_COUNT];
+} bme280_calibration_t;
+
+// Pressure compensation backends, all in hundredths of a Pa
+typedef enum {
+  BME280_PRESSURE_INT64,
+  BME280_PRESSURE_INT32,
+  BME280_PRESSURE_FLOAT,
+  BME280_PRESSURE_COUNT
+} bme280_pressure_t;
+
+typedef uint32_t (*bme280_pressure_fn_t)(const bme280_calibration_t *, int32_t,
+                                         uint32_t);
+
+// Decode the raw trimming registers into coefficients
+void bme280_calibration_decode(bme280_calibration_t *, const uint8_t *);
+
+// Name of a coefficient, for logging
+const char *bme280_calibration_name(bme280_dig_t);
+
+// Temperature in hundredths of a degree C, also gives t_fine for the others
+int32_t bme280_compensate_temperature(const bme280_calibration_t *, int32_t,
+                                      int32_t *);
+
+// Pressure in hundredths of a Pa, 0 if the calibration is invalid. Uses the
+// backend picked in menuconfig, the 64 bit reference otherwise.
+uint32_t bme280_compensate_pressure(const bme280_calibration_t *, int32_t,
+                                    uint32_t);
+
+// Bosch 64 bit integer reference
+uint32_t bme280_compensate_pressure_int64(const bme280_calibration_t *, int32_t,
+                                          uint32_t);
+
+// Bosch 32 bit integer variant, 1 Pa resolution
+uint32_t bme280_compensate_pressure_int32(const bme280_calibration_t *, int32_t,
+                                          uint32_t);
+
+// Bosch floating point variant in single precision for the ESP32's FPU
+uint32_t bme280_compensate_pressure_float(const bme280_calibration_t *, int32_t,
+                                          uint32_t);
+
+// A pressure backend and its name
+bme280_pressure_fn_t bme280_pressure_backend(bme280_pressure_t);
+const char *bme280_pressure_name(bme280_pressure_t);
+
+// Relative humidity in 1024ths of a percent
+uint32_t bme280_compensate_humidity(const bme280_calibration_t *, int32_t,
+                                    int32_t);
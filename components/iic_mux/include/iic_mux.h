@@ -16,31 +16,104 @@
 #pragma once
 #include "driver/i2c_master.h"
 #include "driver/i2c_types.h"
+#include "esp_err.h"
+#include "esp_timer.h"
+#include "sample_ring.h"
 #include <inttypes.h>
+#include <stdbool.h>
 #include <stdlib.h>
 
-#define I2CMUX_BUF_PRESSURE_SIZE 3
-#define I2CMUX_DIG_PRESSURE_SIZE 9
-#define I2CMUX_BUF_TEMPERATURE_SIZE 3
-#define I2CMUX_DIG_TEMPERATURE_SIZE 3
+#define I2CMUX_QUEUE_DEPTH 4
+#define I2CMUX_DEVICES_MAX 8
+#define I2CMUX_WRITE_SIZE 2
+#define I2CMUX_BUF_SIZE 16
 
+typedef enum {
+  I2CMUX_STATE_IDLE,
+  // Only for drivers with a trigger, the write then a wait for conversion
+  I2CMUX_STATE_TRIGGER,
+  I2CMUX_STATE_WAIT,
+  I2CMUX_STATE_READ,
+} iic_mux_state_t;
+
+typedef struct iic_mux iic_mux_t;
+typedef struct iic_mux_device iic_mux_device_t;
+
+// Completion of a sample, runs in the timer service task
+typedef void (*iic_mux_callback_t)(iic_mux_device_t *, esp_err_t, void *);
+
+// What a sensor driver provides. Probe and start run once at iic_mux_start
+// and may block, the rest queue transactions and must not.
 typedef struct {
+  const char *name;
+  uint16_t address;
+  uint32_t scl_speed_hz;
+  // How often the scheduler samples the device
+  uint32_t period_ms;
+  // Driver state allocated per device, found at device->context
+  size_t context_size;
+  // Checks the device answers and is the part the driver expects
+  esp_err_t (*probe)(iic_mux_device_t *);
+  // Configures the device and sets device->conversion_us
+  esp_err_t (*start)(iic_mux_device_t *);
+  // Queues the write that begins a conversion, NULL if it free-runs
+  esp_err_t (*trigger)(iic_mux_device_t *);
+  // Queues the read of the raw sample into device->buffer
+  esp_err_t (*read)(iic_mux_device_t *);
+  // Turns device->buffer into device->record, ESP_ERR_NOT_FINISHED if the
+  // conversion isn't done and the read should be tried again
+  esp_err_t (*compensate)(iic_mux_device_t *);
+} iic_mux_driver_t;
+
+struct iic_mux_device {
+  const iic_mux_driver_t *driver;
+  i2c_master_bus_handle_t bus_handle;
+  i2c_master_dev_handle_t handle;
+  void *context;
+
+  // Scheduling, conversion_us is how long trigger to read takes
+  int64_t deadline_us;
+  int64_t period_us;
+  uint32_t conversion_us;
+
+  // Sample in flight, the buffers have to outlive queued transactions
+  volatile bool busy;
+  iic_mux_state_t state;
+  uint8_t write[I2CMUX_WRITE_SIZE];
+  uint8_t buffer[I2CMUX_BUF_SIZE];
+  uint32_t retries_left;
+  uint32_t rechecks;
+  // Conversion waits, and the watchdog of a transaction in flight, a wake
+  // before timer_due_us is left over from an earlier use
+  esp_timer_handle_t timer;
+  int64_t timer_due_us;
+  iic_mux_callback_t callback;
+  void *user_data;
+  int64_t begin_us;
+  int64_t issue_us;
+
+  // Latest compensated sample, stamped when its read finished
+  sample_ring_record_t record;
+
+  // Bus usage of the last sample
+  uint32_t transactions;
+  int64_t bus_us;
+
+  // From the start of a sample to its completion
+  int64_t latency_us;
+  int64_t latency_max_us;
+  uint32_t samples;
+  uint32_t errors;
+  uint32_t retries;
+  // Deadlines that came up while the last sample was still in flight
+  uint32_t overruns;
+};
+
+struct iic_mux {
   i2c_master_bus_handle_t bus_handle;
-  
-  i2c_master_dev_handle_t bme280_handle;
-
-  uint8_t bme280_buf_pressure[I2CMUX_BUF_PRESSURE_SIZE];
-  uint32_t bme280_pressure;
-  uint8_t bme280_buf_dig_P[I2CMUX_DIG_PRESSURE_SIZE * 2];
-  uint16_t bme280_pressure_coeff_1;
-  int16_t bme280_pressure_coeffs[I2CMUX_DIG_PRESSURE_SIZE - 1];
-
-  uint8_t bme280_buf_temperature[I2CMUX_BUF_TEMPERATURE_SIZE];
-  int32_t bme280_temperature;
-  uint8_t bme280_buf_dig_T[I2CMUX_DIG_TEMPERATURE_SIZE * 2];
-  uint16_t bme280_temperature_coeff_1;
-  int16_t bme280_temperature_coeffs[I2CMUX_DIG_TEMPERATURE_SIZE - 1];
-} iic_mux_t;
+  iic_mux_device_t *devices[I2CMUX_DEVICES_MAX];
+  uint32_t device_count;
+};
 
 // Dynamic allocation of iic_mux_t structs
 void iic_mux_init(iic_mux_t **);
@@ -48,11 +121,28 @@ void iic_mux_init(iic_mux_t **);
 // Static fill of iic_mux_t structs
 void iic_mux_fill(iic_mux_t *);
 
-// Starts the I2C multiplex
+// Adds a sensor driver, before iic_mux_start
+esp_err_t iic_mux_register(iic_mux_t *, const iic_mux_driver_t *);
+
+// Starts the I2C multiplex, devices that don't probe or start are dropped
 void iic_mux_start(iic_mux_t *);
 
-// Sense...
-void iic_mux_refresh(iic_mux_t *);
+// Starts every device whose deadline has passed, earliest first, and returns
+// the next deadline in esp_timer microseconds (INT64_MAX with no devices)
+int64_t iic_mux_service(iic_mux_t *, iic_mux_callback_t, void *);
+
+// Starts a sample and returns right away, the callback (if any) runs once the
+// sample is compensated or has run out of retries. ESP_ERR_INVALID_STATE if
+// the last sample is still in flight, ESP_ERR_TIMEOUT if the timer service
+// task can't take it.
+esp_err_t iic_mux_sample(iic_mux_device_t *, iic_mux_callback_t, void *);
+
+// Register access for drivers. The blocking pair is for probe and start, the
+// queued pair for trigger and read and goes through device->write.
+esp_err_t iic_mux_device_read(iic_mux_device_t *, uint8_t, uint8_t *, size_t);
+esp_err_t iic_mux_device_write(iic_mux_device_t *, const uint8_t *, size_t);
+esp_err_t iic_mux_device_queue_read(iic_mux_device_t *, uint8_t, size_t);
+esp_err_t iic_mux_device_queue_write(iic_mux_device_t *, uint8_t, uint8_t);
 
 // Dynamic free of iic_mux_t structs
-void iic_mux_free(iic_mux_t *);
\ No newline at end of file
+void iic_mux_free(iic_mux_t *);
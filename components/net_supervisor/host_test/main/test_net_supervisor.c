@@ -0,0 +1,308 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "net_supervisor.h"
+#include "unity.h"
+#include <stdio.h>
+
+// A stand-in for the access point, the broker, the wireless component and the
+// MQTT client, stepped in simulated time. Timings are rough ESP32 figures.
+#define TICK_MS 100
+#define JOIN_MS 1500
+#define SCAN_MS 3000
+#define BEACON_LOSS_MS 6000
+#define CONNECT_MS 300
+#define CONNECT_TIMEOUT_MS 10000
+#define RESET_MS 1000
+#define KEEPALIVE_LOSS_MS 30000
+#define RETRIES 5
+// The client's own reconnection, the supervisor is meant to beat it
+#define CLIENT_RECONNECT_MS CONFIG_NET_SUPERVISOR_BROKER_BACKOFF_MAX_MS
+
+typedef enum { WIFI_IDLE, WIFI_JOINING, WIFI_UP } wifi_t;
+typedef enum { MQTT_STOPPED, MQTT_CONNECTING, MQTT_UP, MQTT_WAITING } mqtt_t;
+
+static int64_t now_ms;
+static bool ap_up;
+static bool broker_up;
+static uint32_t dhcp_address;
+static int64_t ap_down_since_ms;
+static int64_t broker_down_since_ms;
+
+static wifi_t wifi;
+static int64_t wifi_at_ms;
+static uint32_t tries_left;
+static mqtt_t mqtt;
+static int64_t mqtt_at_ms;
+
+static net_supervisor_t supervisor;
+
+static void join(void) {
+  wifi = WIFI_JOINING;
+  wifi_at_ms = now_ms + (ap_up ? JOIN_MS : SCAN_MS);
+}
+
+static void connect(void) {
+  mqtt = MQTT_CONNECTING;
+  mqtt_at_ms =
+      now_ms + ((wifi == WIFI_UP && broker_up) ? CONNECT_MS
+                : (wifi == WIFI_UP)             ? RESET_MS
+                                                : CONNECT_TIMEOUT_MS);
+}
+
+static void act(uint32_t actions) {
+  if ((actions & NET_SUPERVISOR_JOIN) != 0) {
+    tries_left = RETRIES;
+    join();
+  }
+  if ((actions & (NET_SUPERVISOR_MQTT_START | NET_SUPERVISOR_MQTT_RESTART)) !=
+      0) {
+    connect();
+  }
+  if ((actions & NET_SUPERVISOR_MQTT_RECONNECT) != 0 &&
+      mqtt == MQTT_WAITING) {
+    connect();
+  }
+}
+
+static void event(net_supervisor_event_t event, uint32_t address) {
+  act(net_supervisor_event(&supervisor, event, address, now_ms * 1000));
+}
+
+static void broker_lost(void) {
+  mqtt = MQTT_WAITING;
+  mqtt_at_ms = now_ms + CLIENT_RECONNECT_MS;
+  event(NET_SUPERVISOR_BROKER_DOWN, 0);
+}
+
+static void tick(void) {
+  now_ms += TICK_MS;
+
+  if (wifi == WIFI_JOINING && now_ms >= wifi_at_ms) {
+    if (ap_up) {
+      wifi = WIFI_UP;
+      event(NET_SUPERVISOR_LINK_UP, dhcp_address);
+    } else if (tries_left > 0) {
+      tries_left--;
+      join();
+    } else {
+      wifi = WIFI_IDLE;
+      event(NET_SUPERVISOR_LINK_FAILED, 0);
+    }
+  } else if (wifi == WIFI_UP && !ap_up &&
+             now_ms - ap_down_since_ms >= BEACON_LOSS_MS) {
+    // The wireless component retries straight away, then tells the rest
+    tries_left--;
+    join();
+    event(NET_SUPERVISOR_LINK_LOST, 0);
+  }
+
+  if (mqtt == MQTT_CONNECTING && now_ms >= mqtt_at_ms) {
+    if (wifi == WIFI_UP && broker_up) {
+      mqtt = MQTT_UP;
+      event(NET_SUPERVISOR_BROKER_UP, 0);
+    } else {
+      broker_lost();
+    }
+  } else if (mqtt == MQTT_WAITING && now_ms >= mqtt_at_ms) {
+    connect();
+  } else if (mqtt == MQTT_UP) {
+    // A broker going away resets the socket, a link going away is only
+    // noticed by the keepalive
+    if (!broker_up && now_ms - broker_down_since_ms >= RESET_MS) {
+      broker_lost();
+    } else if (!ap_up && now_ms - ap_down_since_ms >= KEEPALIVE_LOSS_MS) {
+      broker_lost();
+    }
+  }
+
+  act(net_supervisor_poll(&supervisor, now_ms * 1000));
+}
+
+static void run(int64_t ms) {
+  for (int64_t end_ms = now_ms + ms; now_ms < end_ms;) {
+    tick();
+  }
+}
+
+static void ap(bool up) {
+  ap_up = up;
+  ap_down_since_ms = now_ms;
+}
+
+static void broker(bool up) {
+  broker_up = up;
+  broker_down_since_ms = now_ms;
+}
+
+// Boots with everything up and runs until online
+void setUp(void) {
+  now_ms = 0;
+  ap_up = true;
+  broker_up = true;
+  dhcp_address = 0x0a00002a;
+  wifi = WIFI_IDLE;
+  mqtt = MQTT_STOPPED;
+  tries_left = RETRIES;
+  net_supervisor_fill(&supervisor, 0, 1);
+  join();
+  run(10000);
+}
+
+void tearDown(void) {}
+
+static void test_boot(void) {
+  TEST_ASSERT_TRUE(supervisor.online);
+  TEST_ASSERT_EQUAL_UINT32(1, supervisor.connections);
+  TEST_ASSERT_EQUAL_UINT32(0, supervisor.recoveries);
+  TEST_ASSERT_EQUAL(MQTT_UP, mqtt);
+}
+
+static void test_backoff(void) {
+  for (uint32_t attempts = 0; attempts < 40; attempts++) {
+    uint32_t ceiling_ms = 120000;
+    if (attempts < 8) {
+      ceiling_ms = 1000 << attempts;
+    }
+    // Between half and all of it
+    const uint32_t delay_ms =
+        net_supervisor_backoff_ms(&supervisor, attempts, 1000, 120000);
+    TEST_ASSERT_UINT32_WITHIN(ceiling_ms / 4, ceiling_ms * 3 / 4, delay_ms);
+  }
+}
+
+// Longer than the wireless component's own retries, which used to be the end
+static void test_ap_outage(void) {
+  const int64_t outage_ms = 10 * 60 * 1000;
+  ap(false);
+  run(outage_ms);
+  TEST_ASSERT_FALSE(supervisor.online);
+  TEST_ASSERT_GREATER_THAN_UINT32(0, supervisor.joins);
+  ap(true);
+  run(5 * 60 * 1000);
+  TEST_ASSERT_TRUE(supervisor.online);
+  TEST_ASSERT_EQUAL_UINT32(1, supervisor.recoveries);
+  TEST_ASSERT_EQUAL_UINT32(1, supervisor.relinks);
+  TEST_ASSERT_EQUAL_UINT32(1, supervisor.link_losses);
+  // A rejoin backoff, its scans and a join after the access point is back
+  TEST_ASSERT_LESS_OR_EQUAL(CONFIG_NET_SUPERVISOR_JOIN_BACKOFF_MAX_MS +
+                                (RETRIES + 1) * SCAN_MS + JOIN_MS +
+                                CONNECT_MS + TICK_MS,
+                            supervisor.offline_last_us / 1000 - outage_ms);
+  // Once linked, only the broker connection is left
+  TEST_ASSERT_LESS_OR_EQUAL(CONNECT_MS + TICK_MS,
+                            supervisor.recovery_last_us / 1000);
+}
+
+static void test_broker_outage(void) {
+  broker(false);
+  run(5 * 60 * 1000);
+  TEST_ASSERT_FALSE(supervisor.online);
+  TEST_ASSERT_EQUAL_UINT32(1, supervisor.broker_losses);
+  TEST_ASSERT_GREATER_THAN_UINT32(1, supervisor.reconnects);
+  broker(true);
+  run(3 * 60 * 1000);
+  TEST_ASSERT_TRUE(supervisor.online);
+  TEST_ASSERT_EQUAL_UINT32(1, supervisor.recoveries);
+  TEST_ASSERT_EQUAL_UINT32(0, supervisor.link_losses);
+  // The link never went, so there's no recovery from it to measure
+  TEST_ASSERT_EQUAL_UINT32(0, supervisor.relinks);
+  TEST_ASSERT_EQUAL_INT64(0, net_supervisor_mttr_us(&supervisor));
+}
+
+// DHCP hands out another address after the outage, the client must not keep
+// its old socket
+static void test_address_change(void) {
+  ap(false);
+  run(20000);
+  dhcp_address = 0x0a000063;
+  ap(true);
+  run(60000);
+  TEST_ASSERT_TRUE(supervisor.online);
+  TEST_ASSERT_EQUAL_UINT32(0x0a000063, supervisor.address);
+  TEST_ASSERT_EQUAL_UINT32(1, supervisor.address_changes);
+  // Back before the keepalive would have noticed
+  TEST_ASSERT_LESS_OR_EQUAL(KEEPALIVE_LOSS_MS + 20000,
+                            supervisor.offline_last_us / 1000);
+}
+
+// Access point outages from seconds to an hour, with the broker and address
+// changing now and then, reporting the mean time to recover once they are
+// back
+static void test_mttr(void) {
+  uint32_t random = 12345;
+  const uint32_t outages = 40;
+  int64_t outage_total_ms = 0;
+  int64_t recovery_total_ms = 0;
+  int64_t recovery_max_ms = 0;
+  for (uint32_t i = 0; i < outages; i++) {
+    random = random * 1103515245 + 12345;
+    const int64_t outage_ms = 5000 + (random >> 8) % (60 * 60 * 1000);
+    outage_total_ms += outage_ms;
+    if (i % 3 == 0) {
+      broker(false);
+    }
+    ap(false);
+    run(outage_ms);
+    if (i % 5 == 0) {
+      (dhcp_address)++;
+    }
+    ap(true);
+    broker(true);
+    const int64_t back_ms = now_ms;
+    while (!supervisor.online && now_ms - back_ms < 10 * 60 * 1000) {
+      tick();
+    }
+    TEST_ASSERT_TRUE(supervisor.online);
+    recovery_total_ms += now_ms - back_ms;
+    if (now_ms - back_ms > recovery_max_ms) {
+      recovery_max_ms = now_ms - back_ms;
+    }
+    run(60000);
+  }
+  TEST_ASSERT_EQUAL_UINT32(outages, supervisor.recoveries);
+
+  const int64_t mttr_ms = recovery_total_ms / outages;
+  printf("Mean time to recover %" PRId64 " ms after %" PRIu32
+         " outages of %" PRId64 " s on average, worst %" PRId64
+         " ms, %" PRId64 " ms from the link\n",
+         mttr_ms, outages, outage_total_ms / outages / 1000, recovery_max_ms,
+         net_supervisor_mttr_us(&supervisor) / 1000);
+  // Offline time takes in the outage too. Recovery starts at the link, a
+  // little after the access point is back, so it's below what was seen here.
+  TEST_ASSERT_GREATER_THAN(outage_total_ms / outages,
+                           net_supervisor_offline_mean_us(&supervisor) / 1000);
+  TEST_ASSERT_GREATER_THAN_UINT32(0, supervisor.relinks);
+  TEST_ASSERT_GREATER_THAN(0, net_supervisor_mttr_us(&supervisor));
+  TEST_ASSERT_LESS_OR_EQUAL(mttr_ms,
+                            net_supervisor_mttr_us(&supervisor) / 1000);
+  TEST_ASSERT_LESS_OR_EQUAL(CONFIG_NET_SUPERVISOR_JOIN_BACKOFF_MAX_MS,
+                            mttr_ms);
+  TEST_ASSERT_LESS_OR_EQUAL(CONFIG_NET_SUPERVISOR_JOIN_BACKOFF_MAX_MS +
+                                (RETRIES + 1) * SCAN_MS + JOIN_MS +
+                                CONNECT_MS + TICK_MS,
+                            recovery_max_ms);
+}
+
+void app_main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_boot);
+  RUN_TEST(test_backoff);
+  RUN_TEST(test_ap_outage);
+  RUN_TEST(test_broker_outage);
+  RUN_TEST(test_address_change);
+  RUN_TEST(test_mttr);
+  exit(UNITY_END());
+}
@@ -0,0 +1,124 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+#include "sdkconfig.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Owns the Wi-Fi and MQTT lifecycles together, so the station heals from any
+// outage without a power cycle. Events from both go in, the actions to take
+// come out, and nothing here touches the radio, so it runs on the host too.
+//
+// The wireless component retries a join a few times on its own. Once it gives
+// up, the supervisor rejoins with fresh retries after a backoff that doubles
+// up to a limit, forever. The broker is reconnected the same way, and the
+// MQTT client is restarted whenever the link comes back, as its socket may be
+// bound to an address that changed.
+
+typedef enum {
+  // Wi-Fi dropped, the wireless component retries on its own
+  NET_SUPERVISOR_LINK_LOST,
+  // The wireless component ran out of retries
+  NET_SUPERVISOR_LINK_FAILED,
+  // Got an address
+  NET_SUPERVISOR_LINK_UP,
+  NET_SUPERVISOR_BROKER_UP,
+  NET_SUPERVISOR_BROKER_DOWN,
+} net_supervisor_event_t;
+
+// Rejoin Wi-Fi with fresh retries
+#define NET_SUPERVISOR_JOIN (((uint32_t)(1)) << 0)
+// Start the MQTT client, the first time there is a link
+#define NET_SUPERVISOR_MQTT_START (((uint32_t)(1)) << 1)
+// Stop and start the MQTT client on a fresh socket
+#define NET_SUPERVISOR_MQTT_RESTART (((uint32_t)(1)) << 2)
+// Reconnect the MQTT client now
+#define NET_SUPERVISOR_MQTT_RECONNECT (((uint32_t)(1)) << 3)
+#define NET_SUPERVISOR_NONE ((uint32_t)(0))
+
+typedef struct {
+  bool linked;
+  bool online;
+  bool started;
+  // Current address, and the last one a link had
+  uint32_t address;
+  uint32_t last_address;
+  // Attempts since the last success, and when the next is due, INT64_MAX when
+  // none is
+  uint32_t join_attempts;
+  int64_t join_due_us;
+  uint32_t broker_attempts;
+  int64_t broker_due_us;
+  // xorshift32 state spreading out the backoffs
+  uint32_t random;
+
+  int64_t started_us;
+  // Since when the station is offline, -1 while online
+  int64_t offline_since_us;
+  uint32_t connections;
+  uint32_t link_losses;
+  uint32_t broker_losses;
+  uint32_t address_changes;
+  uint32_t joins;
+  uint32_t reconnects;
+  // Time from losing the broker or the link to being online again, the first
+  // connection after boot doesn't count
+  uint32_t recoveries;
+  int64_t offline_total_us;
+  int64_t offline_last_us;
+  int64_t offline_max_us;
+  // Time from the link coming back to being online again, the recovery
+  // proper. Only outages that took the link count, there's no telling when
+  // a broker came back. linked_since_us is -1 unless one is under way.
+  int64_t linked_since_us;
+  uint32_t relinks;
+  int64_t recovery_total_us;
+  int64_t recovery_last_us;
+  int64_t recovery_max_us;
+} net_supervisor_t;
+
+// Dynamic allocation of net_supervisor_t structs
+void net_supervisor_init(net_supervisor_t **, int64_t now_us, uint32_t seed);
+
+// Static fill of net_supervisor_t structs
+void net_supervisor_fill(net_supervisor_t *, int64_t now_us, uint32_t seed);
+
+// Waits between half and all of a delay doubling with each attempt, up to
+// the maximum
+uint32_t net_supervisor_backoff_ms(net_supervisor_t *, uint32_t attempts,
+                                   uint32_t min_ms, uint32_t max_ms);
+
+// Takes an event, the address only matters for NET_SUPERVISOR_LINK_UP.
+// Returns the actions to take now.
+uint32_t net_supervisor_event(net_supervisor_t *, net_supervisor_event_t,
+                              uint32_t address, int64_t now_us);
+
+// Returns the actions that came due
+uint32_t net_supervisor_poll(net_supervisor_t *, int64_t now_us);
+
+// When to poll next, INT64_MAX when nothing is due
+int64_t net_supervisor_next_us(const net_supervisor_t *);
+
+// Mean time to recover from the link coming back, 0 before any recovery
+int64_t net_supervisor_mttr_us(const net_supervisor_t *);
+
+// Mean time spent offline per outage, 0 before any recovery
+int64_t net_supervisor_offline_mean_us(const net_supervisor_t *);
+
+// Dynamic free of net_supervisor_t structs
+void net_supervisor_free(net_supervisor_t *);
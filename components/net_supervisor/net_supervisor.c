@@ -0,0 +1,240 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "net_supervisor.h"
+#include "esp_log.h"
+
+static const char *TAG = "net_supervisor";
+
+static uint32_t net_supervisor_random(net_supervisor_t *pointer) {
+  uint32_t x = pointer->random;
+  x ^= x << 13;
+  x ^= x >> 17;
+  x ^= x << 5;
+  pointer->random = x;
+  return x;
+}
+
+// Offline from now on, if it wasn't already
+static void net_supervisor_offline(net_supervisor_t *pointer, int64_t now_us) {
+  if (pointer->online) {
+    pointer->online = false;
+    pointer->offline_since_us = now_us;
+  }
+}
+
+static void net_supervisor_online(net_supervisor_t *pointer, int64_t now_us) {
+  pointer->online = true;
+  pointer->broker_attempts = 0;
+  pointer->broker_due_us = INT64_MAX;
+  (pointer->connections)++;
+  if (pointer->connections > 1) {
+    const int64_t offline_us = now_us - pointer->offline_since_us;
+    (pointer->recoveries)++;
+    pointer->offline_total_us += offline_us;
+    pointer->offline_last_us = offline_us;
+    if (offline_us > pointer->offline_max_us) {
+      pointer->offline_max_us = offline_us;
+    }
+    if (pointer->linked_since_us >= 0) {
+      const int64_t recovery_us = now_us - pointer->linked_since_us;
+      (pointer->relinks)++;
+      pointer->recovery_total_us += recovery_us;
+      pointer->recovery_last_us = recovery_us;
+      if (recovery_us > pointer->recovery_max_us) {
+        pointer->recovery_max_us = recovery_us;
+      }
+      ESP_LOGI(TAG,
+               "Recovered in %" PRId64 " ms, offline for %" PRId64 " ms",
+               recovery_us / 1000, offline_us / 1000);
+    } else {
+      ESP_LOGI(TAG, "Back online after %" PRId64 " ms", offline_us / 1000);
+    }
+  }
+  pointer->offline_since_us = -1;
+  pointer->linked_since_us = -1;
+}
+
+static uint32_t net_supervisor_link_up(net_supervisor_t *pointer,
+                                       uint32_t address, int64_t now_us) {
+  pointer->linked = true;
+  pointer->address = address;
+  pointer->join_attempts = 0;
+  pointer->join_due_us = INT64_MAX;
+  const uint32_t last_address = pointer->last_address;
+  pointer->last_address = address;
+
+  if (!pointer->started) {
+    pointer->started = true;
+    return NET_SUPERVISOR_MQTT_START;
+  }
+  pointer->broker_attempts = 0;
+  pointer->broker_due_us = INT64_MAX;
+  if (address != last_address) {
+    (pointer->address_changes)++;
+  }
+  // The client may still think its socket is fine, or it may be bound to an
+  // address that is gone, either way a fresh one is quicker than a keepalive
+  ESP_LOGI(TAG, "Link back, restarting the MQTT client");
+  net_supervisor_offline(pointer, now_us);
+  pointer->linked_since_us = now_us;
+  return NET_SUPERVISOR_MQTT_RESTART;
+}
+// ============================================================================
+void net_supervisor_init(net_supervisor_t **pointer, int64_t now_us,
+                         uint32_t seed) {
+  *pointer = malloc(sizeof(net_supervisor_t));
+  net_supervisor_fill(*pointer, now_us, seed);
+}
+
+void net_supervisor_fill(net_supervisor_t *pointer, int64_t now_us,
+                         uint32_t seed) {
+  pointer->linked = false;
+  pointer->online = false;
+  pointer->started = false;
+  pointer->address = 0;
+  pointer->last_address = 0;
+  pointer->join_attempts = 0;
+  pointer->join_due_us = INT64_MAX;
+  pointer->broker_attempts = 0;
+  pointer->broker_due_us = INT64_MAX;
+  // xorshift32 sticks at zero
+  pointer->random = (seed != 0) ? seed : 0x9e3779b9;
+
+  pointer->started_us = now_us;
+  pointer->offline_since_us = now_us;
+  pointer->connections = 0;
+  pointer->link_losses = 0;
+  pointer->broker_losses = 0;
+  pointer->address_changes = 0;
+  pointer->joins = 0;
+  pointer->reconnects = 0;
+  pointer->recoveries = 0;
+  pointer->offline_total_us = 0;
+  pointer->offline_last_us = 0;
+  pointer->offline_max_us = 0;
+  pointer->linked_since_us = -1;
+  pointer->relinks = 0;
+  pointer->recovery_total_us = 0;
+  pointer->recovery_last_us = 0;
+  pointer->recovery_max_us = 0;
+}
+
+uint32_t net_supervisor_backoff_ms(net_supervisor_t *pointer,
+                                   uint32_t attempts, uint32_t min_ms,
+                                   uint32_t max_ms) {
+  uint32_t delay_ms = max_ms;
+  if (attempts < 16 && (min_ms << attempts) < delay_ms) {
+    delay_ms = min_ms << attempts;
+  }
+  return delay_ms / 2 + net_supervisor_random(pointer) % (delay_ms / 2 + 1);
+}
+
+uint32_t net_supervisor_event(net_supervisor_t *pointer,
+                              net_supervisor_event_t event, uint32_t address,
+                              int64_t now_us) {
+  switch (event) {
+  case NET_SUPERVISOR_LINK_LOST: {
+    if (pointer->linked) {
+      (pointer->link_losses)++;
+    }
+    pointer->linked = false;
+    pointer->address = 0;
+    pointer->linked_since_us = -1;
+    // The MQTT client may take a keepalive to notice
+    net_supervisor_offline(pointer, now_us);
+    return NET_SUPERVISOR_NONE;
+  }
+  case NET_SUPERVISOR_LINK_FAILED: {
+    pointer->linked = false;
+    pointer->address = 0;
+    pointer->linked_since_us = -1;
+    net_supervisor_offline(pointer, now_us);
+    if (pointer->join_due_us == INT64_MAX) {
+      const uint32_t delay_ms = net_supervisor_backoff_ms(
+          pointer, pointer->join_attempts,
+          CONFIG_NET_SUPERVISOR_JOIN_BACKOFF_MIN_MS,
+          CONFIG_NET_SUPERVISOR_JOIN_BACKOFF_MAX_MS);
+      (pointer->join_attempts)++;
+      pointer->join_due_us = now_us + (int64_t)(delay_ms) * 1000;
+      ESP_LOGI(TAG, "Rejoining Wi-Fi in %" PRIu32 " ms, attempt %" PRIu32,
+               delay_ms, pointer->join_attempts);
+    }
+    return NET_SUPERVISOR_NONE;
+  }
+  case NET_SUPERVISOR_LINK_UP: {
+    return net_supervisor_link_up(pointer, address, now_us);
+  }
+  case NET_SUPERVISOR_BROKER_UP: {
+    net_supervisor_online(pointer, now_us);
+    return NET_SUPERVISOR_NONE;
+  }
+  case NET_SUPERVISOR_BROKER_DOWN: {
+    if (pointer->online) {
+      (pointer->broker_losses)++;
+    }
+    net_supervisor_offline(pointer, now_us);
+    // Without a link the rejoin brings the broker back
+    if (pointer->linked && pointer->broker_due_us == INT64_MAX) {
+      const uint32_t delay_ms = net_supervisor_backoff_ms(
+          pointer, pointer->broker_attempts,
+          CONFIG_NET_SUPERVISOR_BROKER_BACKOFF_MIN_MS,
+          CONFIG_NET_SUPERVISOR_BROKER_BACKOFF_MAX_MS);
+      (pointer->broker_attempts)++;
+      pointer->broker_due_us = now_us + (int64_t)(delay_ms) * 1000;
+      ESP_LOGI(TAG, "Reconnecting to MQTT in %" PRIu32 " ms, attempt %" PRIu32,
+               delay_ms, pointer->broker_attempts);
+    }
+    return NET_SUPERVISOR_NONE;
+  }
+  }
+  return NET_SUPERVISOR_NONE;
+}
+
+uint32_t net_supervisor_poll(net_supervisor_t *pointer, int64_t now_us) {
+  uint32_t actions = NET_SUPERVISOR_NONE;
+  if (pointer->join_due_us <= now_us) {
+    pointer->join_due_us = INT64_MAX;
+    (pointer->joins)++;
+    actions |= NET_SUPERVISOR_JOIN;
+  }
+  if (pointer->broker_due_us <= now_us) {
+    pointer->broker_due_us = INT64_MAX;
+    if (pointer->linked && !pointer->online) {
+      (pointer->reconnects)++;
+      actions |= NET_SUPERVISOR_MQTT_RECONNECT;
+    }
+  }
+  return actions;
+}
+
+int64_t net_supervisor_next_us(const net_supervisor_t *pointer) {
+  return (pointer->join_due_us < pointer->broker_due_us)
+             ? pointer->join_due_us
+             : pointer->broker_due_us;
+}
+
+int64_t net_supervisor_mttr_us(const net_supervisor_t *pointer) {
+  return (pointer->relinks > 0) ? pointer->recovery_total_us / pointer->relinks
+                                : 0;
+}
+
+int64_t net_supervisor_offline_mean_us(const net_supervisor_t *pointer) {
+  return (pointer->recoveries > 0)
+             ? pointer->offline_total_us / pointer->recoveries
+             : 0;
+}
+
+void net_supervisor_free(net_supervisor_t *pointer) { free(pointer); }
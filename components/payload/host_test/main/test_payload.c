@@ -0,0 +1,406 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "payload.h"
+#include "cJSON.h"
+#include "payload_cbor.h"
+#include "payload_json.h"
+#include "unity.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define BENCH_ROUNDS 20000
+#define BENCH_BATCH 15
+
+// Heap calls made so far, the linker routes the allocator through here
+static uint32_t allocations;
+
+void *__real_malloc(size_t);
+void *__real_calloc(size_t, size_t);
+void *__real_realloc(void *, size_t);
+
+void *__wrap_malloc(size_t size) {
+  allocations++;
+  return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t count, size_t size) {
+  allocations++;
+  return __real_calloc(count, size);
+}
+
+void *__wrap_realloc(void *pointer, size_t size) {
+  allocations++;
+  return __real_realloc(pointer, size);
+}
+
+static uint8_t buffer[2048];
+
+void setUp(void) { memset(buffer, 0, sizeof(buffer)); }
+
+void tearDown(void) {}
+
+static void test_cbor_encoding(void) {
+  // RFC 8949 appendix A examples
+  payload_cbor_writer_t writer;
+  payload_cbor_writer_fill(&writer, buffer, sizeof(buffer));
+  payload_cbor_write_int(&writer, 10);
+  payload_cbor_write_int(&writer, 500);
+  payload_cbor_write_int(&writer, -1);
+  payload_cbor_write_int(&writer, -1000);
+  payload_cbor_write_int(&writer, 1000000000000);
+  payload_cbor_write_float(&writer, 100000.0f);
+  payload_cbor_write_array(&writer, 3);
+  payload_cbor_write_map(&writer, 0);
+  const uint8_t expected[] = {
+      0x0a, 0x19, 0x01, 0xf4, 0x20, 0x39, 0x03, 0xe7, 0x1b, 0x00, 0x00,
+      0x00, 0xe8, 0xd4, 0xa5, 0x10, 0x00, 0xfa, 0x47, 0xc3, 0x50, 0x00,
+      0x83, 0xa0,
+  };
+  TEST_ASSERT_FALSE(writer.overflow);
+  TEST_ASSERT_EQUAL_UINT32(sizeof(expected), writer.length);
+  TEST_ASSERT_EQUAL_UINT8_ARRAY(expected, buffer, sizeof(expected));
+
+  payload_cbor_reader_t reader;
+  payload_cbor_reader_fill(&reader, buffer, writer.length);
+  TEST_ASSERT_EQUAL_INT64(10, payload_cbor_read_int(&reader));
+  TEST_ASSERT_EQUAL_INT64(500, payload_cbor_read_int(&reader));
+  TEST_ASSERT_EQUAL_INT64(-1, payload_cbor_read_int(&reader));
+  TEST_ASSERT_EQUAL_INT64(-1000, payload_cbor_read_int(&reader));
+  TEST_ASSERT_EQUAL_INT64(1000000000000, payload_cbor_read_int(&reader));
+  TEST_ASSERT_EQUAL_FLOAT(100000.0f, payload_cbor_read_float(&reader));
+  // The array's count claims more items than there are bytes left
+  TEST_ASSERT_EQUAL_UINT32(0, payload_cbor_read_array(&reader));
+  TEST_ASSERT_TRUE(reader.error);
+}
+
+static void test_batch(void) {
+  sample_ring_record_t records[4] = {
+      {.timestamp_us = 1760000000000000,
+       .mask = SAMPLE_RING_MASK(SAMPLE_RING_PRESSURE) |
+               SAMPLE_RING_MASK(SAMPLE_RING_TEMPERATURE) |
+               SAMPLE_RING_MASK(SAMPLE_RING_HUMIDITY)},
+      {.timestamp_us = 1760000001000000,
+       .mask = SAMPLE_RING_MASK(SAMPLE_RING_WIND_SPEED) |
+               SAMPLE_RING_MASK(SAMPLE_RING_WIND_DIRECTION)},
+      // The clock was stepped back, the delta goes negative
+      {.timestamp_us = 1759999999500000,
+       .mask = SAMPLE_RING_MASK(SAMPLE_RING_TEMPERATURE)},
+      {.timestamp_us = 1760000002000000, .mask = 0},
+  };
+  records[0].value[SAMPLE_RING_PRESSURE] = 10132500;
+  records[0].value[SAMPLE_RING_TEMPERATURE] = 2508;
+  records[0].value[SAMPLE_RING_HUMIDITY] = 56317;
+  records[1].value[SAMPLE_RING_WIND_SPEED] = 864;
+  records[1].value[SAMPLE_RING_WIND_DIRECTION] = 28504;
+  records[2].value[SAMPLE_RING_TEMPERATURE] = -1250;
+  const payload_header_t header = {.dropped = 3, .overwritten = 70000};
+
+  const size_t length =
+      payload_encode_batch(&header, records, 4, buffer, sizeof(buffer));
+  TEST_ASSERT_GREATER_THAN_UINT32(0, length);
+
+  payload_header_t decoded_header;
+  sample_ring_record_t decoded[4];
+  uint32_t count;
+  TEST_ASSERT_TRUE(payload_decode_batch(buffer, length, &decoded_header,
+                                        decoded, 4, &count));
+  TEST_ASSERT_EQUAL_UINT32(4, count);
+  TEST_ASSERT_EQUAL_UINT32(PAYLOAD_VERSION, decoded_header.version);
+  TEST_ASSERT_EQUAL_INT64(1760000000000, decoded_header.unix_ms);
+  TEST_ASSERT_EQUAL_UINT32(3, decoded_header.dropped);
+  TEST_ASSERT_EQUAL_UINT32(70000, decoded_header.overwritten);
+  for (uint32_t i = 0; i < count; i++) {
+    TEST_ASSERT_EQUAL_INT64(records[i].timestamp_us, decoded[i].timestamp_us);
+    TEST_ASSERT_EQUAL_UINT32(records[i].mask, decoded[i].mask);
+    TEST_ASSERT_EQUAL_INT32_ARRAY(records[i].value, decoded[i].value,
+                                  SAMPLE_RING_CHANNELS);
+  }
+
+  // Too few records to decode into
+  TEST_ASSERT_FALSE(payload_decode_batch(buffer, length, &decoded_header,
+                                         decoded, 3, &count));
+  // Truncated anywhere
+  for (size_t cut = 0; cut < length; cut++) {
+    TEST_ASSERT_FALSE(payload_decode_batch(buffer, cut, &decoded_header,
+                                           decoded, 4, &count));
+  }
+  // Not enough room to encode
+  TEST_ASSERT_EQUAL_UINT32(
+      0, payload_encode_batch(&header, records, 4, buffer, length - 1));
+}
+
+static void test_batch_size(void) {
+  // A BME280 sample a second, as JSON it would be around 80 bytes each
+  sample_ring_record_t records[15];
+  for (uint32_t i = 0; i < 15; i++) {
+    records[i] = (sample_ring_record_t){
+        .timestamp_us = 1760000000000000 + (int64_t)(i) * 1000000,
+        .mask = SAMPLE_RING_MASK(SAMPLE_RING_PRESSURE) |
+                SAMPLE_RING_MASK(SAMPLE_RING_TEMPERATURE) |
+                SAMPLE_RING_MASK(SAMPLE_RING_HUMIDITY),
+    };
+    records[i].value[SAMPLE_RING_PRESSURE] = 10132500 + (int32_t)(i);
+    records[i].value[SAMPLE_RING_TEMPERATURE] = 2508;
+    records[i].value[SAMPLE_RING_HUMIDITY] = 56317;
+  }
+  const payload_header_t header = {0};
+  const size_t length =
+      payload_encode_batch(&header, records, 15, buffer, sizeof(buffer));
+  // Delta 3, mask 1, pressure 5, temperature 3, humidity 5, array head 1
+  TEST_ASSERT_LESS_OR_EQUAL_UINT32(32 + 15 * 18, length);
+}
+
+static void test_summary(void) {
+  sample_stats_t stats;
+  sample_stats_fill(&stats);
+  const int32_t values[] = {2, 4, 4, 4, 5, 5, 7, 9};
+  for (uint32_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+    sample_ring_record_t record = {
+        .timestamp_us = 1760000000000000 + (int64_t)(i) * 15000000,
+        .mask = SAMPLE_RING_MASK(SAMPLE_RING_TEMPERATURE) |
+                SAMPLE_RING_MASK(SAMPLE_RING_RAIN),
+    };
+    record.value[SAMPLE_RING_TEMPERATURE] = values[i];
+    record.value[SAMPLE_RING_RAIN] = 279 * (int32_t)(i);
+    sample_stats_add(&stats, &record);
+  }
+  const payload_header_t header = {.dropped = 1};
+
+  const size_t length =
+      payload_encode_summary(&header, &stats, buffer, sizeof(buffer));
+  TEST_ASSERT_GREATER_THAN_UINT32(0, length);
+
+  payload_summary_t summary;
+  TEST_ASSERT_TRUE(payload_decode_summary(buffer, length, &summary));
+  TEST_ASSERT_EQUAL_INT64(1760000000000, summary.header.unix_ms);
+  TEST_ASSERT_EQUAL_UINT32(1, summary.header.dropped);
+  TEST_ASSERT_EQUAL_INT64(105000, summary.span_ms);
+  TEST_ASSERT_EQUAL_UINT32(8, summary.records);
+  TEST_ASSERT_EQUAL_UINT32(stats.mask, summary.mask);
+  const payload_summary_channel_t *channel =
+      &summary.channel[SAMPLE_RING_TEMPERATURE];
+  TEST_ASSERT_EQUAL_UINT32(8, channel->count);
+  TEST_ASSERT_EQUAL_INT32(2, channel->min);
+  TEST_ASSERT_EQUAL_INT32(9, channel->max);
+  TEST_ASSERT_FLOAT_WITHIN(1e-5f, 5.0f, channel->mean);
+  TEST_ASSERT_FLOAT_WITHIN(1e-5f, 32.0f / 7.0f, channel->variance);
+  TEST_ASSERT_EQUAL_INT32(1953, summary.channel[SAMPLE_RING_RAIN].max);
+
+  for (size_t cut = 0; cut < length; cut++) {
+    TEST_ASSERT_FALSE(payload_decode_summary(buffer, cut, &summary));
+  }
+}
+
+static void test_unknown_keys(void) {
+  // A later version's extra entries, nested ones included, are stepped over
+  payload_cbor_writer_t writer;
+  payload_cbor_writer_fill(&writer, buffer, sizeof(buffer));
+  payload_cbor_write_map(&writer, 4);
+  payload_cbor_write_int(&writer, 42);
+  payload_cbor_write_map(&writer, 1);
+  payload_cbor_write_int(&writer, 1);
+  payload_cbor_write_array(&writer, 2);
+  payload_cbor_write_float(&writer, 1.5f);
+  payload_cbor_write_int(&writer, -7);
+  payload_cbor_write_int(&writer, PAYLOAD_KEY_VERSION);
+  const size_t version = writer.length;
+  payload_cbor_write_int(&writer, PAYLOAD_VERSION);
+  payload_cbor_write_int(&writer, PAYLOAD_KEY_RECORDS);
+  payload_cbor_write_int(&writer, 12);
+  payload_cbor_write_int(&writer, 43);
+  payload_cbor_write_array(&writer, 0);
+
+  payload_summary_t summary;
+  TEST_ASSERT_TRUE(payload_decode_summary(buffer, writer.length, &summary));
+  TEST_ASSERT_EQUAL_UINT32(12, summary.records);
+  TEST_ASSERT_EQUAL_UINT32(0, summary.mask);
+
+  // Another version isn't guessed at
+  buffer[version] = PAYLOAD_VERSION + 1;
+  TEST_ASSERT_FALSE(payload_decode_summary(buffer, writer.length, &summary));
+}
+
+// A second of BME280 samples each
+static void bench_records(sample_ring_record_t *records, uint32_t count) {
+  for (uint32_t i = 0; i < count; i++) {
+    records[i] = (sample_ring_record_t){
+        .timestamp_us = 1760000000000000 + (int64_t)(i) * 1000000,
+        .mask = SAMPLE_RING_MASK(SAMPLE_RING_PRESSURE) |
+                SAMPLE_RING_MASK(SAMPLE_RING_TEMPERATURE) |
+                SAMPLE_RING_MASK(SAMPLE_RING_HUMIDITY),
+    };
+    records[i].value[SAMPLE_RING_PRESSURE] = 10132500 + (int32_t)(i);
+    records[i].value[SAMPLE_RING_TEMPERATURE] = 2508 - (int32_t)(i);
+    records[i].value[SAMPLE_RING_HUMIDITY] = 56317;
+  }
+}
+
+// The batch publish path as it was, a cJSON tree printed into a buffer
+static size_t cjson_encode_batch(const payload_header_t *header,
+                                 const sample_ring_record_t *records,
+                                 uint32_t count, char *buffer, size_t size) {
+  cJSON *root = cJSON_CreateObject();
+  cJSON_AddNumberToObject(root, "dropped", header->dropped);
+  cJSON_AddNumberToObject(root, "overwritten", header->overwritten);
+  cJSON *batch = cJSON_AddArrayToObject(root, "batch");
+  for (uint32_t i = 0; i < count; i++) {
+    cJSON *sample = cJSON_CreateObject();
+    cJSON_AddNumberToObject(sample, "unix_ms", records[i].timestamp_us / 1000);
+    for (uint32_t j = 0; j < SAMPLE_RING_CHANNELS; j++) {
+      if (records[i].mask & SAMPLE_RING_MASK(j)) {
+        cJSON_AddNumberToObject(sample, sample_ring_channel_name(j),
+                                records[i].value[j]);
+      }
+    }
+    cJSON_AddItemToArray(batch, sample);
+  }
+  memset(buffer, 0, size);
+  const bool printed = cJSON_PrintPreallocated(root, buffer, size - 1, 0);
+  cJSON_Delete(root);
+  return printed ? strlen(buffer) : 0;
+}
+
+static void test_json_batch(void) {
+  sample_ring_record_t records[2] = {
+      {.timestamp_us = 1760000000123456,
+       .mask = SAMPLE_RING_MASK(SAMPLE_RING_PRESSURE) |
+               SAMPLE_RING_MASK(SAMPLE_RING_TEMPERATURE)},
+      {.timestamp_us = 1760000001000000,
+       .mask = SAMPLE_RING_MASK(SAMPLE_RING_WIND_DIRECTION)},
+  };
+  records[0].value[SAMPLE_RING_PRESSURE] = 10132500;
+  records[0].value[SAMPLE_RING_TEMPERATURE] = -1250;
+  records[1].value[SAMPLE_RING_WIND_DIRECTION] = 28504;
+  const payload_header_t header = {.dropped = 2, .overwritten = 0};
+  const char *expected =
+      "{\"dropped\":2,\"overwritten\":0,\"batch\":["
+      "{\"unix_ms\":1760000000123,\"pressure\":10132500,"
+      "\"temperature\":-1250},"
+      "{\"unix_ms\":1760000001000,\"wind_direction\":28504}]}";
+  char *text = (char *)buffer;
+
+  const size_t length = payload_json_encode_batch(&header, records, 2, text,
+                                                  sizeof(buffer));
+  TEST_ASSERT_EQUAL_UINT32(strlen(expected), length);
+  TEST_ASSERT_EQUAL_STRING(expected, text);
+
+  // Every buffer too short says so instead of truncating, the NUL counts
+  for (size_t size = 0; size <= length; size++) {
+    TEST_ASSERT_EQUAL_UINT32(
+        0, payload_json_encode_batch(&header, records, 2, text, size));
+  }
+  TEST_ASSERT_EQUAL_UINT32(
+      length, payload_json_encode_batch(&header, records, 2, text, length + 1));
+
+  // Byte for byte what the cJSON path printed
+  char reference[sizeof(buffer)];
+  sample_ring_record_t many[BENCH_BATCH];
+  bench_records(many, BENCH_BATCH);
+  const size_t reference_length = cjson_encode_batch(
+      &header, many, BENCH_BATCH, reference, sizeof(reference));
+  TEST_ASSERT_GREATER_THAN_UINT32(0, reference_length);
+  TEST_ASSERT_EQUAL_UINT32(reference_length,
+                           payload_json_encode_batch(&header, many, BENCH_BATCH,
+                                                     text, sizeof(buffer)));
+  TEST_ASSERT_EQUAL_STRING(reference, text);
+}
+
+static void test_json_summary(void) {
+  sample_stats_t stats;
+  sample_stats_fill(&stats);
+  const int32_t values[] = {2, 4, 4, 4, 5, 5, 7, 9};
+  for (uint32_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+    sample_ring_record_t record = {
+        .timestamp_us = 1760000000000000 + (int64_t)(i) * 15000000,
+        .mask = SAMPLE_RING_MASK(SAMPLE_RING_TEMPERATURE),
+    };
+    record.value[SAMPLE_RING_TEMPERATURE] = -values[i];
+    sample_stats_add(&stats, &record);
+  }
+  sample_ring_record_t record = {
+      .timestamp_us = 1760000105000000,
+      .mask = SAMPLE_RING_MASK(SAMPLE_RING_PRESSURE),
+  };
+  record.value[SAMPLE_RING_PRESSURE] = 1 << 30;
+  sample_stats_add(&stats, &record);
+  record.value[SAMPLE_RING_PRESSURE] = -(1 << 30);
+  sample_stats_add(&stats, &record);
+  const payload_header_t header = {.dropped = 0, .overwritten = 1};
+  // Variances of 32 / 7 and 2^61
+  const char *expected =
+      "{\"unix_time\":1760000105,\"first_time\":1760000000,\"samples\":10,"
+      "\"dropped\":0,\"overwritten\":1,\"data\":{"
+      "\"pressure\":{\"n\":2,\"min\":-1073741824,\"max\":1073741824,"
+      "\"mean\":0,\"var\":230584301e10},"
+      "\"temperature\":{\"n\":8,\"min\":-9,\"max\":-2,"
+      "\"mean\":-5,\"var\":4.571}}}";
+  char *text = (char *)buffer;
+
+  const size_t length =
+      payload_json_encode_summary(&header, &stats, text, sizeof(buffer));
+  TEST_ASSERT_EQUAL_STRING(expected, text);
+  TEST_ASSERT_EQUAL_UINT32(strlen(expected), length);
+  for (size_t size = 0; size <= length; size++) {
+    TEST_ASSERT_EQUAL_UINT32(
+        0, payload_json_encode_summary(&header, &stats, text, size));
+  }
+}
+
+static void bench(void) {
+  static char text[4096];
+  sample_ring_record_t records[BENCH_BATCH];
+  bench_records(records, BENCH_BATCH);
+  const payload_header_t header = {0};
+  const char *names[] = {"cJSON tree", "payload_json"};
+
+  for (uint32_t path = 0; path < 2; path++) {
+    size_t length = 0;
+    struct timespec begin, end;
+    const uint32_t allocations_before = allocations;
+    clock_gettime(CLOCK_MONOTONIC, &begin);
+    for (uint32_t round = 0; round < BENCH_ROUNDS; round++) {
+      records[0].value[SAMPLE_RING_TEMPERATURE] = (int32_t)(round);
+      length = (path == 0) ? cjson_encode_batch(&header, records, BENCH_BATCH,
+                                                text, sizeof(text))
+                           : payload_json_encode_batch(
+                                 &header, records, BENCH_BATCH, text,
+                                 sizeof(text));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    const double elapsed = (end.tv_sec - begin.tv_sec) * 1e9 +
+                           (double)(end.tv_nsec - begin.tv_nsec);
+    printf("%s: %.0f ns/message, %.1f allocations/message, %zu bytes\n",
+           names[path], elapsed / BENCH_ROUNDS,
+           (double)(allocations - allocations_before) / BENCH_ROUNDS, length);
+  }
+}
+
+void app_main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_cbor_encoding);
+  RUN_TEST(test_batch);
+  RUN_TEST(test_batch_size);
+  RUN_TEST(test_summary);
+  RUN_TEST(test_unknown_keys);
+  RUN_TEST(test_json_batch);
+  RUN_TEST(test_json_summary);
+  const int failures = UNITY_END();
+
+  bench();
+  exit(failures);
+}
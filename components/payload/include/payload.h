@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+#include "sample_ring.h"
+#include "sample_stats.h"
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Binary MQTT payloads, a CBOR map keyed by small integers. Timestamps are
+// milliseconds since the epoch, a batch's samples carry the delta from the
+// one before. Values stay in the sample ring's fixed point units.
+//
+//   batch:   {0: version, 1: unix_ms, 2: dropped, 3: overwritten,
+//             4: [[delta_ms, mask, value for each bit of mask...], ...]}
+//   summary: {0: version, 1: first unix_ms, 2: dropped, 3: overwritten,
+//             5: last minus first in ms, 6: records,
+//             7: {channel: [count, min, max, mean, variance], ...}}
+//
+// Decoders skip keys they don't know, so later versions can add some.
+#define PAYLOAD_VERSION 1
+
+typedef enum {
+  PAYLOAD_KEY_VERSION,
+  PAYLOAD_KEY_UNIX_MS,
+  PAYLOAD_KEY_DROPPED,
+  PAYLOAD_KEY_OVERWRITTEN,
+  PAYLOAD_KEY_SAMPLES,
+  PAYLOAD_KEY_SPAN_MS,
+  PAYLOAD_KEY_RECORDS,
+  PAYLOAD_KEY_CHANNELS,
+} payload_key_t;
+
+// What both payloads start with
+typedef struct {
+  uint32_t version;
+  int64_t unix_ms;
+  uint32_t dropped;
+  uint32_t overwritten;
+} payload_header_t;
+
+typedef struct {
+  uint32_t count;
+  int32_t min;
+  int32_t max;
+  float mean;
+  float variance;
+} payload_summary_channel_t;
+
+typedef struct {
+  payload_header_t header;
+  int64_t span_ms;
+  uint32_t records;
+  // SAMPLE_RING_MASK of the channels present
+  uint32_t mask;
+  payload_summary_channel_t channel[SAMPLE_RING_CHANNELS];
+} payload_summary_t;
+
+// Encodes records into a buffer, the length or 0 if it doesn't fit
+size_t payload_encode_batch(const payload_header_t *,
+                            const sample_ring_record_t *, uint32_t, uint8_t *,
+                            size_t);
+
+// Encodes a report window into a buffer, the length or 0 if it doesn't fit.
+// The header's unix_ms is ignored for the window's first timestamp.
+size_t payload_encode_summary(const payload_header_t *, const sample_stats_t *,
+                              uint8_t *, size_t);
+
+// Decodes a batch into at most some records, false if it's malformed or has
+// more records than that
+bool payload_decode_batch(const uint8_t *, size_t, payload_header_t *,
+                          sample_ring_record_t *, uint32_t, uint32_t *);
+
+// Decodes a summary, false if it's malformed
+bool payload_decode_summary(const uint8_t *, size_t, payload_summary_t *);
@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// The subset of CBOR (RFC 8949) the payloads use: integers, single precision
+// floats, and definite length arrays and maps
+
+// Writes into a caller's buffer. Running out of room sticks, so encoders only
+// check once at the end.
+typedef struct {
+  uint8_t *buffer;
+  size_t size;
+  size_t length;
+  bool overflow;
+} payload_cbor_writer_t;
+
+// Reads from a caller's buffer. Malformed or truncated input sticks, reads
+// after it return 0.
+typedef struct {
+  const uint8_t *buffer;
+  size_t length;
+  size_t offset;
+  bool error;
+} payload_cbor_reader_t;
+
+// Static fill of payload_cbor_writer_t structs
+void payload_cbor_writer_fill(payload_cbor_writer_t *, uint8_t *, size_t);
+
+void payload_cbor_write_int(payload_cbor_writer_t *, int64_t);
+void payload_cbor_write_float(payload_cbor_writer_t *, float);
+void payload_cbor_write_array(payload_cbor_writer_t *, uint32_t);
+void payload_cbor_write_map(payload_cbor_writer_t *, uint32_t);
+
+// Static fill of payload_cbor_reader_t structs
+void payload_cbor_reader_fill(payload_cbor_reader_t *, const uint8_t *,
+                              size_t);
+
+int64_t payload_cbor_read_int(payload_cbor_reader_t *);
+// Also takes integers, which a generic encoder may shorten floats to
+float payload_cbor_read_float(payload_cbor_reader_t *);
+// Item counts of a definite length array or map
+uint32_t payload_cbor_read_array(payload_cbor_reader_t *);
+uint32_t payload_cbor_read_map(payload_cbor_reader_t *);
+// Steps over one item of any type this subset writes, nested ones included
+void payload_cbor_skip(payload_cbor_reader_t *);
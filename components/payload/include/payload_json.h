@@ -0,0 +1,39 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+#include "payload.h"
+#include <stddef.h>
+#include <stdint.h>
+
+// The JSON payloads, written straight into a caller's buffer with no heap
+// allocation. Values stay in the sample ring's fixed point units.
+//
+//   batch:   {"dropped":0,"overwritten":0,
+//             "batch":[{"unix_ms":0,"<channel>":0,...},...]}
+//   summary: {"unix_time":0,"first_time":0,"samples":0,"dropped":0,
+//             "overwritten":0,"data":{"<channel>":{"n":0,"min":0,"max":0,
+//             "mean":0.5,"var":0.25},...}}
+
+// Encodes records into a buffer, NUL terminated. The length without the NUL,
+// or 0 if it doesn't fit.
+size_t payload_json_encode_batch(const payload_header_t *,
+                                 const sample_ring_record_t *, uint32_t,
+                                 char *, size_t);
+
+// Encodes a report window into a buffer, NUL terminated. The length without
+// the NUL, or 0 if it doesn't fit.
+size_t payload_json_encode_summary(const payload_header_t *,
+                                   const sample_stats_t *, char *, size_t);
@@ -0,0 +1,232 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "payload.h"
+#include "payload_cbor.h"
+
+// Channels set in a mask
+static uint32_t payload_channels(uint32_t mask) {
+  uint32_t count = 0;
+  for (uint32_t i = 0; i < SAMPLE_RING_CHANNELS; i++) {
+    if (mask & SAMPLE_RING_MASK(i)) {
+      count++;
+    }
+  }
+  return count;
+}
+
+static void payload_encode_header(payload_cbor_writer_t *writer,
+                                  const payload_header_t *header,
+                                  int64_t unix_ms) {
+  payload_cbor_write_int(writer, PAYLOAD_KEY_VERSION);
+  payload_cbor_write_int(writer, PAYLOAD_VERSION);
+  payload_cbor_write_int(writer, PAYLOAD_KEY_UNIX_MS);
+  payload_cbor_write_int(writer, unix_ms);
+  payload_cbor_write_int(writer, PAYLOAD_KEY_DROPPED);
+  payload_cbor_write_int(writer, header->dropped);
+  payload_cbor_write_int(writer, PAYLOAD_KEY_OVERWRITTEN);
+  payload_cbor_write_int(writer, header->overwritten);
+}
+
+// Reads a header key's value, false if the key isn't a header's
+static bool payload_decode_header(payload_cbor_reader_t *reader,
+                                  payload_header_t *header, int64_t key) {
+  switch (key) {
+  case PAYLOAD_KEY_VERSION: {
+    header->version = (uint32_t)payload_cbor_read_int(reader);
+    return true;
+  }
+  case PAYLOAD_KEY_UNIX_MS: {
+    header->unix_ms = payload_cbor_read_int(reader);
+    return true;
+  }
+  case PAYLOAD_KEY_DROPPED: {
+    header->dropped = (uint32_t)payload_cbor_read_int(reader);
+    return true;
+  }
+  case PAYLOAD_KEY_OVERWRITTEN: {
+    header->overwritten = (uint32_t)payload_cbor_read_int(reader);
+    return true;
+  }
+  default: {
+    return false;
+  }
+  }
+}
+
+size_t payload_encode_batch(const payload_header_t *header,
+                            const sample_ring_record_t *records,
+                            uint32_t count, uint8_t *buffer, size_t size) {
+  payload_cbor_writer_t writer;
+  payload_cbor_writer_fill(&writer, buffer, size);
+  const int64_t base_ms = (count > 0) ? records[0].timestamp_us / 1000 : 0;
+
+  payload_cbor_write_map(&writer, 5);
+  payload_encode_header(&writer, header, base_ms);
+  payload_cbor_write_int(&writer, PAYLOAD_KEY_SAMPLES);
+  payload_cbor_write_array(&writer, count);
+  int64_t last_ms = base_ms;
+  for (uint32_t i = 0; i < count; i++) {
+    const sample_ring_record_t *record = &records[i];
+    const int64_t unix_ms = record->timestamp_us / 1000;
+    payload_cbor_write_array(&writer, 2 + payload_channels(record->mask));
+    payload_cbor_write_int(&writer, unix_ms - last_ms);
+    payload_cbor_write_int(&writer, record->mask);
+    for (uint32_t j = 0; j < SAMPLE_RING_CHANNELS; j++) {
+      if (record->mask & SAMPLE_RING_MASK(j)) {
+        payload_cbor_write_int(&writer, record->value[j]);
+      }
+    }
+    last_ms = unix_ms;
+  }
+  return writer.overflow ? 0 : writer.length;
+}
+
+size_t payload_encode_summary(const payload_header_t *header,
+                              const sample_stats_t *stats, uint8_t *buffer,
+                              size_t size) {
+  payload_cbor_writer_t writer;
+  payload_cbor_writer_fill(&writer, buffer, size);
+  const int64_t first_ms = stats->first_us / 1000;
+
+  payload_cbor_write_map(&writer, 7);
+  payload_encode_header(&writer, header, first_ms);
+  payload_cbor_write_int(&writer, PAYLOAD_KEY_SPAN_MS);
+  payload_cbor_write_int(&writer, stats->last_us / 1000 - first_ms);
+  payload_cbor_write_int(&writer, PAYLOAD_KEY_RECORDS);
+  payload_cbor_write_int(&writer, stats->records);
+  payload_cbor_write_int(&writer, PAYLOAD_KEY_CHANNELS);
+  payload_cbor_write_map(&writer, payload_channels(stats->mask));
+  for (uint32_t i = 0; i < SAMPLE_RING_CHANNELS; i++) {
+    if (stats->mask & SAMPLE_RING_MASK(i)) {
+      const sample_stats_channel_t *channel = &stats->channel[i];
+      payload_cbor_write_int(&writer, i);
+      payload_cbor_write_array(&writer, 5);
+      payload_cbor_write_int(&writer, channel->count);
+      payload_cbor_write_int(&writer, channel->min);
+      payload_cbor_write_int(&writer, channel->max);
+      payload_cbor_write_float(&writer, sample_stats_mean(channel));
+      payload_cbor_write_float(&writer, sample_stats_variance(channel));
+    }
+  }
+  return writer.overflow ? 0 : writer.length;
+}
+
+// Reads one sample array, carrying the timestamp on from the previous one
+static void payload_decode_sample(payload_cbor_reader_t *reader,
+                                  sample_ring_record_t *record,
+                                  int64_t *unix_ms) {
+  const uint32_t items = payload_cbor_read_array(reader);
+  *unix_ms += payload_cbor_read_int(reader);
+  record->timestamp_us = *unix_ms * 1000;
+  record->mask = (uint32_t)payload_cbor_read_int(reader);
+  if (items != 2 + payload_channels(record->mask) ||
+      (record->mask >> SAMPLE_RING_CHANNELS) != 0) {
+    reader->error = true;
+    return;
+  }
+  for (uint32_t i = 0; i < SAMPLE_RING_CHANNELS; i++) {
+    record->value[i] = 0;
+    if (record->mask & SAMPLE_RING_MASK(i)) {
+      record->value[i] = (int32_t)payload_cbor_read_int(reader);
+    }
+  }
+}
+
+bool payload_decode_batch(const uint8_t *buffer, size_t length,
+                          payload_header_t *header,
+                          sample_ring_record_t *records, uint32_t size,
+                          uint32_t *count) {
+  payload_cbor_reader_t reader;
+  payload_cbor_reader_fill(&reader, buffer, length);
+  *header = (payload_header_t){0};
+  *count = 0;
+
+  // The samples are deltas from the header's timestamp, which may come later
+  // in a map from another encoder, so they're rebased at the end
+  int64_t unix_ms = 0;
+  const uint32_t entries = payload_cbor_read_map(&reader);
+  for (uint32_t i = 0; i < entries && !reader.error; i++) {
+    const int64_t key = payload_cbor_read_int(&reader);
+    if (payload_decode_header(&reader, header, key)) {
+      continue;
+    }
+    if (key != PAYLOAD_KEY_SAMPLES) {
+      payload_cbor_skip(&reader);
+      continue;
+    }
+    const uint32_t samples = payload_cbor_read_array(&reader);
+    if (samples > size) {
+      return false;
+    }
+    for (uint32_t j = 0; j < samples && !reader.error; j++) {
+      payload_decode_sample(&reader, &records[j], &unix_ms);
+    }
+    *count = samples;
+  }
+  for (uint32_t i = 0; i < *count; i++) {
+    records[i].timestamp_us += header->unix_ms * 1000;
+  }
+  return !reader.error && header->version == PAYLOAD_VERSION;
+}
+
+bool payload_decode_summary(const uint8_t *buffer, size_t length,
+                            payload_summary_t *summary) {
+  payload_cbor_reader_t reader;
+  payload_cbor_reader_fill(&reader, buffer, length);
+  *summary = (payload_summary_t){0};
+
+  const uint32_t entries = payload_cbor_read_map(&reader);
+  for (uint32_t i = 0; i < entries && !reader.error; i++) {
+    const int64_t key = payload_cbor_read_int(&reader);
+    if (payload_decode_header(&reader, &summary->header, key)) {
+      continue;
+    }
+    switch (key) {
+    case PAYLOAD_KEY_SPAN_MS: {
+      summary->span_ms = payload_cbor_read_int(&reader);
+      break;
+    }
+    case PAYLOAD_KEY_RECORDS: {
+      summary->records = (uint32_t)payload_cbor_read_int(&reader);
+      break;
+    }
+    case PAYLOAD_KEY_CHANNELS: {
+      const uint32_t channels = payload_cbor_read_map(&reader);
+      for (uint32_t j = 0; j < channels && !reader.error; j++) {
+        const int64_t index = payload_cbor_read_int(&reader);
+        if (index < 0 || index >= SAMPLE_RING_CHANNELS ||
+            payload_cbor_read_array(&reader) != 5) {
+          reader.error = true;
+          break;
+        }
+        payload_summary_channel_t *channel = &summary->channel[index];
+        channel->count = (uint32_t)payload_cbor_read_int(&reader);
+        channel->min = (int32_t)payload_cbor_read_int(&reader);
+        channel->max = (int32_t)payload_cbor_read_int(&reader);
+        channel->mean = payload_cbor_read_float(&reader);
+        channel->variance = payload_cbor_read_float(&reader);
+        summary->mask |= SAMPLE_RING_MASK(index);
+      }
+      break;
+    }
+    default: {
+      payload_cbor_skip(&reader);
+      break;
+    }
+    }
+  }
+  return !reader.error && summary->header.version == PAYLOAD_VERSION;
+}
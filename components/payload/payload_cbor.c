@@ -0,0 +1,266 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "payload_cbor.h"
+#include <string.h>
+
+#define PAYLOAD_CBOR_UNSIGNED 0
+#define PAYLOAD_CBOR_NEGATIVE 1
+#define PAYLOAD_CBOR_ARRAY 4
+#define PAYLOAD_CBOR_MAP 5
+#define PAYLOAD_CBOR_SIMPLE 7
+// Additional information values
+#define PAYLOAD_CBOR_UINT8 24
+#define PAYLOAD_CBOR_FLOAT16 25
+#define PAYLOAD_CBOR_FLOAT32 26
+#define PAYLOAD_CBOR_FLOAT64 27
+// Nesting the skipper follows, payloads go two deep
+#define PAYLOAD_CBOR_DEPTH 8
+
+static void payload_cbor_put(payload_cbor_writer_t *pointer,
+                             const uint8_t *bytes, size_t size) {
+  if (pointer->overflow || pointer->size - pointer->length < size) {
+    pointer->overflow = true;
+    return;
+  }
+  memcpy(&pointer->buffer[pointer->length], bytes, size);
+  pointer->length += size;
+}
+
+// Initial byte and the shortest big endian argument that holds the value
+static void payload_cbor_head(payload_cbor_writer_t *pointer, uint8_t major,
+                              uint64_t value) {
+  uint8_t head[9];
+  size_t size;
+  if (value < PAYLOAD_CBOR_UINT8) {
+    head[0] = (uint8_t)((major << 5) | value);
+    size = 1;
+  } else {
+    uint8_t additional;
+    size_t bytes;
+    if (value <= UINT8_MAX) {
+      additional = 24;
+      bytes = 1;
+    } else if (value <= UINT16_MAX) {
+      additional = 25;
+      bytes = 2;
+    } else if (value <= UINT32_MAX) {
+      additional = 26;
+      bytes = 4;
+    } else {
+      additional = 27;
+      bytes = 8;
+    }
+    head[0] = (uint8_t)((major << 5) | additional);
+    for (size_t i = 0; i < bytes; i++) {
+      head[bytes - i] = (uint8_t)(value >> (8 * i));
+    }
+    size = bytes + 1;
+  }
+  payload_cbor_put(pointer, head, size);
+}
+
+void payload_cbor_writer_fill(payload_cbor_writer_t *pointer, uint8_t *buffer,
+                              size_t size) {
+  pointer->buffer = buffer;
+  pointer->size = size;
+  pointer->length = 0;
+  pointer->overflow = false;
+}
+
+void payload_cbor_write_int(payload_cbor_writer_t *pointer, int64_t value) {
+  if (value < 0) {
+    // -1 - n without overflowing on INT64_MIN
+    payload_cbor_head(pointer, PAYLOAD_CBOR_NEGATIVE, ~(uint64_t)value);
+  } else {
+    payload_cbor_head(pointer, PAYLOAD_CBOR_UNSIGNED, (uint64_t)value);
+  }
+}
+
+void payload_cbor_write_float(payload_cbor_writer_t *pointer, float value) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+  const uint8_t bytes[5] = {
+      (PAYLOAD_CBOR_SIMPLE << 5) | PAYLOAD_CBOR_FLOAT32,
+      (uint8_t)(bits >> 24),
+      (uint8_t)(bits >> 16),
+      (uint8_t)(bits >> 8),
+      (uint8_t)(bits),
+  };
+  payload_cbor_put(pointer, bytes, sizeof(bytes));
+}
+
+void payload_cbor_write_array(payload_cbor_writer_t *pointer, uint32_t count) {
+  payload_cbor_head(pointer, PAYLOAD_CBOR_ARRAY, count);
+}
+
+void payload_cbor_write_map(payload_cbor_writer_t *pointer, uint32_t count) {
+  payload_cbor_head(pointer, PAYLOAD_CBOR_MAP, count);
+}
+
+void payload_cbor_reader_fill(payload_cbor_reader_t *pointer,
+                              const uint8_t *buffer, size_t length) {
+  pointer->buffer = buffer;
+  pointer->length = length;
+  pointer->offset = 0;
+  pointer->error = false;
+}
+
+// Reads an initial byte and its argument, the major type goes to *major
+static uint64_t payload_cbor_read_head(payload_cbor_reader_t *pointer,
+                                       uint8_t *major) {
+  *major = 0xFF;
+  if (pointer->error || pointer->offset >= pointer->length) {
+    pointer->error = true;
+    return 0;
+  }
+  const uint8_t initial = pointer->buffer[(pointer->offset)++];
+  const uint8_t additional = initial & 0x1F;
+  *major = initial >> 5;
+  if (additional < PAYLOAD_CBOR_UINT8) {
+    return additional;
+  }
+  if (additional > PAYLOAD_CBOR_FLOAT64) {
+    // Indefinite lengths and reserved values aren't in the subset
+    pointer->error = true;
+    return 0;
+  }
+  const size_t bytes = (size_t)1 << (additional - PAYLOAD_CBOR_UINT8);
+  if (pointer->length - pointer->offset < bytes) {
+    pointer->error = true;
+    return 0;
+  }
+  uint64_t value = 0;
+  for (size_t i = 0; i < bytes; i++) {
+    value = (value << 8) | pointer->buffer[(pointer->offset)++];
+  }
+  return value;
+}
+
+int64_t payload_cbor_read_int(payload_cbor_reader_t *pointer) {
+  uint8_t major;
+  const uint64_t value = payload_cbor_read_head(pointer, &major);
+  if (value > INT64_MAX) {
+    pointer->error = true;
+    return 0;
+  }
+  switch (major) {
+  case PAYLOAD_CBOR_UNSIGNED: {
+    return (int64_t)value;
+  }
+  case PAYLOAD_CBOR_NEGATIVE: {
+    return -1 - (int64_t)value;
+  }
+  default: {
+    pointer->error = true;
+    return 0;
+  }
+  }
+}
+
+float payload_cbor_read_float(payload_cbor_reader_t *pointer) {
+  if (pointer->error || pointer->offset >= pointer->length) {
+    pointer->error = true;
+    return 0.0f;
+  }
+  const uint8_t initial = pointer->buffer[pointer->offset];
+  if ((initial >> 5) != PAYLOAD_CBOR_SIMPLE) {
+    return (float)payload_cbor_read_int(pointer);
+  }
+  uint8_t major;
+  const uint64_t value = payload_cbor_read_head(pointer, &major);
+  switch (initial & 0x1F) {
+  case PAYLOAD_CBOR_FLOAT32: {
+    const uint32_t bits = (uint32_t)value;
+    float result;
+    memcpy(&result, &bits, sizeof(result));
+    return result;
+  }
+  case PAYLOAD_CBOR_FLOAT64: {
+    double result;
+    memcpy(&result, &value, sizeof(result));
+    return (float)result;
+  }
+  default: {
+    // Half precision and simple values aren't in the subset
+    pointer->error = true;
+    return 0.0f;
+  }
+  }
+}
+
+// Reads the item count of a container, checking it against the bytes left
+static uint32_t payload_cbor_read_count(payload_cbor_reader_t *pointer,
+                                        uint8_t expected) {
+  uint8_t major;
+  const uint64_t count = payload_cbor_read_head(pointer, &major);
+  // Every item is at least a byte
+  if (major != expected || count > pointer->length - pointer->offset) {
+    pointer->error = true;
+    return 0;
+  }
+  return (uint32_t)count;
+}
+
+uint32_t payload_cbor_read_array(payload_cbor_reader_t *pointer) {
+  return payload_cbor_read_count(pointer, PAYLOAD_CBOR_ARRAY);
+}
+
+uint32_t payload_cbor_read_map(payload_cbor_reader_t *pointer) {
+  return payload_cbor_read_count(pointer, PAYLOAD_CBOR_MAP);
+}
+
+void payload_cbor_skip(payload_cbor_reader_t *pointer) {
+  // Items still to skip at each open container, without recursion
+  uint64_t pending[PAYLOAD_CBOR_DEPTH];
+  uint32_t depth = 0;
+  pending[0] = 1;
+  while (!pointer->error) {
+    if (pending[depth] == 0) {
+      if (depth == 0) {
+        return;
+      }
+      depth--;
+      continue;
+    }
+    pending[depth]--;
+
+    uint8_t major;
+    const uint64_t value = payload_cbor_read_head(pointer, &major);
+    switch (major) {
+    case PAYLOAD_CBOR_UNSIGNED:
+    case PAYLOAD_CBOR_NEGATIVE:
+    case PAYLOAD_CBOR_SIMPLE: {
+      break;
+    }
+    case PAYLOAD_CBOR_ARRAY:
+    case PAYLOAD_CBOR_MAP: {
+      if (depth + 1 >= PAYLOAD_CBOR_DEPTH ||
+          value > pointer->length - pointer->offset) {
+        pointer->error = true;
+        break;
+      }
+      depth++;
+      pending[depth] = (major == PAYLOAD_CBOR_MAP) ? value * 2 : value;
+      break;
+    }
+    default: {
+      // Strings and tags aren't in the subset
+      pointer->error = true;
+      break;
+    }
+    }
+  }
+}
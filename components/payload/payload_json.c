@@ -0,0 +1,209 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "payload_json.h"
+#include <math.h>
+#include <stdbool.h>
+#include <string.h>
+
+// Running out of room sticks, so encoders only check once at the end
+typedef struct {
+  char *buffer;
+  size_t size;
+  size_t length;
+  bool overflow;
+} payload_json_writer_t;
+
+static void payload_json_put(payload_json_writer_t *pointer, const char *bytes,
+                             size_t size) {
+  // One byte always stays free for the NUL
+  if (pointer->overflow || pointer->size - pointer->length <= size) {
+    pointer->overflow = true;
+    return;
+  }
+  memcpy(&pointer->buffer[pointer->length], bytes, size);
+  pointer->length += size;
+}
+
+static void payload_json_text(payload_json_writer_t *pointer,
+                              const char *text) {
+  payload_json_put(pointer, text, strlen(text));
+}
+
+// A quoted key and its colon, with a comma first unless it opens an object
+static void payload_json_key(payload_json_writer_t *pointer, const char *key,
+                             bool first) {
+  if (!first) {
+    payload_json_put(pointer, ",", 1);
+  }
+  payload_json_put(pointer, "\"", 1);
+  payload_json_text(pointer, key);
+  payload_json_put(pointer, "\":", 2);
+}
+
+static void payload_json_int(payload_json_writer_t *pointer, int64_t value) {
+  char digits[20];
+  size_t count = 0;
+  // Negated as unsigned so INT64_MIN survives
+  uint64_t magnitude = (value < 0) ? -(uint64_t)value : (uint64_t)value;
+  do {
+    digits[sizeof(digits) - ++count] = (char)('0' + magnitude % 10);
+    magnitude /= 10;
+  } while (magnitude > 0);
+  if (value < 0) {
+    payload_json_put(pointer, "-", 1);
+  }
+  payload_json_put(pointer, &digits[sizeof(digits) - count], count);
+}
+
+// Thousandths are finer than any channel's fixed point unit. printf isn't
+// used, newlib's float formatting allocates.
+static void payload_json_float(payload_json_writer_t *pointer, float value) {
+  if (!isfinite(value)) {
+    payload_json_text(pointer, "null");
+    return;
+  }
+  // Past a billion a float's digits have run out, so it goes out as nine
+  // significant digits and an exponent
+  if (fabsf(value) >= 1e9f) {
+    double scaled = value;
+    int32_t exponent = 0;
+    while (fabs(scaled) >= 1e9) {
+      scaled /= 10.0;
+      exponent++;
+    }
+    payload_json_int(pointer, llround(scaled));
+    payload_json_put(pointer, "e", 1);
+    payload_json_int(pointer, exponent);
+    return;
+  }
+
+  const int64_t milli = llroundf(value * 1000.0f);
+  const uint64_t magnitude = (milli < 0) ? -(uint64_t)milli : (uint64_t)milli;
+  if (milli < 0) {
+    payload_json_put(pointer, "-", 1);
+  }
+  payload_json_int(pointer, (int64_t)(magnitude / 1000));
+  const uint32_t fraction = (uint32_t)(magnitude % 1000);
+  if (fraction == 0) {
+    return;
+  }
+  char digits[4] = {'.', (char)('0' + fraction / 100),
+                    (char)('0' + fraction / 10 % 10),
+                    (char)('0' + fraction % 10)};
+  size_t count = sizeof(digits);
+  while (digits[count - 1] == '0') {
+    count--;
+  }
+  payload_json_put(pointer, digits, count);
+}
+
+static void payload_json_fill(payload_json_writer_t *pointer, char *buffer,
+                              size_t size) {
+  pointer->buffer = buffer;
+  pointer->size = size;
+  pointer->length = 0;
+  pointer->overflow = (size == 0);
+}
+
+// NUL terminates, the length or 0 on overflow
+static size_t payload_json_finish(payload_json_writer_t *pointer) {
+  if (pointer->overflow) {
+    if (pointer->size > 0) {
+      pointer->buffer[0] = '\0';
+    }
+    return 0;
+  }
+  pointer->buffer[pointer->length] = '\0';
+  return pointer->length;
+}
+
+// The sample ring's loss counters
+static void payload_json_ring(payload_json_writer_t *writer,
+                              const payload_header_t *header, bool first) {
+  payload_json_key(writer, "dropped", first);
+  payload_json_int(writer, header->dropped);
+  payload_json_key(writer, "overwritten", false);
+  payload_json_int(writer, header->overwritten);
+}
+
+size_t payload_json_encode_batch(const payload_header_t *header,
+                                 const sample_ring_record_t *records,
+                                 uint32_t count, char *buffer, size_t size) {
+  payload_json_writer_t writer;
+  payload_json_fill(&writer, buffer, size);
+
+  payload_json_put(&writer, "{", 1);
+  payload_json_ring(&writer, header, true);
+  payload_json_key(&writer, "batch", false);
+  payload_json_put(&writer, "[", 1);
+  for (uint32_t i = 0; i < count && !writer.overflow; i++) {
+    const sample_ring_record_t *record = &records[i];
+    payload_json_text(&writer, (i == 0) ? "{" : ",{");
+    // Time of the sample, not of the publish
+    payload_json_key(&writer, "unix_ms", true);
+    payload_json_int(&writer, record->timestamp_us / 1000);
+    for (uint32_t j = 0; j < SAMPLE_RING_CHANNELS; j++) {
+      if (record->mask & SAMPLE_RING_MASK(j)) {
+        payload_json_key(&writer, sample_ring_channel_name(j), false);
+        payload_json_int(&writer, record->value[j]);
+      }
+    }
+    payload_json_put(&writer, "}", 1);
+  }
+  payload_json_put(&writer, "]}", 2);
+  return payload_json_finish(&writer);
+}
+
+size_t payload_json_encode_summary(const payload_header_t *header,
+                                   const sample_stats_t *stats, char *buffer,
+                                   size_t size) {
+  payload_json_writer_t writer;
+  payload_json_fill(&writer, buffer, size);
+
+  payload_json_put(&writer, "{", 1);
+  // Times of the window's first and last samples, not of the publish
+  payload_json_key(&writer, "unix_time", true);
+  payload_json_int(&writer, stats->last_us / 1000000);
+  payload_json_key(&writer, "first_time", false);
+  payload_json_int(&writer, stats->first_us / 1000000);
+  payload_json_key(&writer, "samples", false);
+  payload_json_int(&writer, stats->records);
+  payload_json_ring(&writer, header, false);
+  payload_json_key(&writer, "data", false);
+  payload_json_put(&writer, "{", 1);
+  bool first = true;
+  for (uint32_t i = 0; i < SAMPLE_RING_CHANNELS; i++) {
+    if (stats->mask & SAMPLE_RING_MASK(i)) {
+      const sample_stats_channel_t *channel = &stats->channel[i];
+      payload_json_key(&writer, sample_ring_channel_name(i), first);
+      payload_json_put(&writer, "{", 1);
+      payload_json_key(&writer, "n", true);
+      payload_json_int(&writer, channel->count);
+      payload_json_key(&writer, "min", false);
+      payload_json_int(&writer, channel->min);
+      payload_json_key(&writer, "max", false);
+      payload_json_int(&writer, channel->max);
+      payload_json_key(&writer, "mean", false);
+      payload_json_float(&writer, sample_stats_mean(channel));
+      payload_json_key(&writer, "var", false);
+      payload_json_float(&writer, sample_stats_variance(channel));
+      payload_json_put(&writer, "}", 1);
+      first = false;
+    }
+  }
+  payload_json_put(&writer, "}}", 2);
+  return payload_json_finish(&writer);
+}
@@ -0,0 +1,327 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "sample_log.h"
+#include "unity.h"
+#include <stdio.h>
+#include <string.h>
+
+// A 32 byte sector header, then records with a state word and a CRC each
+#define SLOTS                                                                  \
+  ((SAMPLE_LOG_SECTOR_SIZE - 32) / (sizeof(sample_ring_record_t) + 8))
+#define SECTORS 4
+
+// NOR flash in a file. Writes AND into what is there, erases set 0xff, and the
+// power goes out once the budget of bytes to write or erase runs out.
+static FILE *file;
+static int64_t budget;
+static sample_log_t *sample_log;
+
+static bool spend(size_t *length) {
+  if (budget < 0) {
+    return true;
+  }
+  if ((int64_t)*length > budget) {
+    *length = budget;
+    budget = 0;
+    return false;
+  }
+  budget -= *length;
+  return true;
+}
+
+static esp_err_t flash_read(void *context, uint32_t offset, void *buffer,
+                            size_t length) {
+  fseek(file, offset, SEEK_SET);
+  return fread(buffer, 1, length, file) == length ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t flash_write(void *context, uint32_t offset,
+                             const void *buffer, size_t length) {
+  uint8_t bytes[SAMPLE_LOG_SECTOR_SIZE];
+  const bool powered = spend(&length);
+  flash_read(context, offset, bytes, length);
+  for (size_t i = 0; i < length; i++) {
+    bytes[i] &= ((const uint8_t *)buffer)[i];
+  }
+  fseek(file, offset, SEEK_SET);
+  fwrite(bytes, 1, length, file);
+  return powered ? ESP_OK : ESP_FAIL;
+}
+
+static esp_err_t flash_erase(void *context, uint32_t offset, size_t length) {
+  uint8_t bytes[SAMPLE_LOG_SECTOR_SIZE];
+  const bool powered = spend(&length);
+  memset(bytes, 0xff, length);
+  fseek(file, offset, SEEK_SET);
+  fwrite(bytes, 1, length, file);
+  return powered ? ESP_OK : ESP_FAIL;
+}
+
+static const sample_log_flash_t flash = {
+    .read = flash_read,
+    .write = flash_write,
+    .erase = flash_erase,
+    .size = SECTORS * SAMPLE_LOG_SECTOR_SIZE,
+};
+
+// Boots on whatever the file holds
+static void reboot(void) {
+  budget = -1;
+  sample_log_fill(sample_log, &flash);
+  TEST_ASSERT_EQUAL(ESP_OK, sample_log_mount(sample_log));
+}
+
+void setUp(void) {
+  file = tmpfile();
+  uint8_t bytes[SAMPLE_LOG_SECTOR_SIZE];
+  memset(bytes, 0, sizeof(bytes));
+  for (uint32_t i = 0; i < SECTORS; i++) {
+    fwrite(bytes, 1, sizeof(bytes), file);
+  }
+  budget = -1;
+  sample_log_init(&sample_log, &flash);
+}
+
+void tearDown(void) {
+  sample_log_free(sample_log);
+  fclose(file);
+}
+
+static sample_ring_record_t make(int32_t i) {
+  sample_ring_record_t record = {
+      .timestamp_us = 1700000000000000 + (int64_t)i * 1000000,
+      .mask = SAMPLE_RING_MASK(SAMPLE_RING_PRESSURE) |
+              SAMPLE_RING_MASK(SAMPLE_RING_TEMPERATURE),
+  };
+  record.value[SAMPLE_RING_PRESSURE] = 10132500 + i;
+  record.value[SAMPLE_RING_TEMPERATURE] = -i;
+  return record;
+}
+
+static esp_err_t append(int32_t i) {
+  const sample_ring_record_t record = make(i);
+  return sample_log_append(sample_log, &record);
+}
+
+// Peeks up to count records and checks they run from first on
+static void expect(int32_t first, uint32_t count) {
+  sample_ring_record_t records[SLOTS * SECTORS];
+  TEST_ASSERT_EQUAL_UINT32(count, sample_log_peek(sample_log, records, count));
+  for (uint32_t i = 0; i < count; i++) {
+    const sample_ring_record_t record = make(first + i);
+    TEST_ASSERT_EQUAL_MEMORY(&record, &records[i], sizeof(record));
+  }
+}
+
+static void test_format(void) {
+  // Zeroed flash holds no log yet
+  reboot();
+  TEST_ASSERT_EQUAL_UINT32(0, sample_log->depth);
+  TEST_ASSERT_EQUAL_UINT32(1, sample_log->wear);
+  sample_ring_record_t record;
+  TEST_ASSERT_EQUAL_UINT32(0, sample_log_peek(sample_log, &record, 1));
+  TEST_ASSERT_EQUAL(ESP_OK, sample_log_consume(sample_log));
+}
+
+static void test_fifo(void) {
+  reboot();
+  for (int32_t i = 0; i < 200; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, append(i));
+  }
+  TEST_ASSERT_EQUAL_UINT32(200, sample_log->depth);
+
+  // Peeking twice gives the same records until they are consumed
+  expect(0, 32);
+  expect(0, 32);
+  TEST_ASSERT_EQUAL(ESP_OK, sample_log_consume(sample_log));
+  TEST_ASSERT_EQUAL_UINT32(168, sample_log->depth);
+  for (int32_t i = 32; i < 200; i += 32) {
+    const uint32_t count = 200 - i < 32 ? 200 - i : 32;
+    expect(i, count);
+    TEST_ASSERT_EQUAL(ESP_OK, sample_log_consume(sample_log));
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, sample_log->depth);
+  TEST_ASSERT_EQUAL_UINT32(200, sample_log->consumed);
+  TEST_ASSERT_EQUAL_UINT32(0, sample_log->corrupt);
+}
+
+static void test_reboot(void) {
+  reboot();
+  for (int32_t i = 0; i < 100; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, append(i));
+  }
+  expect(0, 40);
+  TEST_ASSERT_EQUAL(ESP_OK, sample_log_consume(sample_log));
+  // Peeked but not consumed records come back
+  expect(40, 10);
+
+  reboot();
+  TEST_ASSERT_EQUAL_UINT32(60, sample_log->depth);
+  TEST_ASSERT_EQUAL(ESP_OK, append(100));
+  expect(40, 61);
+
+  // Consuming everything up to a sector boundary
+  TEST_ASSERT_EQUAL(ESP_OK, sample_log_consume(sample_log));
+  for (int32_t i = 101; i < (int32_t)SLOTS * 2; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, append(i));
+  }
+  expect(101, SLOTS * 2 - 101);
+  TEST_ASSERT_EQUAL(ESP_OK, sample_log_consume(sample_log));
+  reboot();
+  TEST_ASSERT_EQUAL_UINT32(0, sample_log->depth);
+  TEST_ASSERT_EQUAL(ESP_OK, append(SLOTS * 2));
+  expect(SLOTS * 2, 1);
+  reboot();
+  expect(SLOTS * 2, 1);
+}
+
+static void test_wrap(void) {
+  reboot();
+  // One sector's worth past a full log drops the oldest sector
+  const int32_t total = SLOTS * (SECTORS + 1) + 10;
+  for (int32_t i = 0; i < total; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, append(i));
+  }
+  TEST_ASSERT_EQUAL_UINT32(SLOTS * 2, sample_log->dropped);
+  TEST_ASSERT_EQUAL_UINT32(total - SLOTS * 2, sample_log->depth);
+  TEST_ASSERT_EQUAL_UINT32(2, sample_log->wear);
+  expect(SLOTS * 2, 16);
+
+  reboot();
+  TEST_ASSERT_EQUAL_UINT32(total - SLOTS * 2, sample_log->depth);
+  expect(SLOTS * 2, total - SLOTS * 2);
+  TEST_ASSERT_EQUAL(ESP_OK, sample_log_consume(sample_log));
+  TEST_ASSERT_EQUAL_UINT32(0, sample_log->depth);
+
+  // Consumed sectors are reused without dropping anything
+  for (int32_t i = total; i < total + (int32_t)SLOTS * 3; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, append(i));
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, sample_log->dropped);
+  reboot();
+  TEST_ASSERT_EQUAL_UINT32(SLOTS * 3, sample_log->depth);
+  expect(total, 8);
+}
+
+static void test_torn_append(void) {
+  // Power cuts at every byte of a frame write
+  for (size_t cut = 0; cut < sizeof(sample_ring_record_t) + 8; cut++) {
+    tearDown();
+    setUp();
+    reboot();
+    for (int32_t i = 0; i < 10; i++) {
+      TEST_ASSERT_EQUAL(ESP_OK, append(i));
+    }
+    budget = cut;
+    TEST_ASSERT_EQUAL(ESP_FAIL, append(10));
+
+    reboot();
+    TEST_ASSERT_EQUAL_UINT32(10, sample_log->depth);
+    TEST_ASSERT_EQUAL(ESP_OK, append(11));
+    expect(0, 10);
+    sample_ring_record_t records[12];
+    TEST_ASSERT_EQUAL_UINT32(11, sample_log_peek(sample_log, records, 12));
+    const sample_ring_record_t record = make(11);
+    TEST_ASSERT_EQUAL_MEMORY(&record, &records[10], sizeof(record));
+    TEST_ASSERT_EQUAL(ESP_OK, sample_log_consume(sample_log));
+    TEST_ASSERT_EQUAL_UINT32(0, sample_log->depth);
+    TEST_ASSERT_EQUAL_UINT32(cut > 0, sample_log->corrupt);
+  }
+}
+
+static void test_rotten_frame(void) {
+  // A frame that goes bad after it was appended leaves the depth with it
+  reboot();
+  for (int32_t i = 0; i < 10; i++) {
+    TEST_ASSERT_EQUAL(ESP_OK, append(i));
+  }
+  // Found by its timestamp, whichever sector the log opened first
+  const sample_ring_record_t rotten = make(3);
+  const int64_t zero = 0;
+  for (uint32_t offset = 0; offset < flash.size; offset += 4) {
+    int64_t timestamp_us;
+    flash_read(NULL, offset, &timestamp_us, sizeof(timestamp_us));
+    if (timestamp_us == rotten.timestamp_us) {
+      flash_write(NULL, offset, &zero, sizeof(zero));
+      break;
+    }
+  }
+  sample_ring_record_t records[10];
+  TEST_ASSERT_EQUAL_UINT32(9, sample_log_peek(sample_log, records, 10));
+  TEST_ASSERT_EQUAL(ESP_OK, sample_log_consume(sample_log));
+  TEST_ASSERT_EQUAL_UINT32(0, sample_log->depth);
+  TEST_ASSERT_EQUAL_UINT32(1, sample_log->corrupt);
+}
+
+static void test_torn_consume(void) {
+  // Nothing is lost, at worst a batch comes back
+  for (size_t cut = 0; cut < sizeof(uint32_t); cut++) {
+    tearDown();
+    setUp();
+    reboot();
+    for (int32_t i = 0; i < 100; i++) {
+      TEST_ASSERT_EQUAL(ESP_OK, append(i));
+    }
+    expect(0, 32);
+    budget = cut;
+    TEST_ASSERT_EQUAL(ESP_FAIL, sample_log_consume(sample_log));
+
+    reboot();
+    sample_ring_record_t records[100];
+    const uint32_t count = sample_log_peek(sample_log, records, 100);
+    TEST_ASSERT_GREATER_THAN(67, count);
+    const sample_ring_record_t record = make(99);
+    TEST_ASSERT_EQUAL_MEMORY(&record, &records[count - 1], sizeof(record));
+  }
+}
+
+static void test_torn_erase(void) {
+  // Power cuts while moving on to the next sector, during the erase and the
+  // header write
+  const size_t cuts[] = {0, 100, SAMPLE_LOG_SECTOR_SIZE,
+                         SAMPLE_LOG_SECTOR_SIZE + 10,
+                         SAMPLE_LOG_SECTOR_SIZE + 32};
+  for (size_t c = 0; c < sizeof(cuts) / sizeof(cuts[0]); c++) {
+    tearDown();
+    setUp();
+    reboot();
+    for (int32_t i = 0; i < (int32_t)SLOTS; i++) {
+      TEST_ASSERT_EQUAL(ESP_OK, append(i));
+    }
+    budget = cuts[c];
+    TEST_ASSERT_EQUAL(ESP_FAIL, append(SLOTS));
+
+    reboot();
+    TEST_ASSERT_EQUAL_UINT32(SLOTS, sample_log->depth);
+    TEST_ASSERT_EQUAL(ESP_OK, append(SLOTS));
+    expect(0, SLOTS + 1);
+    reboot();
+    expect(0, SLOTS + 1);
+  }
+}
+
+void app_main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_format);
+  RUN_TEST(test_fifo);
+  RUN_TEST(test_reboot);
+  RUN_TEST(test_wrap);
+  RUN_TEST(test_torn_append);
+  RUN_TEST(test_rotten_frame);
+  RUN_TEST(test_torn_consume);
+  RUN_TEST(test_torn_erase);
+  exit(UNITY_END());
+}
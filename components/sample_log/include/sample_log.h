@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+#include "esp_err.h"
+#include "sample_ring.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Append-only log of sample records on NOR flash, used as a ring of 4 KiB
+// sectors so every sector is erased once per lap.
+//
+// Each sector opens with a header carrying a sequence number, so the newest
+// sector is found again after a reboot. Records are CRC framed in fixed size
+// slots, a torn write is detected and skipped. Consuming clears bits in the
+// state word of the last consumed frame, and in a sector's header once the
+// tail has left it, so the tail also survives reboots without any erase.
+#define SAMPLE_LOG_SECTOR_SIZE 4096
+
+// Where the log sits, offsets are relative to its start. Writes may only clear
+// bits and erases set whole sectors to 0xFF, like NOR flash.
+typedef struct {
+  esp_err_t (*read)(void *, uint32_t, void *, size_t);
+  esp_err_t (*write)(void *, uint32_t, const void *, size_t);
+  esp_err_t (*erase)(void *, uint32_t, size_t);
+  void *context;
+  // Bytes, a multiple of SAMPLE_LOG_SECTOR_SIZE
+  uint32_t size;
+} sample_log_flash_t;
+
+typedef struct {
+  uint32_t sector;
+  uint32_t slot;
+} sample_log_position_t;
+
+typedef struct {
+  sample_log_flash_t flash;
+  uint32_t sectors;
+  uint32_t sequence;
+  // Oldest sector still in the log, next slot to write and oldest slot not
+  // yet consumed. The head's slot is SAMPLE_LOG_SLOTS when its sector is full.
+  uint32_t oldest;
+  sample_log_position_t head;
+  sample_log_position_t tail;
+  // Where the last peek stopped and how many records it gave
+  sample_log_position_t peek;
+  uint32_t peeked;
+
+  // Records appended and not yet consumed, the backlog
+  uint32_t depth;
+  // Since mount: records appended, consumed, lost to the log wrapping and
+  // frames that failed their CRC
+  uint32_t appended;
+  uint32_t consumed;
+  uint32_t dropped;
+  uint32_t corrupt;
+  // Most erases any sector has seen
+  uint32_t wear;
+} sample_log_t;
+
+// Dynamic allocation of sample_log_t structs
+void sample_log_init(sample_log_t **, const sample_log_flash_t *);
+
+// Static fill of sample_log_t structs
+void sample_log_fill(sample_log_t *, const sample_log_flash_t *);
+
+// Finds the head and tail again, formats the log if it has none
+esp_err_t sample_log_mount(sample_log_t *);
+
+// Appends a record, erasing the oldest sector when the log is full
+esp_err_t sample_log_append(sample_log_t *, const sample_ring_record_t *);
+
+// Reads up to some of the oldest records without consuming them, how many
+uint32_t sample_log_peek(sample_log_t *, sample_ring_record_t *, uint32_t);
+
+// Consumes what the last peek gave
+esp_err_t sample_log_consume(sample_log_t *);
+
+// Points a sample_log_flash_t at the CONFIG_SAMPLE_LOG_PARTITION partition
+esp_err_t sample_log_partition(sample_log_flash_t *);
+
+// Dynamic free of sample_log_t structs
+void sample_log_free(sample_log_t *);
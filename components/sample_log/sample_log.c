@@ -0,0 +1,442 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "sample_log.h"
+#include "esp_rom_crc.h"
+#include <string.h>
+
+#define SAMPLE_LOG_MAGIC 0x474f4c53
+#define SAMPLE_LOG_LAYOUT                                                      \
+  ((uint32_t)sizeof(sample_log_frame_t) | (SAMPLE_RING_CHANNELS << 16))
+// Frame states, each step only clears bits
+#define SAMPLE_LOG_ERASED 0xffffffff
+#define SAMPLE_LOG_WRITTEN 0xffff5a5a
+#define SAMPLE_LOG_CONSUMED 0x00005a5a
+#define SAMPLE_LOG_SLOTS                                                       \
+  ((SAMPLE_LOG_SECTOR_SIZE - sizeof(sample_log_header_t)) /                    \
+   sizeof(sample_log_frame_t))
+
+typedef struct {
+  uint32_t magic;
+  uint32_t layout;
+  uint32_t sequence;
+  uint32_t erases;
+  // Over the words above
+  uint32_t crc;
+  // SAMPLE_LOG_CONSUMED once the tail has left the sector
+  uint32_t consumed;
+  uint32_t reserved[2];
+} sample_log_header_t;
+
+typedef struct {
+  sample_ring_record_t record;
+  uint32_t state;
+  // Over the record
+  uint32_t crc;
+} sample_log_frame_t;
+
+_Static_assert(sizeof(sample_log_header_t) == 32, "sector header size");
+_Static_assert(sizeof(sample_log_frame_t) % 4 == 0, "frame alignment");
+
+static uint32_t sample_log_sector_offset(uint32_t sector) {
+  return sector * SAMPLE_LOG_SECTOR_SIZE;
+}
+
+static uint32_t sample_log_offset(sample_log_position_t position) {
+  return sample_log_sector_offset(position.sector) +
+         sizeof(sample_log_header_t) +
+         position.slot * sizeof(sample_log_frame_t);
+}
+
+static bool sample_log_equal(sample_log_position_t a, sample_log_position_t b) {
+  return a.sector == b.sector && a.slot == b.slot;
+}
+
+static uint32_t sample_log_after(sample_log_t *pointer, uint32_t sector) {
+  return (sector + 1) % pointer->sectors;
+}
+
+// Next slot in log order, never past the head
+static sample_log_position_t sample_log_step(sample_log_t *pointer,
+                                             sample_log_position_t position) {
+  (position.slot)++;
+  if (position.slot == SAMPLE_LOG_SLOTS &&
+      position.sector != pointer->head.sector) {
+    position.sector = sample_log_after(pointer, position.sector);
+    position.slot = 0;
+  }
+  return position;
+}
+
+static bool sample_log_header_read(sample_log_t *pointer, uint32_t sector,
+                                   sample_log_header_t *header) {
+  if (pointer->flash.read(pointer->flash.context,
+                          sample_log_sector_offset(sector), header,
+                          sizeof(sample_log_header_t)) != ESP_OK) {
+    return false;
+  }
+  return header->magic == SAMPLE_LOG_MAGIC &&
+         header->layout == SAMPLE_LOG_LAYOUT &&
+         header->crc == esp_rom_crc32_le(0, (const uint8_t *)header,
+                                         offsetof(sample_log_header_t, crc));
+}
+
+static uint32_t sample_log_state(sample_log_t *pointer,
+                                 sample_log_position_t position) {
+  uint32_t state = 0;
+  if (pointer->flash.read(pointer->flash.context,
+                          sample_log_offset(position) +
+                              offsetof(sample_log_frame_t, state),
+                          &state, sizeof(state)) != ESP_OK) {
+    return 0;
+  }
+  return state;
+}
+
+// True if the frame holds a whole record
+static bool sample_log_frame_read(sample_log_t *pointer,
+                                  sample_log_position_t position,
+                                  sample_log_frame_t *frame) {
+  if (pointer->flash.read(pointer->flash.context, sample_log_offset(position),
+                          frame, sizeof(sample_log_frame_t)) != ESP_OK) {
+    return false;
+  }
+  return (frame->state == SAMPLE_LOG_WRITTEN ||
+          frame->state == SAMPLE_LOG_CONSUMED) &&
+         frame->crc == esp_rom_crc32_le(0, (const uint8_t *)&frame->record,
+                                        sizeof(sample_ring_record_t));
+}
+
+static bool sample_log_frame_erased(const sample_log_frame_t *frame) {
+  const uint8_t *bytes = (const uint8_t *)frame;
+  for (size_t i = 0; i < sizeof(sample_log_frame_t); i++) {
+    if (bytes[i] != 0xff) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static esp_err_t sample_log_state_write(sample_log_t *pointer,
+                                        sample_log_position_t position,
+                                        uint32_t state) {
+  return pointer->flash.write(pointer->flash.context,
+                              sample_log_offset(position) +
+                                  offsetof(sample_log_frame_t, state),
+                              &state, sizeof(state));
+}
+
+static esp_err_t sample_log_sector_consumed(sample_log_t *pointer,
+                                            uint32_t sector) {
+  const uint32_t consumed = SAMPLE_LOG_CONSUMED;
+  return pointer->flash.write(pointer->flash.context,
+                              sample_log_sector_offset(sector) +
+                                  offsetof(sample_log_header_t, consumed),
+                              &consumed, sizeof(consumed));
+}
+
+// Erases a sector and makes it the head
+static esp_err_t sample_log_open(sample_log_t *pointer, uint32_t sector) {
+  // A sector without a valid header starts counting over
+  sample_log_header_t header;
+  uint32_t erases = 0;
+  if (sample_log_header_read(pointer, sector, &header)) {
+    erases = header.erases;
+  }
+
+  esp_err_t err = pointer->flash.erase(pointer->flash.context,
+                                       sample_log_sector_offset(sector),
+                                       SAMPLE_LOG_SECTOR_SIZE);
+  if (err != ESP_OK) {
+    return err;
+  }
+  header = (sample_log_header_t){
+      .magic = SAMPLE_LOG_MAGIC,
+      .layout = SAMPLE_LOG_LAYOUT,
+      .sequence = pointer->sequence + 1,
+      .erases = erases + 1,
+      .consumed = SAMPLE_LOG_ERASED,
+      .reserved = {SAMPLE_LOG_ERASED, SAMPLE_LOG_ERASED},
+  };
+  header.crc = esp_rom_crc32_le(0, (const uint8_t *)&header,
+                                offsetof(sample_log_header_t, crc));
+  err = pointer->flash.write(pointer->flash.context,
+                             sample_log_sector_offset(sector), &header,
+                             sizeof(header));
+  if (err != ESP_OK) {
+    return err;
+  }
+  pointer->sequence = header.sequence;
+  if (header.erases > pointer->wear) {
+    pointer->wear = header.erases;
+  }
+  pointer->head = (sample_log_position_t){.sector = sector, .slot = 0};
+  return ESP_OK;
+}
+
+// Whole records left to replay, corrupt frames aren't counted
+static uint32_t sample_log_count(sample_log_t *pointer) {
+  sample_log_frame_t frame;
+  uint32_t depth = 0;
+  for (sample_log_position_t position = pointer->tail;
+       !sample_log_equal(position, pointer->head);
+       position = sample_log_step(pointer, position)) {
+    if (sample_log_frame_read(pointer, position, &frame) &&
+        frame.state == SAMPLE_LOG_WRITTEN) {
+      depth++;
+    }
+  }
+  return depth;
+}
+
+// The next sector is about to be erased, gives up what it still holds
+static void sample_log_evict(sample_log_t *pointer, uint32_t sector) {
+  if (sector != pointer->oldest) {
+    return;
+  }
+  pointer->oldest = sample_log_after(pointer, sector);
+  if (pointer->tail.sector != sector) {
+    return;
+  }
+  sample_log_frame_t frame;
+  bool corrupt = false;
+  for (sample_log_position_t position = pointer->tail;
+       position.slot < SAMPLE_LOG_SLOTS; (position.slot)++) {
+    if (sample_log_frame_read(pointer, position, &frame)) {
+      if (frame.state == SAMPLE_LOG_WRITTEN) {
+        (pointer->dropped)++;
+        (pointer->depth)--;
+      }
+    } else {
+      corrupt = true;
+    }
+  }
+  pointer->tail =
+      (sample_log_position_t){.sector = pointer->oldest, .slot = 0};
+  pointer->peek = pointer->tail;
+  pointer->peeked = 0;
+  if (corrupt) {
+    pointer->depth = sample_log_count(pointer);
+  }
+}
+
+void sample_log_init(sample_log_t **pointer,
+                     const sample_log_flash_t *flash) {
+  *pointer = malloc(sizeof(sample_log_t));
+  sample_log_fill(*pointer, flash);
+}
+
+void sample_log_fill(sample_log_t *pointer, const sample_log_flash_t *flash) {
+  pointer->flash = *flash;
+  pointer->sectors = flash->size / SAMPLE_LOG_SECTOR_SIZE;
+  pointer->sequence = 0;
+  pointer->oldest = 0;
+  pointer->head = (sample_log_position_t){0};
+  pointer->tail = (sample_log_position_t){0};
+  pointer->peek = (sample_log_position_t){0};
+  pointer->peeked = 0;
+  pointer->depth = 0;
+  pointer->appended = 0;
+  pointer->consumed = 0;
+  pointer->dropped = 0;
+  pointer->corrupt = 0;
+  pointer->wear = 0;
+}
+
+esp_err_t sample_log_mount(sample_log_t *pointer) {
+  if (pointer->sectors < 2) {
+    return ESP_ERR_INVALID_SIZE;
+  }
+
+  // The newest sector has the highest sequence
+  bool found = false;
+  sample_log_header_t header;
+  for (uint32_t i = 0; i < pointer->sectors; i++) {
+    if (!sample_log_header_read(pointer, i, &header)) {
+      continue;
+    }
+    if (header.erases > pointer->wear) {
+      pointer->wear = header.erases;
+    }
+    if (!found || header.sequence > pointer->sequence) {
+      found = true;
+      pointer->sequence = header.sequence;
+      pointer->head.sector = i;
+    }
+  }
+  if (!found) {
+    esp_err_t err = sample_log_open(pointer, 0);
+    pointer->oldest = 0;
+    pointer->tail = pointer->head;
+    pointer->peek = pointer->head;
+    return err;
+  }
+
+  // Its first erased slot is the head, torn frames before it are skipped
+  sample_log_frame_t frame;
+  pointer->head.slot = 0;
+  while (pointer->head.slot < SAMPLE_LOG_SLOTS) {
+    if (!sample_log_frame_read(pointer, pointer->head, &frame) &&
+        sample_log_frame_erased(&frame)) {
+      break;
+    }
+    (pointer->head.slot)++;
+  }
+
+  // Older sectors count down in sequence without a gap
+  pointer->oldest = pointer->head.sector;
+  for (uint32_t i = 1; i < pointer->sectors; i++) {
+    const uint32_t sector =
+        (pointer->head.sector + pointer->sectors - i) % pointer->sectors;
+    if (!sample_log_header_read(pointer, sector, &header) ||
+        header.sequence != pointer->sequence - i) {
+      break;
+    }
+    pointer->oldest = sector;
+  }
+
+  // The tail follows the newest consumed frame or fully consumed sector
+  pointer->tail = (sample_log_position_t){.sector = pointer->oldest, .slot = 0};
+  uint32_t sector = pointer->head.sector;
+  uint32_t slots = pointer->head.slot;
+  while (true) {
+    bool consumed = false;
+    if (sector != pointer->head.sector) {
+      sample_log_header_read(pointer, sector, &header);
+      if (header.consumed == SAMPLE_LOG_CONSUMED) {
+        pointer->tail = (sample_log_position_t){
+            .sector = sample_log_after(pointer, sector), .slot = 0};
+        break;
+      }
+    }
+    for (uint32_t slot = slots; slot > 0; slot--) {
+      const sample_log_position_t position = {.sector = sector,
+                                              .slot = slot - 1};
+      if (sample_log_state(pointer, position) == SAMPLE_LOG_CONSUMED) {
+        pointer->tail = sample_log_step(pointer, position);
+        consumed = true;
+        break;
+      }
+    }
+    if (consumed || sector == pointer->oldest) {
+      break;
+    }
+    sector = (sector + pointer->sectors - 1) % pointer->sectors;
+    slots = SAMPLE_LOG_SLOTS;
+  }
+  pointer->peek = pointer->tail;
+  pointer->depth = sample_log_count(pointer);
+  return ESP_OK;
+}
+
+esp_err_t sample_log_append(sample_log_t *pointer,
+                            const sample_ring_record_t *record) {
+  if (pointer->head.slot == SAMPLE_LOG_SLOTS) {
+    const sample_log_position_t full = pointer->head;
+    const uint32_t sector = sample_log_after(pointer, full.sector);
+    sample_log_evict(pointer, sector);
+    esp_err_t err = sample_log_open(pointer, sector);
+    if (err != ESP_OK) {
+      return err;
+    }
+    // Nothing may point past the end of the full sector
+    if (sample_log_equal(pointer->tail, full)) {
+      pointer->tail = pointer->head;
+    }
+    if (sample_log_equal(pointer->peek, full)) {
+      pointer->peek = pointer->head;
+    }
+  }
+
+  sample_log_frame_t frame = {
+      .record = *record,
+      .state = SAMPLE_LOG_WRITTEN,
+      .crc = esp_rom_crc32_le(0, (const uint8_t *)record,
+                              sizeof(sample_ring_record_t)),
+  };
+  esp_err_t err =
+      pointer->flash.write(pointer->flash.context,
+                           sample_log_offset(pointer->head), &frame,
+                           sizeof(frame));
+  // Even a failed write may have left bits behind, the slot is spent
+  (pointer->head.slot)++;
+  if (err != ESP_OK) {
+    return err;
+  }
+  (pointer->depth)++;
+  (pointer->appended)++;
+  return ESP_OK;
+}
+
+uint32_t sample_log_peek(sample_log_t *pointer, sample_ring_record_t *records,
+                         uint32_t count) {
+  sample_log_frame_t frame;
+  sample_log_position_t position = pointer->tail;
+  uint32_t peeked = 0;
+  while (peeked < count && !sample_log_equal(position, pointer->head)) {
+    if (sample_log_frame_read(pointer, position, &frame) &&
+        frame.state == SAMPLE_LOG_WRITTEN) {
+      records[peeked] = frame.record;
+      peeked++;
+    }
+    position = sample_log_step(pointer, position);
+  }
+  pointer->peek = position;
+  pointer->peeked = peeked;
+  return peeked;
+}
+
+esp_err_t sample_log_consume(sample_log_t *pointer) {
+  // Only the newest frame is marked, the tail is found after it on mount
+  sample_log_frame_t frame;
+  sample_log_position_t last = pointer->tail;
+  bool marked = false;
+  uint32_t corrupt = 0;
+  for (sample_log_position_t position = pointer->tail;
+       !sample_log_equal(position, pointer->peek);
+       position = sample_log_step(pointer, position)) {
+    if (sample_log_frame_read(pointer, position, &frame) &&
+        frame.state == SAMPLE_LOG_WRITTEN) {
+      last = position;
+      marked = true;
+    } else if (frame.state != SAMPLE_LOG_CONSUMED) {
+      corrupt++;
+    }
+  }
+  if (marked) {
+    esp_err_t err = sample_log_state_write(pointer, last, SAMPLE_LOG_CONSUMED);
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+
+  for (uint32_t sector = pointer->tail.sector; sector != pointer->peek.sector;
+       sector = sample_log_after(pointer, sector)) {
+    esp_err_t err = sample_log_sector_consumed(pointer, sector);
+    if (err != ESP_OK) {
+      return err;
+    }
+  }
+  pointer->tail = pointer->peek;
+  // A frame that went bad since it was appended is still in the depth
+  pointer->depth = (corrupt > 0) ? sample_log_count(pointer)
+                                  : pointer->depth - pointer->peeked;
+  pointer->consumed += pointer->peeked;
+  pointer->corrupt += corrupt;
+  pointer->peeked = 0;
+  return ESP_OK;
+}
+
+void sample_log_free(sample_log_t *pointer) { free(pointer); }
@@ -0,0 +1,51 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "esp_partition.h"
+#include "sample_log.h"
+
+static esp_err_t sample_log_partition_read(void *context, uint32_t offset,
+                                           void *buffer, size_t length) {
+  return esp_partition_read(context, offset, buffer, length);
+}
+
+static esp_err_t sample_log_partition_write(void *context, uint32_t offset,
+                                            const void *buffer,
+                                            size_t length) {
+  return esp_partition_write(context, offset, buffer, length);
+}
+
+static esp_err_t sample_log_partition_erase(void *context, uint32_t offset,
+                                            size_t length) {
+  return esp_partition_erase_range(context, offset, length);
+}
+
+esp_err_t sample_log_partition(sample_log_flash_t *flash) {
+  const esp_partition_t *partition =
+      esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+                               ESP_PARTITION_SUBTYPE_ANY,
+                               CONFIG_SAMPLE_LOG_PARTITION);
+  if (partition == NULL) {
+    return ESP_ERR_NOT_FOUND;
+  }
+  *flash = (sample_log_flash_t){
+      .read = sample_log_partition_read,
+      .write = sample_log_partition_write,
+      .erase = sample_log_partition_erase,
+      .context = (void *)partition,
+      .size = partition->size - partition->size % SAMPLE_LOG_SECTOR_SIZE,
+  };
+  return ESP_OK;
+}
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "sample_ring.h"
+#include "unity.h"
+#include <pthread.h>
+#include <stdio.h>
+
+#define THREADED_RECORDS 1000000
+
+static sample_ring_t ring;
+static atomic_bool produced;
+
+// Every channel carries the sequence number, so a torn copy shows up as a
+// record that disagrees with itself
+static void record_make(sample_ring_record_t *record, uint32_t sequence) {
+  record->timestamp_us = sequence;
+  record->mask = SAMPLE_RING_MASK(SAMPLE_RING_PRESSURE) |
+                 SAMPLE_RING_MASK(SAMPLE_RING_TEMPERATURE) |
+                 SAMPLE_RING_MASK(SAMPLE_RING_HUMIDITY);
+  for (uint32_t i = 0; i < SAMPLE_RING_CHANNELS; i++) {
+    record->value[i] = (int32_t)sequence;
+  }
+}
+
+static bool record_whole(const sample_ring_record_t *record) {
+  for (uint32_t i = 0; i < SAMPLE_RING_CHANNELS; i++) {
+    if (record->value[i] != (int32_t)record->timestamp_us) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void setUp(void) { sample_ring_fill(&ring); }
+
+void tearDown(void) {}
+
+static void test_order(void) {
+  sample_ring_record_t record;
+  TEST_ASSERT_FALSE(sample_ring_pop(&ring, &record));
+  // Several laps so the indices wrap around the slots
+  for (uint32_t sequence = 0; sequence < CONFIG_SAMPLE_RING_CAPACITY * 5;
+       sequence++) {
+    record_make(&record, sequence);
+    TEST_ASSERT_TRUE(sample_ring_push(&ring, &record));
+    TEST_ASSERT_TRUE(sample_ring_pop(&ring, &record));
+    TEST_ASSERT_EQUAL_INT64(sequence, record.timestamp_us);
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, sample_ring_count(&ring));
+}
+
+static void test_drop_newest(void) {
+  ring.policy = SAMPLE_RING_POLICY_DROP_NEWEST;
+  sample_ring_record_t record;
+  for (uint32_t sequence = 0; sequence < CONFIG_SAMPLE_RING_CAPACITY + 3;
+       sequence++) {
+    record_make(&record, sequence);
+    TEST_ASSERT_EQUAL(sequence < CONFIG_SAMPLE_RING_CAPACITY,
+                      sample_ring_push(&ring, &record));
+  }
+  TEST_ASSERT_EQUAL_UINT32(3, atomic_load(&ring.dropped));
+  TEST_ASSERT_EQUAL_UINT32(0, atomic_load(&ring.overwritten));
+  TEST_ASSERT_EQUAL_UINT32(CONFIG_SAMPLE_RING_CAPACITY,
+                           sample_ring_count(&ring));
+  TEST_ASSERT_TRUE(sample_ring_pop(&ring, &record));
+  TEST_ASSERT_EQUAL_INT64(0, record.timestamp_us);
+}
+
+static void test_overwrite_oldest(void) {
+  ring.policy = SAMPLE_RING_POLICY_OVERWRITE_OLDEST;
+  sample_ring_record_t record;
+  for (uint32_t sequence = 0; sequence < CONFIG_SAMPLE_RING_CAPACITY + 3;
+       sequence++) {
+    record_make(&record, sequence);
+    TEST_ASSERT_TRUE(sample_ring_push(&ring, &record));
+  }
+  TEST_ASSERT_EQUAL_UINT32(0, atomic_load(&ring.dropped));
+  TEST_ASSERT_EQUAL_UINT32(3, atomic_load(&ring.overwritten));
+  TEST_ASSERT_EQUAL_UINT32(CONFIG_SAMPLE_RING_CAPACITY,
+                           sample_ring_count(&ring));
+  for (uint32_t sequence = 3; sequence < CONFIG_SAMPLE_RING_CAPACITY + 3;
+       sequence++) {
+    TEST_ASSERT_TRUE(sample_ring_pop(&ring, &record));
+    TEST_ASSERT_EQUAL_INT64(sequence, record.timestamp_us);
+  }
+  TEST_ASSERT_FALSE(sample_ring_pop(&ring, &record));
+}
+
+static void *producer(void *user_data) {
+  sample_ring_record_t record;
+  for (uint32_t sequence = 1; sequence <= THREADED_RECORDS; sequence++) {
+    record_make(&record, sequence);
+    sample_ring_push(&ring, &record);
+  }
+  atomic_store(&produced, true);
+  return NULL;
+}
+
+// Whatever the policy loses, what comes out must be whole and in order, and
+// every record must be accounted for
+static void threaded(sample_ring_policy_t policy) {
+  ring.policy = policy;
+  atomic_store(&produced, false);
+  pthread_t thread;
+  TEST_ASSERT_EQUAL(0, pthread_create(&thread, NULL, producer, NULL));
+  sample_ring_record_t record;
+  int64_t last = 0;
+  uint32_t popped = 0, torn = 0, unordered = 0;
+  while (true) {
+    // Checked before popping, so nothing pushed in between is missed
+    const bool finished = atomic_load(&produced);
+    if (!sample_ring_pop(&ring, &record)) {
+      if (finished) {
+        break;
+      }
+      continue;
+    }
+    torn += record_whole(&record) ? 0 : 1;
+    unordered += (record.timestamp_us > last) ? 0 : 1;
+    last = record.timestamp_us;
+    popped++;
+  }
+  pthread_join(thread, NULL);
+  TEST_ASSERT_EQUAL_UINT32(0, torn);
+  TEST_ASSERT_EQUAL_UINT32(0, unordered);
+  TEST_ASSERT_EQUAL_UINT32(THREADED_RECORDS,
+                           popped + atomic_load(&ring.dropped) +
+                               atomic_load(&ring.overwritten));
+  printf("%" PRIu32 " popped, %" PRIu32 " dropped, %" PRIu32 " overwritten\n",
+         popped, atomic_load(&ring.dropped), atomic_load(&ring.overwritten));
+}
+
+static void test_threaded_drop_newest(void) {
+  threaded(SAMPLE_RING_POLICY_DROP_NEWEST);
+}
+
+static void test_threaded_overwrite_oldest(void) {
+  threaded(SAMPLE_RING_POLICY_OVERWRITE_OLDEST);
+}
+
+void app_main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_order);
+  RUN_TEST(test_drop_newest);
+  RUN_TEST(test_overwrite_oldest);
+  RUN_TEST(test_threaded_drop_newest);
+  RUN_TEST(test_threaded_overwrite_oldest);
+  exit(UNITY_END());
+}
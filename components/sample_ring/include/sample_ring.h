@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+#include "sdkconfig.h"
+#include <inttypes.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+_Static_assert((CONFIG_SAMPLE_RING_CAPACITY &
+                (CONFIG_SAMPLE_RING_CAPACITY - 1)) == 0,
+               "CONFIG_SAMPLE_RING_CAPACITY must be a power of 2");
+
+typedef enum {
+  SAMPLE_RING_PRESSURE,
+  SAMPLE_RING_TEMPERATURE,
+  SAMPLE_RING_HUMIDITY,
+  SAMPLE_RING_WIND_SPEED,
+  SAMPLE_RING_WIND_GUST,
+  SAMPLE_RING_RAIN,
+  SAMPLE_RING_WIND_DIRECTION,
+  SAMPLE_RING_CHANNELS
+} sample_ring_channel_t;
+
+#define SAMPLE_RING_MASK(channel) (((uint32_t)(1)) << (channel))
+
+// One sensor reading, values are fixed point: pressure in hundredths of a Pa,
+// temperature in hundredths of a degree C, humidity in 1024ths of a percent,
+// wind in hundredths of a km/h, rain in micrometres and wind direction in
+// hundredths of a degree
+typedef struct {
+  // Wall clock time of acquisition, microseconds since the epoch
+  int64_t timestamp_us;
+  // SAMPLE_RING_MASK of the channels holding a value
+  uint32_t mask;
+  int32_t value[SAMPLE_RING_CHANNELS];
+} sample_ring_record_t;
+
+typedef enum {
+  SAMPLE_RING_POLICY_DROP_NEWEST,
+  SAMPLE_RING_POLICY_OVERWRITE_OLDEST,
+} sample_ring_policy_t;
+
+// Lock-free ring for one producer task and one consumer task. Indices run
+// freely and wrap at 2^32, the slot is the index modulo the capacity.
+typedef struct {
+  sample_ring_policy_t policy;
+  _Atomic uint32_t head;
+  _Atomic uint32_t tail;
+  _Atomic uint32_t dropped;
+  _Atomic uint32_t overwritten;
+  sample_ring_record_t records[CONFIG_SAMPLE_RING_CAPACITY];
+} sample_ring_t;
+
+// Dynamic allocation of sample_ring_t structs
+void sample_ring_init(sample_ring_t **);
+
+// Static fill of sample_ring_t structs
+void sample_ring_fill(sample_ring_t *);
+
+// Producer side, false if the record was dropped
+bool sample_ring_push(sample_ring_t *, const sample_ring_record_t *);
+
+// Consumer side, false if the ring is empty
+bool sample_ring_pop(sample_ring_t *, sample_ring_record_t *);
+
+// Records waiting, only a snapshot while the other side runs
+uint32_t sample_ring_count(sample_ring_t *);
+
+// Name of a channel in published payloads
+const char *sample_ring_channel_name(sample_ring_channel_t);
+
+// Dynamic free of sample_ring_t structs
+void sample_ring_free(sample_ring_t *);
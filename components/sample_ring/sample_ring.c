@@ -0,0 +1,101 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "sample_ring.h"
+
+#define SAMPLE_RING_SLOT(index) ((index) & (CONFIG_SAMPLE_RING_CAPACITY - 1))
+
+void sample_ring_init(sample_ring_t **pointer) {
+  *pointer = malloc(sizeof(sample_ring_t));
+  sample_ring_fill(*pointer);
+}
+
+void sample_ring_fill(sample_ring_t *pointer) {
+#ifdef CONFIG_SAMPLE_RING_DROP_NEWEST
+  pointer->policy = SAMPLE_RING_POLICY_DROP_NEWEST;
+#else
+  pointer->policy = SAMPLE_RING_POLICY_OVERWRITE_OLDEST;
+#endif
+  atomic_init(&pointer->head, 0);
+  atomic_init(&pointer->tail, 0);
+  atomic_init(&pointer->dropped, 0);
+  atomic_init(&pointer->overwritten, 0);
+}
+
+bool sample_ring_push(sample_ring_t *pointer,
+                      const sample_ring_record_t *record) {
+  const uint32_t head =
+      atomic_load_explicit(&pointer->head, memory_order_relaxed);
+  uint32_t tail = atomic_load_explicit(&pointer->tail, memory_order_acquire);
+  if (head - tail == CONFIG_SAMPLE_RING_CAPACITY) {
+    if (pointer->policy == SAMPLE_RING_POLICY_DROP_NEWEST) {
+      atomic_fetch_add_explicit(&pointer->dropped, 1, memory_order_relaxed);
+      return false;
+    }
+    // Take the oldest slot from the consumer. If the consumer got to it
+    // first, there's room now anyway.
+    if (atomic_compare_exchange_strong_explicit(&pointer->tail, &tail,
+                                                tail + 1, memory_order_acq_rel,
+                                                memory_order_acquire)) {
+      atomic_fetch_add_explicit(&pointer->overwritten, 1,
+                                memory_order_relaxed);
+    }
+  }
+  pointer->records[SAMPLE_RING_SLOT(head)] = *record;
+  atomic_store_explicit(&pointer->head, head + 1, memory_order_release);
+  return true;
+}
+
+bool sample_ring_pop(sample_ring_t *pointer, sample_ring_record_t *record) {
+  uint32_t tail = atomic_load_explicit(&pointer->tail, memory_order_acquire);
+  while (true) {
+    const uint32_t head =
+        atomic_load_explicit(&pointer->head, memory_order_acquire);
+    if (head == tail) {
+      return false;
+    }
+    *record = pointer->records[SAMPLE_RING_SLOT(tail)];
+    // The producer only writes over a slot after moving the tail past it, so
+    // the copy is good if the tail hasn't moved. Otherwise try the new tail.
+    if (atomic_compare_exchange_strong_explicit(&pointer->tail, &tail,
+                                                tail + 1, memory_order_acq_rel,
+                                                memory_order_acquire)) {
+      return true;
+    }
+  }
+}
+
+uint32_t sample_ring_count(sample_ring_t *pointer) {
+  const uint32_t tail =
+      atomic_load_explicit(&pointer->tail, memory_order_acquire);
+  const uint32_t head =
+      atomic_load_explicit(&pointer->head, memory_order_acquire);
+  return head - tail;
+}
+
+const char *sample_ring_channel_name(sample_ring_channel_t channel) {
+  static const char *names[SAMPLE_RING_CHANNELS] = {
+      [SAMPLE_RING_PRESSURE] = "pressure",
+      [SAMPLE_RING_TEMPERATURE] = "temperature",
+      [SAMPLE_RING_HUMIDITY] = "humidity",
+      [SAMPLE_RING_WIND_SPEED] = "wind_speed",
+      [SAMPLE_RING_WIND_GUST] = "wind_gust",
+      [SAMPLE_RING_RAIN] = "rain",
+      [SAMPLE_RING_WIND_DIRECTION] = "wind_direction",
+  };
+  return (channel < SAMPLE_RING_CHANNELS) ? names[channel] : "?";
+}
+
+void sample_ring_free(sample_ring_t *pointer) { free(pointer); }
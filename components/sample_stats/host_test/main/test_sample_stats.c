@@ -0,0 +1,122 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "sample_stats.h"
+#include "unity.h"
+#include <math.h>
+#include <stdlib.h>
+
+static sample_stats_t *stats;
+
+void setUp(void) { sample_stats_init(&stats); }
+
+void tearDown(void) { sample_stats_free(stats); }
+
+static void add(int64_t timestamp_us, sample_ring_channel_t channel,
+                int32_t value) {
+  sample_ring_record_t record = {
+      .timestamp_us = timestamp_us,
+      .mask = SAMPLE_RING_MASK(channel),
+  };
+  record.value[channel] = value;
+  sample_stats_add(stats, &record);
+}
+
+static void test_empty(void) {
+  TEST_ASSERT_EQUAL_UINT32(0, stats->records);
+  TEST_ASSERT_EQUAL_UINT32(0, stats->mask);
+  TEST_ASSERT_EQUAL_UINT32(0, stats->channel[SAMPLE_RING_PRESSURE].count);
+  TEST_ASSERT_EQUAL_FLOAT(
+      0.0f, sample_stats_variance(&stats->channel[SAMPLE_RING_PRESSURE]));
+}
+
+static void test_summary(void) {
+  const int32_t values[] = {2, 4, 4, 4, 5, 5, 7, 9};
+  for (uint32_t i = 0; i < sizeof(values) / sizeof(values[0]); i++) {
+    add(1000 + i, SAMPLE_RING_TEMPERATURE, values[i]);
+  }
+  const sample_stats_channel_t *channel =
+      &stats->channel[SAMPLE_RING_TEMPERATURE];
+  TEST_ASSERT_EQUAL_UINT32(8, channel->count);
+  TEST_ASSERT_EQUAL_INT32(2, channel->min);
+  TEST_ASSERT_EQUAL_INT32(9, channel->max);
+  TEST_ASSERT_FLOAT_WITHIN(1e-5f, 5.0f, sample_stats_mean(channel));
+  // Sum of squared deviations is 32, over n - 1
+  TEST_ASSERT_FLOAT_WITHIN(1e-5f, 32.0f / 7.0f,
+                           sample_stats_variance(channel));
+  TEST_ASSERT_EQUAL_INT64(1000, stats->first_us);
+  TEST_ASSERT_EQUAL_INT64(1007, stats->last_us);
+  TEST_ASSERT_EQUAL_UINT32(SAMPLE_RING_MASK(SAMPLE_RING_TEMPERATURE),
+                           stats->mask);
+}
+
+static void test_offset(void) {
+  // Pressure in hundredths of a Pa sits near 10^7, where a float steps by 1.
+  // Shifting by the first sample keeps the small spread exact.
+  double sum = 0.0;
+  double squares = 0.0;
+  const uint32_t count = 1000;
+  for (uint32_t i = 0; i < count; i++) {
+    const int32_t value = 10132500 + (int32_t)((i * 37) % 101) - 50;
+    add(i, SAMPLE_RING_PRESSURE, value);
+    sum += value;
+  }
+  const double mean = sum / count;
+  for (uint32_t i = 0; i < count; i++) {
+    const double d = (10132500 + (int32_t)((i * 37) % 101) - 50) - mean;
+    squares += d * d;
+  }
+  const sample_stats_channel_t *channel = &stats->channel[SAMPLE_RING_PRESSURE];
+  const float variance = (float)(squares / (count - 1));
+  TEST_ASSERT_FLOAT_WITHIN(1.0f, (float)mean, sample_stats_mean(channel));
+  TEST_ASSERT_FLOAT_WITHIN(variance * 1e-3f, variance,
+                           sample_stats_variance(channel));
+  TEST_ASSERT_EQUAL_INT32(10132450, channel->min);
+  TEST_ASSERT_EQUAL_INT32(10132550, channel->max);
+}
+
+static void test_window(void) {
+  sample_ring_record_t record = {
+      .timestamp_us = 5,
+      .mask = SAMPLE_RING_MASK(SAMPLE_RING_PRESSURE) |
+              SAMPLE_RING_MASK(SAMPLE_RING_HUMIDITY),
+  };
+  record.value[SAMPLE_RING_PRESSURE] = 100;
+  record.value[SAMPLE_RING_HUMIDITY] = -3;
+  sample_stats_add(stats, &record);
+  add(9, SAMPLE_RING_RAIN, 7);
+  TEST_ASSERT_EQUAL_UINT32(2, stats->records);
+  TEST_ASSERT_EQUAL_UINT32(1, stats->channel[SAMPLE_RING_HUMIDITY].count);
+  TEST_ASSERT_EQUAL_INT32(-3, stats->channel[SAMPLE_RING_HUMIDITY].min);
+  TEST_ASSERT_EQUAL_UINT32(0, stats->channel[SAMPLE_RING_TEMPERATURE].count);
+
+  // A new window forgets the last one, including the shift
+  sample_stats_fill(stats);
+  add(20, SAMPLE_RING_PRESSURE, -100);
+  const sample_stats_channel_t *channel = &stats->channel[SAMPLE_RING_PRESSURE];
+  TEST_ASSERT_EQUAL_UINT32(1, channel->count);
+  TEST_ASSERT_FLOAT_WITHIN(1e-5f, -100.0f, sample_stats_mean(channel));
+  TEST_ASSERT_EQUAL_INT64(20, stats->first_us);
+  TEST_ASSERT_EQUAL_UINT32(SAMPLE_RING_MASK(SAMPLE_RING_PRESSURE), stats->mask);
+}
+
+void app_main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_empty);
+  RUN_TEST(test_summary);
+  RUN_TEST(test_offset);
+  RUN_TEST(test_window);
+  exit(UNITY_END());
+}
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+#include "sample_ring.h"
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+// Running statistics of one channel over a report window, in O(1) memory.
+// Welford's update runs in single precision, which the FPU has, on values
+// shifted by the window's first sample so the large fixed point offsets
+// (pressure is around 10^7) don't eat the float's 24 bit mantissa.
+typedef struct {
+  uint32_t count;
+  int32_t shift;
+  int32_t min;
+  int32_t max;
+  float mean;
+  float m2;
+} sample_stats_channel_t;
+
+// One report window across every channel
+typedef struct {
+  // Wall clock time of the window's first and last record, 0 while empty
+  int64_t first_us;
+  int64_t last_us;
+  // Records folded in, and SAMPLE_RING_MASK of the channels that have a count
+  uint32_t records;
+  uint32_t mask;
+  sample_stats_channel_t channel[SAMPLE_RING_CHANNELS];
+} sample_stats_t;
+
+// Dynamic allocation of sample_stats_t structs
+void sample_stats_init(sample_stats_t **);
+
+// Static fill of sample_stats_t structs, also starts a new window
+void sample_stats_fill(sample_stats_t *);
+
+// Folds a record's channels into the window
+void sample_stats_add(sample_stats_t *, const sample_ring_record_t *);
+
+// Mean of a channel, in the channel's fixed point units
+float sample_stats_mean(const sample_stats_channel_t *);
+
+// Sample variance of a channel, 0 with fewer than two samples
+float sample_stats_variance(const sample_stats_channel_t *);
+
+// Dynamic free of sample_stats_t structs
+void sample_stats_free(sample_stats_t *);
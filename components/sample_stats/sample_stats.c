@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "sample_stats.h"
+
+static void sample_stats_channel_add(sample_stats_channel_t *pointer,
+                                     int32_t value) {
+  if (pointer->count == 0) {
+    pointer->shift = value;
+    pointer->min = value;
+    pointer->max = value;
+  } else if (value < pointer->min) {
+    pointer->min = value;
+  } else if (value > pointer->max) {
+    pointer->max = value;
+  }
+  (pointer->count)++;
+
+  const float x = (float)((int64_t)value - pointer->shift);
+  const float delta = x - pointer->mean;
+  pointer->mean += delta / (float)pointer->count;
+  pointer->m2 += delta * (x - pointer->mean);
+}
+
+void sample_stats_init(sample_stats_t **pointer) {
+  *pointer = malloc(sizeof(sample_stats_t));
+  sample_stats_fill(*pointer);
+}
+
+void sample_stats_fill(sample_stats_t *pointer) {
+  pointer->first_us = 0;
+  pointer->last_us = 0;
+  pointer->records = 0;
+  pointer->mask = 0;
+  for (uint32_t i = 0; i < SAMPLE_RING_CHANNELS; i++) {
+    pointer->channel[i] = (sample_stats_channel_t){0};
+  }
+}
+
+void sample_stats_add(sample_stats_t *pointer,
+                      const sample_ring_record_t *record) {
+  if (pointer->records == 0) {
+    pointer->first_us = record->timestamp_us;
+  }
+  pointer->last_us = record->timestamp_us;
+  (pointer->records)++;
+  for (uint32_t i = 0; i < SAMPLE_RING_CHANNELS; i++) {
+    if (record->mask & SAMPLE_RING_MASK(i)) {
+      sample_stats_channel_add(&pointer->channel[i], record->value[i]);
+    }
+  }
+  pointer->mask |= record->mask;
+}
+
+float sample_stats_mean(const sample_stats_channel_t *pointer) {
+  return (float)(pointer->shift) + pointer->mean;
+}
+
+float sample_stats_variance(const sample_stats_channel_t *pointer) {
+  if (pointer->count < 2) {
+    return 0.0f;
+  }
+  return pointer->m2 / (float)(pointer->count - 1);
+}
+
+void sample_stats_free(sample_stats_t *pointer) { free(pointer); }
@@ -0,0 +1,127 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "unity.h"
+#include "weather_meters_convert.h"
+#include <stdlib.h>
+
+void setUp(void) {}
+
+void tearDown(void) {}
+
+static void test_wind_speed(void) {
+  // 1 Hz is 2.4 km/h
+  TEST_ASSERT_EQUAL_UINT32(240, weather_meters_wind_speed(1, 1000000));
+  TEST_ASSERT_EQUAL_UINT32(240, weather_meters_wind_speed(15, 15000000));
+  // 100 Hz, a 240 km/h gale, is still exact
+  TEST_ASSERT_EQUAL_UINT32(24000, weather_meters_wind_speed(300, 3000000));
+  // 1 pulse in 3 s rounds to 0.80 km/h
+  TEST_ASSERT_EQUAL_UINT32(80, weather_meters_wind_speed(1, 3000000));
+  TEST_ASSERT_EQUAL_UINT32(0, weather_meters_wind_speed(0, 3000000));
+  TEST_ASSERT_EQUAL_UINT32(0, weather_meters_wind_speed(5, 0));
+}
+
+static void test_gust(void) {
+  weather_meters_wind_t wind;
+  weather_meters_wind_fill(&wind);
+  // Five 3 s windows, 2 Hz apart from a 10 Hz gust in the middle
+  const uint32_t pulses[] = {6, 6, 30, 6, 6};
+  for (uint32_t i = 0; i < sizeof(pulses) / sizeof(pulses[0]); i++) {
+    weather_meters_wind_add(&wind, pulses[i], 3000000);
+  }
+  TEST_ASSERT_EQUAL_UINT32(2400, wind.gust);
+  // 54 pulses over 15 s is 3.6 Hz
+  TEST_ASSERT_EQUAL_UINT32(864, weather_meters_wind_average(&wind));
+
+  weather_meters_wind_fill(&wind);
+  TEST_ASSERT_EQUAL_UINT32(0, wind.gust);
+  TEST_ASSERT_EQUAL_UINT32(0, weather_meters_wind_average(&wind));
+}
+
+static void test_delta(void) {
+  TEST_ASSERT_EQUAL_UINT32(5, weather_meters_delta(105, 100));
+  // accum_count readings are plain ints, they wrap after a very long gale
+  TEST_ASSERT_EQUAL_UINT32(10,
+                           weather_meters_delta(INT32_MIN + 4, INT32_MAX - 5));
+}
+
+static void test_rain(void) {
+  TEST_ASSERT_EQUAL_UINT32(0, weather_meters_rain_um(0));
+  TEST_ASSERT_EQUAL_UINT32(279, weather_meters_rain_um(1));
+  // 100 tips is 27.94 mm, rounding doesn't drift as tips add up
+  TEST_ASSERT_EQUAL_UINT32(27940, weather_meters_rain_um(100));
+  TEST_ASSERT_EQUAL_UINT32(2794000, weather_meters_rain_um(10000));
+}
+
+static void test_vane(void) {
+  static const uint32_t ohm[WEATHER_METERS_VANE_POSITIONS] = {
+      33000, 6570, 8200,  891,    1000,  688,   2200,  1410,
+      3900,  3140, 16000, 14120, 120000, 42120, 64900, 21880,
+  };
+  weather_meters_vane_t vane;
+  weather_meters_vane_fill(&vane, 3300, 10000);
+  for (uint32_t i = 1; i < WEATHER_METERS_VANE_POSITIONS; i++) {
+    TEST_ASSERT_GREATER_THAN_UINT32(vane.threshold_mv[i - 1],
+                                    vane.threshold_mv[i]);
+  }
+  // Every position's own voltage, and 2% either side of it, reads back
+  for (uint32_t i = 0; i < WEATHER_METERS_VANE_POSITIONS; i++) {
+    const uint32_t mv = 3300 * ohm[i] / (ohm[i] + 10000);
+    TEST_ASSERT_EQUAL_UINT32(i, weather_meters_vane_position(&vane, mv));
+    TEST_ASSERT_EQUAL_UINT32(
+        i, weather_meters_vane_position(&vane, mv * 98 / 100));
+    TEST_ASSERT_EQUAL_UINT32(
+        i, weather_meters_vane_position(&vane, mv * 102 / 100));
+  }
+  TEST_ASSERT_EQUAL_UINT32(5, weather_meters_vane_position(&vane, 0));
+  TEST_ASSERT_EQUAL_UINT32(12, weather_meters_vane_position(&vane, 3300));
+}
+
+static void test_direction(void) {
+  weather_meters_direction_t direction;
+  weather_meters_direction_fill(&direction);
+  TEST_ASSERT_EQUAL_UINT32(0, weather_meters_direction_average(&direction));
+
+  // North and east average to north-east
+  weather_meters_direction_add(&direction, 0);
+  weather_meters_direction_add(&direction, 4);
+  TEST_ASSERT_EQUAL_UINT32(4500, weather_meters_direction_average(&direction));
+
+  // Either side of north averages to north, not to south like a plain mean
+  weather_meters_direction_fill(&direction);
+  weather_meters_direction_add(&direction, 15);
+  weather_meters_direction_add(&direction, 1);
+  TEST_ASSERT_EQUAL_UINT32(0, weather_meters_direction_average(&direction));
+
+  // Two west-north-west and a west, two thirds of the way to 292.5
+  weather_meters_direction_fill(&direction);
+  weather_meters_direction_add(&direction, 13);
+  weather_meters_direction_add(&direction, 13);
+  weather_meters_direction_add(&direction, 12);
+  TEST_ASSERT_UINT32_WITHIN(1, 28504,
+                            weather_meters_direction_average(&direction));
+  TEST_ASSERT_EQUAL_UINT32(3, direction.count);
+}
+
+void app_main(void) {
+  UNITY_BEGIN();
+  RUN_TEST(test_wind_speed);
+  RUN_TEST(test_gust);
+  RUN_TEST(test_delta);
+  RUN_TEST(test_rain);
+  RUN_TEST(test_vane);
+  RUN_TEST(test_direction);
+  exit(UNITY_END());
+}
@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+#include "driver/pulse_cnt.h"
+#include "sdkconfig.h"
+#include "weather_meters_convert.h"
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#ifdef CONFIG_WEATHER_METERS_VANE
+#include "esp_adc/adc_cali.h"
+#include "esp_adc/adc_continuous.h"
+#include "soc/soc_caps.h"
+
+#define WEATHER_METERS_VANE_FRAME_BYTES                                        \
+  (CONFIG_WEATHER_METERS_VANE_FRAME * SOC_ADC_DIGI_RESULT_BYTES)
+#endif
+
+// What a report period came to
+typedef struct {
+  // Hundredths of a km/h
+  uint32_t wind_speed;
+  uint32_t wind_gust;
+  // Micrometres since start
+  uint32_t rain_um;
+  // Hundredths of a degree clockwise from north, from this many vane frames
+  uint32_t wind_direction;
+  uint32_t vane_frames;
+} weather_meters_report_t;
+
+typedef struct {
+  pcnt_unit_handle_t wind_unit;
+  pcnt_channel_handle_t wind_channel;
+  pcnt_unit_handle_t rain_unit;
+  pcnt_channel_handle_t rain_channel;
+
+  // Counter readings at the last sample, and when that was
+  int wind_last;
+  int rain_last;
+  int64_t last_us;
+
+  weather_meters_wind_t wind;
+  uint32_t rain_tips;
+
+#ifdef CONFIG_WEATHER_METERS_VANE
+  // Frames are averaged in the timer service task, the same task that samples
+  // and reports, so the direction needs no lock
+  adc_continuous_handle_t vane_adc;
+  adc_cali_handle_t vane_cali;
+  weather_meters_vane_t vane;
+  weather_meters_direction_t direction;
+  uint32_t vane_misses;
+  uint8_t vane_frame[WEATHER_METERS_VANE_FRAME_BYTES];
+#endif
+} weather_meters_t;
+
+// Dynamic allocation of weather_meters_t structs
+void weather_meters_init(weather_meters_t **);
+
+// Static fill of weather_meters_t structs
+void weather_meters_fill(weather_meters_t *);
+
+// Starts counting on both meters
+void weather_meters_start(weather_meters_t *);
+
+// Reads the counters and folds the pulses since the last sample in as a gust
+// window, true once a report period is complete
+bool weather_meters_sample(weather_meters_t *);
+
+// Gives the report period's wind and the total rain, then starts a new period
+void weather_meters_report(weather_meters_t *, weather_meters_report_t *);
+
+// Dynamic free of weather_meters_t structs
+void weather_meters_free(weather_meters_t *);
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+#include <inttypes.h>
+#include <stdint.h>
+
+// SparkFun weather meter datasheet: a switch closure per second is 2.4 km/h
+// of wind, and a bucket tip is 0.2794 mm of rain
+#define WEATHER_METERS_WIND_CENTI_KMH_PER_HZ 240
+#define WEATHER_METERS_RAIN_NM_PER_TIP 279400
+
+// Positions the vane's reed switches resolve, 22.5 degrees apart clockwise
+// from north
+#define WEATHER_METERS_VANE_POSITIONS 16
+
+// Wind pulses over a report period, along with the fastest gust window
+typedef struct {
+  uint32_t pulses;
+  int64_t elapsed_us;
+  uint32_t gust;
+} weather_meters_wind_t;
+
+// Pulses between two counter readings, wrapping counters are fine
+uint32_t weather_meters_delta(int32_t, int32_t);
+
+// Wind speed in hundredths of a km/h from pulses over some microseconds
+uint32_t weather_meters_wind_speed(uint32_t, int64_t);
+
+// Rainfall in micrometres from bucket tips
+uint32_t weather_meters_rain_um(uint32_t);
+
+// Starts a report period over
+void weather_meters_wind_fill(weather_meters_wind_t *);
+
+// Adds a gust window's pulses over some microseconds
+void weather_meters_wind_add(weather_meters_wind_t *, uint32_t, int64_t);
+
+// Average wind speed over the report period so far, hundredths of a km/h
+uint32_t weather_meters_wind_average(const weather_meters_wind_t *);
+
+// Vane voltages sorted low to high, a reading below threshold_mv[i] is at
+// position[i]
+typedef struct {
+  uint32_t threshold_mv[WEATHER_METERS_VANE_POSITIONS];
+  uint8_t position[WEATHER_METERS_VANE_POSITIONS];
+} weather_meters_vane_t;
+
+// Unit vectors summed over a report period, Q15 east and north components
+typedef struct {
+  int64_t east;
+  int64_t north;
+  uint32_t count;
+} weather_meters_direction_t;
+
+// Builds the threshold table for a supply in millivolts and the pull-up that
+// makes a divider with the vane, in ohms
+void weather_meters_vane_fill(weather_meters_vane_t *, uint32_t, uint32_t);
+
+// Vane position from a reading in millivolts
+uint32_t weather_meters_vane_position(const weather_meters_vane_t *, uint32_t);
+
+// Starts a report period over
+void weather_meters_direction_fill(weather_meters_direction_t *);
+
+// Adds a vane position
+void weather_meters_direction_add(weather_meters_direction_t *, uint32_t);
+
+// Vector averaged direction in hundredths of a degree clockwise from north
+uint32_t weather_meters_direction_average(const weather_meters_direction_t *);
@@ -0,0 +1,261 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "weather_meters.h"
+#include "driver/gpio.h"
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "sdkconfig.h"
+#ifdef CONFIG_WEATHER_METERS_VANE
+#include "esp_adc/adc_cali_scheme.h"
+#include "esp_attr.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/timers.h"
+#endif
+
+static const char *TAG = "weather_meters";
+
+// accum_count folds every overflow into the reading, so the limit only sets
+// how often the overflow interrupt comes around
+#define WEATHER_METERS_PCNT_LIMIT 32767
+
+// Sets up one reed switch meter, counting closures (falling edges) only
+static void weather_meters_unit(int gpio, pcnt_unit_handle_t *unit,
+                                pcnt_channel_handle_t *channel) {
+  const pcnt_unit_config_t unit_config = {
+      .low_limit = -WEATHER_METERS_PCNT_LIMIT,
+      .high_limit = WEATHER_METERS_PCNT_LIMIT,
+      .flags.accum_count = true,
+  };
+  ESP_ERROR_CHECK(pcnt_new_unit(&unit_config, unit));
+
+  const pcnt_glitch_filter_config_t filter_config = {
+      .max_glitch_ns = CONFIG_WEATHER_METERS_GLITCH_NS,
+  };
+  ESP_ERROR_CHECK(pcnt_unit_set_glitch_filter(*unit, &filter_config));
+
+  const pcnt_chan_config_t channel_config = {
+      .edge_gpio_num = gpio,
+      .level_gpio_num = -1,
+  };
+  ESP_ERROR_CHECK(pcnt_new_channel(*unit, &channel_config, channel));
+  ESP_ERROR_CHECK(pcnt_channel_set_edge_action(
+      *channel, PCNT_CHANNEL_EDGE_ACTION_HOLD,
+      PCNT_CHANNEL_EDGE_ACTION_INCREASE));
+  ESP_ERROR_CHECK(pcnt_unit_add_watch_point(*unit, WEATHER_METERS_PCNT_LIMIT));
+  // The switches pull to ground
+  ESP_ERROR_CHECK(gpio_set_pull_mode(gpio, GPIO_PULLUP_ONLY));
+
+  ESP_ERROR_CHECK(pcnt_unit_enable(*unit));
+  ESP_ERROR_CHECK(pcnt_unit_clear_count(*unit));
+  ESP_ERROR_CHECK(pcnt_unit_start(*unit));
+}
+
+#ifdef CONFIG_WEATHER_METERS_VANE
+// Averages a frame and folds its vane position into the direction, one pass
+// and one calibration lookup per frame rather than per conversion
+static void weather_meters_vane_frame(void *user_data, uint32_t unused) {
+  weather_meters_t *pointer = user_data;
+  uint32_t length = 0;
+  if (adc_continuous_read(pointer->vane_adc, pointer->vane_frame,
+                          sizeof(pointer->vane_frame), &length,
+                          0) != ESP_OK) {
+    (pointer->vane_misses)++;
+    return;
+  }
+
+  uint32_t sum = 0;
+  uint32_t count = 0;
+  for (uint32_t i = 0; i + SOC_ADC_DIGI_RESULT_BYTES <= length;
+       i += SOC_ADC_DIGI_RESULT_BYTES) {
+    const adc_digi_output_data_t *result =
+        (const adc_digi_output_data_t *)&pointer->vane_frame[i];
+    if (result->type1.channel == CONFIG_WEATHER_METERS_VANE_CHANNEL) {
+      sum += result->type1.data;
+      count++;
+    }
+  }
+  if (count == 0) {
+    (pointer->vane_misses)++;
+    return;
+  }
+
+  const int raw = (int)((sum + count / 2) / count);
+  int mv;
+  if (pointer->vane_cali == NULL ||
+      adc_cali_raw_to_voltage(pointer->vane_cali, raw, &mv) != ESP_OK) {
+    // Uncalibrated, 12 dB attenuation reads roughly 3.1 V full scale
+    mv = raw * 3100 / 4095;
+  }
+  weather_meters_direction_add(
+      &pointer->direction,
+      weather_meters_vane_position(&pointer->vane, (uint32_t)mv));
+}
+
+// Runs once per DMA frame, the frame is read outside the interrupt
+static bool IRAM_ATTR weather_meters_vane_done(
+    adc_continuous_handle_t handle, const adc_continuous_evt_data_t *event,
+    void *user_data) {
+  BaseType_t woken = pdFALSE;
+  xTimerPendFunctionCallFromISR(weather_meters_vane_frame, user_data, 0,
+                                &woken);
+  return woken == pdTRUE;
+}
+
+static void weather_meters_vane_start(weather_meters_t *pointer) {
+  ESP_LOGI(TAG, "Sampling the wind vane on ADC1 channel %d at %d Hz",
+           CONFIG_WEATHER_METERS_VANE_CHANNEL,
+           CONFIG_WEATHER_METERS_VANE_SAMPLE_HZ);
+  const adc_continuous_handle_cfg_t handle_config = {
+      .max_store_buf_size = WEATHER_METERS_VANE_FRAME_BYTES * 2,
+      .conv_frame_size = WEATHER_METERS_VANE_FRAME_BYTES,
+  };
+  ESP_ERROR_CHECK(
+      adc_continuous_new_handle(&handle_config, &pointer->vane_adc));
+
+  adc_digi_pattern_config_t pattern = {
+      .atten = ADC_ATTEN_DB_12,
+      .channel = CONFIG_WEATHER_METERS_VANE_CHANNEL,
+      .unit = ADC_UNIT_1,
+      .bit_width = SOC_ADC_DIGI_MAX_BITWIDTH,
+  };
+  const adc_continuous_config_t config = {
+      .pattern_num = 1,
+      .adc_pattern = &pattern,
+      .sample_freq_hz = CONFIG_WEATHER_METERS_VANE_SAMPLE_HZ,
+      .conv_mode = ADC_CONV_SINGLE_UNIT_1,
+      .format = ADC_DIGI_OUTPUT_FORMAT_TYPE1,
+  };
+  ESP_ERROR_CHECK(adc_continuous_config(pointer->vane_adc, &config));
+
+  const adc_cali_line_fitting_config_t cali_config = {
+      .unit_id = ADC_UNIT_1,
+      .atten = ADC_ATTEN_DB_12,
+      .bitwidth = ADC_BITWIDTH_DEFAULT,
+  };
+  if (adc_cali_create_scheme_line_fitting(&cali_config,
+                                          &pointer->vane_cali) != ESP_OK) {
+    ESP_LOGW(TAG, "No ADC calibration in eFuse, vane thresholds are rough");
+    pointer->vane_cali = NULL;
+  }
+
+  const adc_continuous_evt_cbs_t callbacks = {
+      .on_conv_done = weather_meters_vane_done,
+  };
+  ESP_ERROR_CHECK(adc_continuous_register_event_callbacks(
+      pointer->vane_adc, &callbacks, pointer));
+  ESP_ERROR_CHECK(adc_continuous_start(pointer->vane_adc));
+}
+#endif
+
+void weather_meters_init(weather_meters_t **pointer) {
+  *pointer = malloc(sizeof(weather_meters_t));
+  weather_meters_fill(*pointer);
+}
+
+void weather_meters_fill(weather_meters_t *pointer) {
+  pointer->wind_last = 0;
+  pointer->rain_last = 0;
+  pointer->last_us = 0;
+  weather_meters_wind_fill(&pointer->wind);
+  pointer->rain_tips = 0;
+#ifdef CONFIG_WEATHER_METERS_VANE
+  pointer->vane_adc = NULL;
+  pointer->vane_cali = NULL;
+  weather_meters_vane_fill(&pointer->vane,
+                           CONFIG_WEATHER_METERS_VANE_SUPPLY_MV,
+                           CONFIG_WEATHER_METERS_VANE_PULLUP_OHM);
+  weather_meters_direction_fill(&pointer->direction);
+  pointer->vane_misses = 0;
+#endif
+}
+
+void weather_meters_start(weather_meters_t *pointer) {
+  ESP_LOGI(TAG, "Counting anemometer pulses on GPIO%d",
+           CONFIG_WEATHER_METERS_WIND_GPIO);
+  weather_meters_unit(CONFIG_WEATHER_METERS_WIND_GPIO, &pointer->wind_unit,
+                      &pointer->wind_channel);
+  ESP_LOGI(TAG, "Counting rain gauge tips on GPIO%d",
+           CONFIG_WEATHER_METERS_RAIN_GPIO);
+  weather_meters_unit(CONFIG_WEATHER_METERS_RAIN_GPIO, &pointer->rain_unit,
+                      &pointer->rain_channel);
+#ifdef CONFIG_WEATHER_METERS_VANE
+  weather_meters_vane_start(pointer);
+#endif
+  pointer->last_us = esp_timer_get_time();
+}
+
+bool weather_meters_sample(weather_meters_t *pointer) {
+  int wind, rain;
+  const int64_t now = esp_timer_get_time();
+  ESP_ERROR_CHECK(pcnt_unit_get_count(pointer->wind_unit, &wind));
+  ESP_ERROR_CHECK(pcnt_unit_get_count(pointer->rain_unit, &rain));
+
+  weather_meters_wind_add(&pointer->wind,
+                          weather_meters_delta(wind, pointer->wind_last),
+                          now - pointer->last_us);
+  pointer->rain_tips += weather_meters_delta(rain, pointer->rain_last);
+  pointer->wind_last = wind;
+  pointer->rain_last = rain;
+  pointer->last_us = now;
+  // Half a window of slack so timer jitter doesn't add a whole window
+  return pointer->wind.elapsed_us + CONFIG_WEATHER_METERS_GUST_MS * 500 >=
+         (int64_t)(CONFIG_WEATHER_METERS_PERIOD_MS) * 1000;
+}
+
+void weather_meters_report(weather_meters_t *pointer,
+                           weather_meters_report_t *report) {
+  report->wind_speed = weather_meters_wind_average(&pointer->wind);
+  report->wind_gust = pointer->wind.gust;
+  report->rain_um = weather_meters_rain_um(pointer->rain_tips);
+#ifdef CONFIG_WEATHER_METERS_VANE
+  report->wind_direction =
+      weather_meters_direction_average(&pointer->direction);
+  report->vane_frames = pointer->direction.count;
+  if (pointer->vane_misses > 0) {
+    ESP_LOGW(TAG, "Missed %" PRIu32 " vane frames", pointer->vane_misses);
+    pointer->vane_misses = 0;
+  }
+  weather_meters_direction_fill(&pointer->direction);
+#else
+  report->wind_direction = 0;
+  report->vane_frames = 0;
+#endif
+  ESP_LOGI(TAG,
+           "Wind %" PRIu32 " pulses in %" PRId64 " us, %" PRIu32
+           " rain tips so far",
+           pointer->wind.pulses, pointer->wind.elapsed_us, pointer->rain_tips);
+  weather_meters_wind_fill(&pointer->wind);
+}
+
+void weather_meters_free(weather_meters_t *pointer) {
+#ifdef CONFIG_WEATHER_METERS_VANE
+  ESP_ERROR_CHECK(adc_continuous_stop(pointer->vane_adc));
+  ESP_ERROR_CHECK(adc_continuous_deinit(pointer->vane_adc));
+  if (pointer->vane_cali != NULL) {
+    ESP_ERROR_CHECK(adc_cali_delete_scheme_line_fitting(pointer->vane_cali));
+  }
+#endif
+  ESP_ERROR_CHECK(pcnt_unit_stop(pointer->wind_unit));
+  ESP_ERROR_CHECK(pcnt_unit_disable(pointer->wind_unit));
+  ESP_ERROR_CHECK(pcnt_del_channel(pointer->wind_channel));
+  ESP_ERROR_CHECK(pcnt_del_unit(pointer->wind_unit));
+  ESP_ERROR_CHECK(pcnt_unit_stop(pointer->rain_unit));
+  ESP_ERROR_CHECK(pcnt_unit_disable(pointer->rain_unit));
+  ESP_ERROR_CHECK(pcnt_del_channel(pointer->rain_channel));
+  ESP_ERROR_CHECK(pcnt_del_unit(pointer->rain_unit));
+  free(pointer);
+}
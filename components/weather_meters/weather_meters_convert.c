@@ -0,0 +1,129 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "weather_meters_convert.h"
+#include <math.h>
+
+// SparkFun weather meter datasheet: the vane's resistance at each position
+static const uint32_t weather_meters_vane_ohm[WEATHER_METERS_VANE_POSITIONS] = {
+    33000, 6570, 8200,  891,    1000,  688,   2200,  1410,
+    3900,  3140, 16000, 14120, 120000, 42120, 64900, 21880,
+};
+
+// sin(position * 22.5 degrees) in Q15, cos is four positions on
+static const int32_t weather_meters_vane_sin[WEATHER_METERS_VANE_POSITIONS] = {
+    0,      12539,  23170,  30273,  32767,  30273,  23170,  12539,
+    0,      -12539, -23170, -30273, -32767, -30273, -23170, -12539,
+};
+
+uint32_t weather_meters_delta(int32_t now, int32_t last) {
+  return (uint32_t)now - (uint32_t)last;
+}
+
+uint32_t weather_meters_wind_speed(uint32_t pulses, int64_t elapsed_us) {
+  if (elapsed_us <= 0) {
+    return 0;
+  }
+  const uint64_t scaled =
+      (uint64_t)pulses * WEATHER_METERS_WIND_CENTI_KMH_PER_HZ * 1000000;
+  return (uint32_t)((scaled + (uint64_t)elapsed_us / 2) /
+                    (uint64_t)elapsed_us);
+}
+
+uint32_t weather_meters_rain_um(uint32_t tips) {
+  return (uint32_t)(((uint64_t)tips * WEATHER_METERS_RAIN_NM_PER_TIP + 500) /
+                    1000);
+}
+
+void weather_meters_wind_fill(weather_meters_wind_t *pointer) {
+  pointer->pulses = 0;
+  pointer->elapsed_us = 0;
+  pointer->gust = 0;
+}
+
+void weather_meters_wind_add(weather_meters_wind_t *pointer, uint32_t pulses,
+                             int64_t elapsed_us) {
+  pointer->pulses += pulses;
+  pointer->elapsed_us += elapsed_us;
+  const uint32_t speed = weather_meters_wind_speed(pulses, elapsed_us);
+  if (speed > pointer->gust) {
+    pointer->gust = speed;
+  }
+}
+
+uint32_t weather_meters_wind_average(const weather_meters_wind_t *pointer) {
+  return weather_meters_wind_speed(pointer->pulses, pointer->elapsed_us);
+}
+
+void weather_meters_vane_fill(weather_meters_vane_t *pointer,
+                              uint32_t supply_mv, uint32_t pullup_ohm) {
+  uint32_t mv[WEATHER_METERS_VANE_POSITIONS];
+  // Insertion sort by divider voltage, it's 16 entries once at start
+  for (uint32_t i = 0; i < WEATHER_METERS_VANE_POSITIONS; i++) {
+    const uint32_t ohm = weather_meters_vane_ohm[i];
+    const uint32_t v =
+        (uint32_t)((uint64_t)supply_mv * ohm / (ohm + pullup_ohm));
+    uint32_t j = i;
+    while (j > 0 && mv[j - 1] > v) {
+      mv[j] = mv[j - 1];
+      pointer->position[j] = pointer->position[j - 1];
+      j--;
+    }
+    mv[j] = v;
+    pointer->position[j] = (uint8_t)i;
+  }
+  // Thresholds sit halfway between neighbouring voltages
+  for (uint32_t i = 0; i + 1 < WEATHER_METERS_VANE_POSITIONS; i++) {
+    pointer->threshold_mv[i] = (mv[i] + mv[i + 1]) / 2;
+  }
+  pointer->threshold_mv[WEATHER_METERS_VANE_POSITIONS - 1] = UINT32_MAX;
+}
+
+uint32_t weather_meters_vane_position(const weather_meters_vane_t *pointer,
+                                      uint32_t mv) {
+  uint32_t i = 0;
+  while (mv >= pointer->threshold_mv[i]) {
+    i++;
+  }
+  return pointer->position[i];
+}
+
+void weather_meters_direction_fill(weather_meters_direction_t *pointer) {
+  pointer->east = 0;
+  pointer->north = 0;
+  pointer->count = 0;
+}
+
+void weather_meters_direction_add(weather_meters_direction_t *pointer,
+                                  uint32_t position) {
+  position %= WEATHER_METERS_VANE_POSITIONS;
+  pointer->east += weather_meters_vane_sin[position];
+  pointer->north += weather_meters_vane_sin[(position + 4) %
+                                            WEATHER_METERS_VANE_POSITIONS];
+  (pointer->count)++;
+}
+
+uint32_t
+weather_meters_direction_average(const weather_meters_direction_t *pointer) {
+  if (pointer->east == 0 && pointer->north == 0) {
+    return 0;
+  }
+  float degrees = atan2f((float)(pointer->east), (float)(pointer->north)) *
+                  (180.0f / (float)M_PI);
+  if (degrees < 0.0f) {
+    degrees += 360.0f;
+  }
+  return (uint32_t)lroundf(degrees * 100.0f) % 36000;
+}
@@ -15,6 +15,7 @@
  */
 #pragma once
 #include <inttypes.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdlib.h>
 
@@ -27,16 +28,28 @@
 #define WIRELESS_STATUS_STARTED (((uint32_t)(1)) << 0)
 #define WIRELESS_STATUS_BINARY_FETCHED_OTA (((uint32_t)(1)) << 1)
 #define WIRELESS_STATUS_CONNECTED (((uint32_t)(1)) << 2)
+#define WIRELESS_STATUS_FAST_JOIN (((uint32_t)(1)) << 3)
 #define WIRELESS_STATUS_NONE ((uint32_t)(0))
 
 #define WIRELESS_CONNECTED_BIT BIT0
 #define WIRELESS_FAIL_BIT BIT1
 
+#define WIRELESS_NVS_NAMESPACE "wireless"
+
 typedef struct {
   wifi_config_t config;
-  uint32_t status;
+  // Set from the event loop and the update task alike
+  _Atomic uint32_t status;
   EventGroupHandle_t events;
   uint32_t tries_left;
+  // When the current join started and how long the last one took to get an
+  // IP, fast joins included
+  int64_t joining_since_us;
+  uint32_t time_to_ip_ms;
+  // Radio time spent joining and associated, for the current estimate
+  int64_t joining_us;
+  int64_t associated_us;
+  int64_t associated_since_us;
 } wireless_t;
 
 // Dynamic allocation of wireless_t structs
@@ -48,5 +61,24 @@ void wireless_fill(wireless_t *);
 // Starts the Wi-Fi connection
 void wireless_start(wireless_t *);
 
+// Tries joining again with fresh retries, once they ran out
+void wireless_rejoin(wireless_t *);
+
+// Logs the last time to IP and the estimated average radio current
+void wireless_report(wireless_t *);
+
 // Dynamic free of wireless_t structs
 void wireless_free(wireless_t *);
+
+#ifdef CONFIG_WIRELESS_AUTO_UPDATE
+// Streams a raw or zlib compressed app image from the URL into the inactive
+// OTA partition and boots it next. ESP_ERR_INVALID_VERSION means there's
+// nothing new to install.
+esp_err_t wireless_ota_fetch(wireless_t *, const char *url);
+
+// Keeps a freshly updated image once it's shown to work, or rolls back
+void wireless_ota_confirm(bool works);
+
+// Confirms or rolls back a new image, then checks for updates periodically
+void wireless_ota_task(void *);
+#endif
@@ -0,0 +1,45 @@
+# Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+#
+# Permission to use, copy, modify, and distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+"""Compresses an app image for WIRELESS_AUTO_UPDATE, the station inflates it
+as it writes it to flash.
+
+    python ota_pack.py build/weather.bin weather.bin.z
+"""
+
+import argparse
+import zlib
+from pathlib import Path
+
+
+def pack(image: bytes) -> bytes:
+    # zlib's default 32 KiB window is the one the ROM inflater keeps
+    return zlib.compress(image, 9)
+
+
+def main() -> None:
+    parser = argparse.ArgumentParser(
+        description='Compresses an app image for WIRELESS_AUTO_UPDATE')
+    parser.add_argument('image', type=Path, help='app .bin from idf.py build')
+    parser.add_argument('output', type=Path, help='compressed image to serve')
+    args = parser.parse_args()
+
+    image = args.image.read_bytes()
+    packed = pack(image)
+    args.output.write_bytes(packed)
+    print(f'{len(image)} bytes to {len(packed)} bytes '
+          f'({len(packed) * 100 // len(image)}%)')
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,103 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "esp_event.h"
+#include "esp_netif.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "nvs.h"
+#include "nvs_flash.h"
+#include "protocol_examples_common.h"
+#include "unity.h"
+#include "wireless.h"
+#include <stdio.h>
+
+// QEMU's user networking reaches the host here
+#define SERVER "http://10.0.2.2:8070"
+
+static wireless_t wireless;
+
+// A bad stream must never reach the boot partition
+static void test_corrupt(void) {
+  const esp_partition_t *boot = esp_ota_get_boot_partition();
+  TEST_ASSERT_NOT_EQUAL(ESP_OK,
+                        wireless_ota_fetch(&wireless, SERVER "/corrupt.bin.z"));
+  TEST_ASSERT_EQUAL_PTR(boot, esp_ota_get_boot_partition());
+  TEST_ASSERT_EQUAL_UINT32(0, atomic_load(&wireless.status) &
+                                  WIRELESS_STATUS_BINARY_FETCHED_OTA);
+}
+
+// The image we run, uncompressed, is nothing new
+static void test_running(void) {
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_VERSION,
+                    wireless_ota_fetch(&wireless, SERVER "/running.bin"));
+}
+
+static void test_update(void) {
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    wireless_ota_fetch(&wireless, SERVER "/update.bin.z"));
+  TEST_ASSERT_NOT_EQUAL(0, atomic_load(&wireless.status) &
+                               WIRELESS_STATUS_BINARY_FETCHED_OTA);
+  TEST_ASSERT_NOT_EQUAL(esp_ota_get_running_partition(),
+                        esp_ota_get_boot_partition());
+}
+
+// The server answers 304 for the image already installed
+static void test_unchanged(void) {
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_VERSION,
+                    wireless_ota_fetch(&wireless, SERVER "/update.bin.z"));
+}
+
+// Without the ETag, the image is still recognised as the one rolled back
+static void test_rolled_back(void) {
+  nvs_handle_t handle;
+  TEST_ASSERT_EQUAL(ESP_OK,
+                    nvs_open(WIRELESS_NVS_NAMESPACE, NVS_READWRITE, &handle));
+  TEST_ASSERT_EQUAL(ESP_OK, nvs_erase_key(handle, "ota_etag"));
+  nvs_close(handle);
+  TEST_ASSERT_NOT_NULL(esp_ota_get_last_invalid_partition());
+  TEST_ASSERT_EQUAL(ESP_ERR_INVALID_VERSION,
+                    wireless_ota_fetch(&wireless, SERVER "/update.bin.z"));
+}
+
+// Boots three times, into the original image, the update that fails to
+// confirm, then the original image again
+void app_main(void) {
+  ESP_ERROR_CHECK(nvs_flash_init());
+  ESP_ERROR_CHECK(esp_netif_init());
+  ESP_ERROR_CHECK(esp_event_loop_create_default());
+  ESP_ERROR_CHECK(example_connect());
+  wireless_fill(&wireless);
+
+  esp_ota_img_states_t state;
+  if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) ==
+          ESP_OK &&
+      state == ESP_OTA_IMG_PENDING_VERIFY) {
+    printf("Running the update, not confirming it\n");
+    wireless_ota_confirm(false);
+  }
+
+  UNITY_BEGIN();
+  if (esp_ota_get_last_invalid_partition() == NULL) {
+    RUN_TEST(test_corrupt);
+    RUN_TEST(test_running);
+    RUN_TEST(test_update);
+    UNITY_END();
+    esp_restart();
+  }
+  RUN_TEST(test_unchanged);
+  RUN_TEST(test_rolled_back);
+  UNITY_END();
+}
@@ -0,0 +1,103 @@
+# Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+#
+# Permission to use, copy, modify, and distribute this software for any
+# purpose with or without fee is hereby granted, provided that the above
+# copyright notice and this permission notice appear in all copies.
+#
+# THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+# WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+# MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+# ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+# WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+# ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+# OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+
+import hashlib
+import logging
+import threading
+import zlib
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+from typing import Dict, Iterator
+
+import pytest
+from pytest_embedded_qemu.app import QemuApp
+from pytest_embedded_qemu.dut import QemuDut
+
+PORT = 8070
+# Image header, segment header, then esp_app_desc_t up to app_elf_sha256
+ELF_SHA256_OFFSET = 24 + 8 + 144
+
+
+def make_update(image: bytes) -> bytes:
+    # Flips a byte of the ELF SHA256 so the image looks like a new version,
+    # then fixes up the checksum byte and the appended SHA256 after it
+    update = bytearray(image)
+    update[ELF_SHA256_OFFSET] ^= 0xFF
+    update[-33] ^= 0xFF
+    update[-32:] = hashlib.sha256(update[:-32]).digest()
+    return bytes(update)
+
+
+def make_corrupt(image: bytes) -> bytes:
+    corrupt = bytearray(zlib.compress(image, 9))
+    corrupt[len(corrupt) // 2] ^= 0xFF
+    return bytes(corrupt)
+
+
+def serve(files: Dict[str, bytes]) -> ThreadingHTTPServer:
+    class Handler(BaseHTTPRequestHandler):
+        def do_GET(self) -> None:
+            body = files.get(self.path)
+            if body is None:
+                self.send_error(404)
+                return
+            etag = f'"{hashlib.sha1(body).hexdigest()}"'
+            if self.headers.get('If-None-Match') == etag:
+                self.send_response(304)
+                self.send_header('ETag', etag)
+                self.end_headers()
+                return
+            self.send_response(200)
+            self.send_header('ETag', etag)
+            self.send_header('Content-Length', str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+
+    server = ThreadingHTTPServer(('0.0.0.0', PORT), Handler)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    return server
+
+
+@pytest.fixture
+def images(app: QemuApp) -> Iterator[None]:
+    with open(app.bin_file, 'rb') as f:
+        image = f.read()
+    update = zlib.compress(make_update(image), 9)
+    logging.info(f'Update compressed from {len(image)} to {len(update)} bytes')
+    server = serve({
+        '/running.bin': image,
+        '/update.bin.z': update,
+        '/corrupt.bin.z': make_corrupt(image),
+    })
+    yield
+    server.shutdown()
+
+
+@pytest.mark.esp32
+@pytest.mark.host_test
+@pytest.mark.qemu
+@pytest.mark.parametrize('qemu_extra_args', ['-nic user,model=open_eth'],
+                         indirect=True)
+def test_wireless_ota_qemu(images: None, dut: QemuDut) -> None:
+    fetched = dut.expect(
+        r'Fetched (\d+) byte image in (\d+) bytes \(\d+%\) to \w+ in (\d+) ms',
+        timeout=300)
+    logging.info(f'Update of {fetched.group(1).decode()} bytes downloaded in '
+                 f'{fetched.group(2).decode()} bytes, '
+                 f'{fetched.group(3).decode()} ms')
+    dut.expect(r'3 Tests 0 Failures 0 Ignored', timeout=60)
+    dut.expect('Running the update, not confirming it', timeout=120)
+    dut.expect('rolling back', timeout=60)
+    dut.expect('Image unchanged', timeout=120)
+    dut.expect('was rolled back before', timeout=60)
+    dut.expect(r'2 Tests 0 Failures 0 Ignored', timeout=60)
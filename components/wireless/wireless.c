@@ -14,9 +14,96 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 #include "wireless.h"
+#include "esp_rom_crc.h"
+#include "esp_timer.h"
+#include "nvs.h"
+#include <string.h>
 
 static const char *TAG = "wireless";
 
+// Where the last join went, for a directed join on the next start
+typedef struct {
+  uint8_t ssid[32];
+  uint8_t bssid[6];
+  uint8_t channel;
+  uint32_t crc;
+} wireless_cache_t;
+
+static uint32_t wireless_cache_crc(const wireless_cache_t *cache) {
+  return esp_rom_crc32_le(0, (const uint8_t *)cache, offsetof(wireless_cache_t, crc));
+}
+
+// Reads the cached access point, false if there's none for this SSID
+static bool wireless_cache_read(wireless_t *pointer, wireless_cache_t *cache) {
+  nvs_handle_t handle;
+  if(nvs_open(WIRELESS_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+    return false;
+  }
+  size_t size = sizeof(*cache);
+  esp_err_t ret = nvs_get_blob(handle, "join", cache, &size);
+  nvs_close(handle);
+  return ret == ESP_OK && size == sizeof(*cache) &&
+         cache->crc == wireless_cache_crc(cache) &&
+         memcmp(cache->ssid, pointer->config.sta.ssid, sizeof(cache->ssid)) == 0;
+}
+
+// Points the configuration at the cached access point, false if there's none
+// for this SSID
+static bool wireless_cache_load(wireless_t *pointer) {
+  wireless_cache_t cache;
+  if(!wireless_cache_read(pointer, &cache)) {
+    return false;
+  }
+  pointer->config.sta.bssid_set = true;
+  memcpy(pointer->config.sta.bssid, cache.bssid, sizeof(cache.bssid));
+  pointer->config.sta.channel = cache.channel;
+  pointer->config.sta.scan_method = WIFI_FAST_SCAN;
+  return true;
+}
+
+// Stores where the join went, only when it changed to spare the flash
+static void wireless_cache_store(wireless_t *pointer) {
+  wifi_ap_record_t ap;
+  if(esp_wifi_sta_get_ap_info(&ap) != ESP_OK) {
+    return;
+  }
+  // Checked against the flash itself, a scanned join has no BSSID to go by
+  wireless_cache_t cache;
+  if(wireless_cache_read(pointer, &cache) &&
+     memcmp(cache.bssid, ap.bssid, sizeof(ap.bssid)) == 0 &&
+     cache.channel == ap.primary) {
+    return;
+  }
+
+  // Padding goes into the CRC, keep it deterministic
+  memset(&cache, 0, sizeof(cache));
+  memcpy(cache.ssid, pointer->config.sta.ssid, sizeof(cache.ssid));
+  memcpy(cache.bssid, ap.bssid, sizeof(cache.bssid));
+  cache.channel = ap.primary;
+  cache.crc = wireless_cache_crc(&cache);
+  nvs_handle_t handle;
+  esp_err_t ret = nvs_open(WIRELESS_NVS_NAMESPACE, NVS_READWRITE, &handle);
+  if(ret == ESP_OK) {
+    ret = nvs_set_blob(handle, "join", &cache, sizeof(cache));
+    if(ret == ESP_OK) {
+      ret = nvs_commit(handle);
+    }
+    nvs_close(handle);
+  }
+  if(ret != ESP_OK) {
+    ESP_LOGW(TAG, "Couldn't cache the access point: %s", esp_err_to_name(ret));
+  }
+}
+
+// Forgets the cached access point and scans every channel instead
+static void wireless_scan_config(wireless_t *pointer) {
+  atomic_fetch_and(&pointer->status, ~WIRELESS_STATUS_FAST_JOIN);
+  pointer->config.sta.bssid_set = false;
+  pointer->config.sta.channel = 0;
+  pointer->config.sta.scan_method = WIFI_ALL_CHANNEL_SCAN;
+  esp_wifi_set_config(WIFI_IF_STA, &(pointer->config));
+}
+
 static void wireless_event_handler(void *user_data, esp_event_base_t event_base, int32_t event_id, void *event_data) {
   wireless_t *pointer = user_data;
 
@@ -25,22 +112,41 @@ static void wireless_event_handler(void *user_data, esp_event_base_t event_base,
       ESP_LOGI(TAG, "Connecting to Wi-Fi network");
       esp_wifi_connect();
     } else if(event_id == WIFI_EVENT_STA_DISCONNECTED) {
-      pointer->status &= ~WIRELESS_STATUS_CONNECTED;
+      const int64_t now = esp_timer_get_time();
+      if((atomic_load(&pointer->status) & WIRELESS_STATUS_CONNECTED) != 0) {
+        pointer->associated_us += now - pointer->associated_since_us;
+        pointer->joining_since_us = now;
+      }
+      atomic_fetch_and(&pointer->status, ~WIRELESS_STATUS_CONNECTED);
+      xEventGroupClearBits(pointer->events, WIRELESS_CONNECTED_BIT);
 
-      if(pointer->tries_left > 0) {
+      if((atomic_load(&pointer->status) & WIRELESS_STATUS_FAST_JOIN) != 0) {
+        // The access point moved or went away, a scan doesn't cost a try
+        ESP_LOGW(TAG, "Cached access point didn't answer, scanning");
+        wireless_scan_config(pointer);
+        esp_wifi_connect();
+      } else if(pointer->tries_left > 0) {
         ESP_LOGW(TAG, "Can't connect, will try %" PRIu32 " more times", pointer->tries_left);
         esp_wifi_connect();
         (pointer->tries_left)--;
       } else {
-        ESP_LOGW(TAG, "Ran out of tries, bailing out");
+        ESP_LOGW(TAG, "Ran out of tries, waiting for a rejoin");
+        // The radio idles until then, that isn't joining time
+        pointer->joining_us += now - pointer->joining_since_us;
         xEventGroupSetBits(pointer->events, WIRELESS_FAIL_BIT);
       }
     }
   } else if (event_base == IP_EVENT) {
     if(event_id == IP_EVENT_STA_GOT_IP) {
       ip_event_got_ip_t* event = event_data;
-      ESP_LOGI(TAG, "Obtained IP address: " IPSTR, IP2STR(&event->ip_info.ip));
-      pointer->status |= WIRELESS_STATUS_CONNECTED;
+      const int64_t now = esp_timer_get_time();
+      pointer->time_to_ip_ms = (uint32_t)((now - pointer->joining_since_us) / 1000);
+      pointer->joining_us += now - pointer->joining_since_us;
+      pointer->associated_since_us = now;
+      ESP_LOGI(TAG, "Obtained IP address " IPSTR " in %" PRIu32 " ms%s", IP2STR(&event->ip_info.ip),
+               pointer->time_to_ip_ms, ((atomic_load(&pointer->status) & WIRELESS_STATUS_FAST_JOIN) != 0) ? " (fast join)" : "");
+      wireless_cache_store(pointer);
+      atomic_fetch_or(&pointer->status, WIRELESS_STATUS_CONNECTED);
       pointer->tries_left = CONFIG_WIRELESS_RETRIES;
       xEventGroupSetBits(pointer->events, WIRELESS_CONNECTED_BIT);
     }
@@ -53,7 +159,7 @@ void wireless_init(wireless_t **pointer) {
 }
 
 void wireless_fill(wireless_t *pointer) {
-  pointer->status = WIRELESS_STATUS_NONE;
+  atomic_store(&pointer->status, WIRELESS_STATUS_NONE);
 
 #ifdef CONFIG_WIRELESS_SECURITY_OPEN
   wifi_auth_mode_t auth = WIFI_AUTH_OPEN;
@@ -76,14 +182,23 @@ void wireless_fill(wireless_t *pointer) {
       .ssid = CONFIG_WIRELESS_JOIN_SSID,
       .password = CONFIG_WIRELESS_JOIN_PASSPHRASE,
       .threshold.authmode = auth,
+      .scan_method = WIFI_ALL_CHANNEL_SCAN,
+#ifdef CONFIG_WIRELESS_POWER_SAVE_MAX_MODEM
+      .listen_interval = CONFIG_WIRELESS_LISTEN_INTERVAL,
+#endif
     },
   };
 
   pointer->tries_left = CONFIG_WIRELESS_RETRIES;
+  pointer->joining_since_us = 0;
+  pointer->time_to_ip_ms = 0;
+  pointer->joining_us = 0;
+  pointer->associated_us = 0;
+  pointer->associated_since_us = 0;
 }
 
 void wireless_start(wireless_t *pointer) {
-  if((pointer->status & WIRELESS_STATUS_STARTED) == 0) {
+  if((atomic_load(&pointer->status) & WIRELESS_STATUS_STARTED) == 0) {
     pointer->events = xEventGroupCreate();
 
     ESP_ERROR_CHECK(esp_netif_init());
@@ -108,17 +223,62 @@ void wireless_start(wireless_t *pointer) {
                                                         pointer,
                                                         &instance_got_ip));
 
+#ifdef CONFIG_WIRELESS_FAST_JOIN
+    if(wireless_cache_load(pointer)) {
+      ESP_LOGI(TAG, "Joining the cached access point on channel %d", pointer->config.sta.channel);
+      atomic_fetch_or(&pointer->status, WIRELESS_STATUS_FAST_JOIN);
+    }
+#endif
+
     ESP_ERROR_CHECK(esp_wifi_set_mode(WIFI_MODE_STA));
     ESP_ERROR_CHECK(esp_wifi_set_config(WIFI_IF_STA, &(pointer->config)));
+    pointer->joining_since_us = esp_timer_get_time();
     ESP_ERROR_CHECK(esp_wifi_start());
+#if defined(CONFIG_WIRELESS_POWER_SAVE_NONE)
+    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_NONE));
+#elif defined(CONFIG_WIRELESS_POWER_SAVE_MAX_MODEM)
+    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_MAX_MODEM));
+#else
+    ESP_ERROR_CHECK(esp_wifi_set_ps(WIFI_PS_MIN_MODEM));
+#endif
 
     ESP_LOGI(TAG, "Wireless component started");
-    pointer->status |= WIRELESS_STATUS_STARTED;
+    atomic_fetch_or(&pointer->status, WIRELESS_STATUS_STARTED);
   } else {
     ESP_LOGE(TAG, "Wireless component was already started!");
   }
 }
 
+void wireless_rejoin(wireless_t *pointer) {
+  ESP_LOGI(TAG, "Rejoining Wi-Fi network");
+  pointer->tries_left = CONFIG_WIRELESS_RETRIES;
+  pointer->joining_since_us = esp_timer_get_time();
+  xEventGroupClearBits(pointer->events, WIRELESS_FAIL_BIT);
+  esp_wifi_connect();
+}
+
+void wireless_report(wireless_t *pointer) {
+  const int64_t now = esp_timer_get_time();
+  int64_t joining_us = pointer->joining_us;
+  int64_t associated_us = pointer->associated_us;
+  if((atomic_load(&pointer->status) & WIRELESS_STATUS_CONNECTED) != 0) {
+    associated_us += now - pointer->associated_since_us;
+  } else if((xEventGroupGetBits(pointer->events) & WIRELESS_FAIL_BIT) == 0) {
+    joining_us += now - pointer->joining_since_us;
+  }
+  const int64_t total_us = joining_us + associated_us;
+  if(total_us <= 0) {
+    return;
+  }
+  // Weighted by the time spent in each state
+  const int64_t average_ua = (joining_us * CONFIG_WIRELESS_CURRENT_JOIN_MA +
+                              associated_us * CONFIG_WIRELESS_CURRENT_ASSOCIATED_MA) * 1000 / total_us;
+  ESP_LOGI(TAG, "Last time to IP %" PRIu32 " ms, %" PRId64 " s joining and %" PRId64
+                " s associated, about %" PRId64 ".%" PRId64 " mA radio current",
+           pointer->time_to_ip_ms, joining_us / 1000000, associated_us / 1000000,
+           average_ua / 1000, (average_ua % 1000) / 100);
+}
+
 void wireless_free(wireless_t *pointer) { free(pointer); }
 
 // Event handler
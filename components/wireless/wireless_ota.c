@@ -0,0 +1,400 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "wireless.h"
+
+#ifdef CONFIG_WIRELESS_AUTO_UPDATE
+#include "esp_app_desc.h"
+#include "esp_app_format.h"
+#include "esp_crt_bundle.h"
+#include "esp_http_client.h"
+#include "esp_ota_ops.h"
+#include "esp_system.h"
+#include "esp_timer.h"
+#include "freertos/task.h"
+#include "nvs.h"
+#include "rom/miniz.h"
+#include <string.h>
+
+static const char *TAG = "wireless_ota";
+
+// Enough of the image to read its app description before writing anything
+#define WIRELESS_OTA_HEAD_SIZE                                                 \
+  (sizeof(esp_image_header_t) + sizeof(esp_image_segment_header_t) +           \
+   sizeof(esp_app_desc_t))
+#define WIRELESS_OTA_CHUNK_SIZE 1024
+#define WIRELESS_OTA_ETAG_SIZE 64
+// The first byte of a zlib stream with a 32 KiB window
+#define WIRELESS_OTA_ZLIB_CMF 0x78
+
+typedef struct {
+  const esp_partition_t *partition;
+  esp_ota_handle_t handle;
+  bool begun;
+  uint8_t head[WIRELESS_OTA_HEAD_SIZE];
+  size_t head_length;
+  // Bytes of image written, and bytes downloaded for them
+  size_t written;
+  size_t received;
+  // Set once the image turns out to be one not worth writing
+  esp_err_t skip;
+} wireless_ota_sink_t;
+
+// Decompression state and its 32 KiB window, on the heap for the download
+typedef struct {
+  tinfl_decompressor inflator;
+  uint8_t window[TINFL_LZ_DICT_SIZE];
+  size_t window_at;
+} wireless_ota_inflate_t;
+
+typedef struct {
+  char etag[WIRELESS_OTA_ETAG_SIZE];
+} wireless_ota_headers_t;
+
+static bool wireless_ota_confirmed = false;
+
+static esp_err_t wireless_ota_http_event(esp_http_client_event_t *event) {
+  wireless_ota_headers_t *headers = event->user_data;
+  if (event->event_id == HTTP_EVENT_ON_HEADER &&
+      strcasecmp(event->header_key, "ETag") == 0) {
+    strlcpy(headers->etag, event->header_value, sizeof(headers->etag));
+  }
+  return ESP_OK;
+}
+
+static void wireless_ota_etag_load(char *etag, size_t size) {
+  etag[0] = '\0';
+  nvs_handle_t handle;
+  if (nvs_open(WIRELESS_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+    return;
+  }
+  if (nvs_get_str(handle, "ota_etag", etag, &size) != ESP_OK) {
+    etag[0] = '\0';
+  }
+  nvs_close(handle);
+}
+
+static void wireless_ota_etag_store(const char *etag) {
+  nvs_handle_t handle;
+  esp_err_t ret = nvs_open(WIRELESS_NVS_NAMESPACE, NVS_READWRITE, &handle);
+  if (ret == ESP_OK) {
+    ret = nvs_set_str(handle, "ota_etag", etag);
+    if (ret == ESP_OK) {
+      ret = nvs_commit(handle);
+    }
+    nvs_close(handle);
+  }
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "Couldn't store the image's ETag: %s", esp_err_to_name(ret));
+  }
+}
+
+// Skips the image we run, and one that was already rolled back
+static esp_err_t wireless_ota_check(const esp_app_desc_t *update) {
+  const esp_app_desc_t *running = esp_app_get_description();
+  if (memcmp(update->app_elf_sha256, running->app_elf_sha256,
+             sizeof(running->app_elf_sha256)) == 0) {
+    ESP_LOGI(TAG, "Already running version %s", running->version);
+    return ESP_ERR_INVALID_VERSION;
+  }
+  const esp_partition_t *invalid = esp_ota_get_last_invalid_partition();
+  esp_app_desc_t rolled_back;
+  if (invalid != NULL &&
+      esp_ota_get_partition_description(invalid, &rolled_back) == ESP_OK &&
+      memcmp(update->app_elf_sha256, rolled_back.app_elf_sha256,
+             sizeof(rolled_back.app_elf_sha256)) == 0) {
+    ESP_LOGW(TAG, "Version %s was rolled back before, skipping it",
+             update->version);
+    return ESP_ERR_INVALID_VERSION;
+  }
+  ESP_LOGI(TAG, "Updating from version %s to %s", running->version,
+           update->version);
+  return ESP_OK;
+}
+
+// Writes decompressed image bytes, holding back the head until the app
+// description in it is checked. Sequential writes erase sector by sector, so
+// nothing is erased for an image that gets skipped.
+static esp_err_t wireless_ota_sink(wireless_ota_sink_t *sink,
+                                   const uint8_t *data, size_t length) {
+  if (!sink->begun) {
+    const size_t take = (length < WIRELESS_OTA_HEAD_SIZE - sink->head_length)
+                            ? length
+                            : WIRELESS_OTA_HEAD_SIZE - sink->head_length;
+    memcpy(sink->head + sink->head_length, data, take);
+    sink->head_length += take;
+    data += take;
+    length -= take;
+    if (sink->head_length < WIRELESS_OTA_HEAD_SIZE) {
+      return ESP_OK;
+    }
+
+    const esp_image_header_t *header = (const esp_image_header_t *)sink->head;
+    if (header->magic != ESP_IMAGE_HEADER_MAGIC) {
+      ESP_LOGE(TAG, "Not an app image");
+      return ESP_ERR_INVALID_RESPONSE;
+    }
+    sink->skip = wireless_ota_check(
+        (const esp_app_desc_t *)(sink->head + sizeof(esp_image_header_t) +
+                                 sizeof(esp_image_segment_header_t)));
+    if (sink->skip != ESP_OK) {
+      return sink->skip;
+    }
+    esp_err_t ret = esp_ota_begin(sink->partition, OTA_WITH_SEQUENTIAL_WRITES,
+                                  &sink->handle);
+    if (ret != ESP_OK) {
+      return ret;
+    }
+    sink->begun = true;
+    ret = esp_ota_write(sink->handle, sink->head, sink->head_length);
+    if (ret != ESP_OK) {
+      return ret;
+    }
+    sink->written += sink->head_length;
+  }
+  if (length == 0) {
+    return ESP_OK;
+  }
+  sink->written += length;
+  return esp_ota_write(sink->handle, data, length);
+}
+
+// Inflates a piece of zlib stream into the sink, the Adler-32 is checked at
+// its end
+static esp_err_t wireless_ota_inflate(wireless_ota_inflate_t *inflate,
+                                      wireless_ota_sink_t *sink,
+                                      const uint8_t *data, size_t length,
+                                      bool done, bool *finished) {
+  while (1) {
+    size_t in_size = length;
+    size_t out_size = TINFL_LZ_DICT_SIZE - inflate->window_at;
+    const tinfl_status status = tinfl_decompress(
+        &inflate->inflator, data, &in_size, inflate->window,
+        inflate->window + inflate->window_at, &out_size,
+        TINFL_FLAG_PARSE_ZLIB_HEADER | TINFL_FLAG_COMPUTE_ADLER32 |
+            (done ? 0 : TINFL_FLAG_HAS_MORE_INPUT));
+    data += in_size;
+    length -= in_size;
+    if (out_size > 0) {
+      const esp_err_t ret = wireless_ota_sink(
+          sink, inflate->window + inflate->window_at, out_size);
+      if (ret != ESP_OK) {
+        return ret;
+      }
+      inflate->window_at = (inflate->window_at + out_size) &
+                           (TINFL_LZ_DICT_SIZE - 1);
+    }
+    if (status < TINFL_STATUS_DONE) {
+      ESP_LOGE(TAG, "Compressed image is corrupt (%d)", status);
+      return ESP_ERR_INVALID_CRC;
+    }
+    if (status == TINFL_STATUS_DONE) {
+      *finished = true;
+      return ESP_OK;
+    }
+    if (status == TINFL_STATUS_NEEDS_MORE_INPUT && length == 0) {
+      if (done) {
+        ESP_LOGE(TAG, "Compressed image is truncated");
+        return ESP_ERR_INVALID_SIZE;
+      }
+      return ESP_OK;
+    }
+  }
+}
+
+// Streams the body into the sink, inflating it if it is zlib compressed
+static esp_err_t wireless_ota_stream(esp_http_client_handle_t client,
+                                     wireless_ota_sink_t *sink) {
+  uint8_t chunk[WIRELESS_OTA_CHUNK_SIZE];
+  wireless_ota_inflate_t *inflate = NULL;
+  bool compressed = false;
+  bool finished = false;
+  esp_err_t ret = ESP_OK;
+  while (ret == ESP_OK && !finished) {
+    const int length =
+        esp_http_client_read(client, (char *)chunk, sizeof(chunk));
+    if (length < 0) {
+      ret = ESP_ERR_HTTP_FETCH_HEADER;
+      break;
+    }
+    const bool done = length == 0 || esp_http_client_is_complete_data_received(
+                                         client);
+    if (sink->received == 0 && length > 0) {
+      compressed = chunk[0] == WIRELESS_OTA_ZLIB_CMF;
+      if (compressed) {
+        inflate = malloc(sizeof(wireless_ota_inflate_t));
+        if (inflate == NULL) {
+          ret = ESP_ERR_NO_MEM;
+          break;
+        }
+        tinfl_init(&inflate->inflator);
+        inflate->window_at = 0;
+      }
+    }
+    sink->received += length;
+    if (compressed) {
+      ret = wireless_ota_inflate(inflate, sink, chunk, length, done,
+                                 &finished);
+    } else {
+      ret = wireless_ota_sink(sink, chunk, length);
+      finished = done;
+    }
+  }
+  free(inflate);
+  if (ret == ESP_OK && !sink->begun) {
+    ESP_LOGE(TAG, "Image is too short");
+    ret = ESP_ERR_INVALID_SIZE;
+  }
+  return ret;
+}
+// ============================================================================
+esp_err_t wireless_ota_fetch(wireless_t *pointer, const char *url) {
+  wireless_ota_sink_t sink = {
+      .partition = esp_ota_get_next_update_partition(NULL),
+      .begun = false,
+      .head_length = 0,
+      .written = 0,
+      .received = 0,
+      .skip = ESP_OK,
+  };
+  if (sink.partition == NULL) {
+    ESP_LOGE(TAG, "No OTA partition, flash partitions_ota.csv");
+    return ESP_ERR_NOT_FOUND;
+  }
+
+  wireless_ota_headers_t headers = {.etag = ""};
+  const esp_http_client_config_t config = {
+      .url = url,
+      .crt_bundle_attach = esp_crt_bundle_attach,
+      .event_handler = wireless_ota_http_event,
+      .user_data = &headers,
+      .keep_alive_enable = true,
+  };
+  esp_http_client_handle_t client = esp_http_client_init(&config);
+  if (client == NULL) {
+    return ESP_FAIL;
+  }
+  // The server answers 304 without a body when the image didn't change
+  char etag[WIRELESS_OTA_ETAG_SIZE];
+  wireless_ota_etag_load(etag, sizeof(etag));
+  if (etag[0] != '\0') {
+    esp_http_client_set_header(client, "If-None-Match", etag);
+  }
+
+  const int64_t start_us = esp_timer_get_time();
+  esp_err_t ret = esp_http_client_open(client, 0);
+  if (ret == ESP_OK && esp_http_client_fetch_headers(client) < 0) {
+    ret = ESP_ERR_HTTP_FETCH_HEADER;
+  }
+  if (ret == ESP_OK) {
+    const int status = esp_http_client_get_status_code(client);
+    if (status == 304) {
+      ESP_LOGI(TAG, "Image unchanged");
+      ret = ESP_ERR_INVALID_VERSION;
+    } else if (status != 200) {
+      ESP_LOGW(TAG, "Server answered %d", status);
+      ret = ESP_ERR_INVALID_RESPONSE;
+    } else {
+      ret = wireless_ota_stream(client, &sink);
+    }
+  }
+  esp_http_client_close(client);
+  esp_http_client_cleanup(client);
+
+  if (sink.begun) {
+    if (ret == ESP_OK) {
+      // Checks the image hash, and its signature when signing is on
+      ret = esp_ota_end(sink.handle);
+    } else {
+      esp_ota_abort(sink.handle);
+    }
+  }
+  if (ret == ESP_OK) {
+    ret = esp_ota_set_boot_partition(sink.partition);
+  }
+  // An image not worth writing is remembered too, so it isn't fetched again
+  if ((ret == ESP_OK || sink.skip != ESP_OK) && headers.etag[0] != '\0') {
+    wireless_ota_etag_store(headers.etag);
+  }
+
+  const int64_t elapsed_ms = (esp_timer_get_time() - start_us) / 1000;
+  if (ret == ESP_OK) {
+    atomic_fetch_or(&pointer->status, WIRELESS_STATUS_BINARY_FETCHED_OTA);
+    ESP_LOGI(TAG,
+             "Fetched %zu byte image in %zu bytes (%zu%%) to %s in %" PRId64
+             " ms",
+             sink.written, sink.received,
+             sink.received * 100 / (sink.written > 0 ? sink.written : 1),
+             sink.partition->label, elapsed_ms);
+  } else if (ret != ESP_ERR_INVALID_VERSION) {
+    ESP_LOGW(TAG, "Update failed after %" PRId64 " ms: %s", elapsed_ms,
+             esp_err_to_name(ret));
+  }
+  return ret;
+}
+
+void wireless_ota_confirm(bool works) {
+  if (wireless_ota_confirmed) {
+    return;
+  }
+  esp_ota_img_states_t state;
+  if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) !=
+          ESP_OK ||
+      state != ESP_OTA_IMG_PENDING_VERIFY) {
+    wireless_ota_confirmed = true;
+    return;
+  }
+  if (works) {
+    ESP_LOGI(TAG, "New image works, keeping it");
+    esp_ota_mark_app_valid_cancel_rollback();
+    wireless_ota_confirmed = true;
+  } else {
+    ESP_LOGE(TAG, "New image doesn't work, rolling back");
+    esp_ota_mark_app_invalid_rollback_and_reboot();
+  }
+}
+
+void wireless_ota_task(void *user_data) {
+  wireless_t *pointer = user_data;
+#ifndef CONFIG_SECURE_SIGNED_ON_UPDATE
+  ESP_LOGW(TAG, "Images aren't signature checked, see SECURE_SIGNED_ON_UPDATE");
+#endif
+
+  // A new image has this long to reach the broker on its first boot
+  esp_ota_img_states_t state;
+  if (esp_ota_get_state_partition(esp_ota_get_running_partition(), &state) ==
+          ESP_OK &&
+      state == ESP_OTA_IMG_PENDING_VERIFY) {
+    const int64_t verify_us = esp_timer_get_time() +
+                              (int64_t)(CONFIG_WIRELESS_OTA_VERIFY_S)*1000000;
+    while (!wireless_ota_confirmed && esp_timer_get_time() < verify_us) {
+      vTaskDelay(1000 / portTICK_PERIOD_MS);
+    }
+    wireless_ota_confirm(false);
+  }
+
+  while (1) {
+    xEventGroupWaitBits(pointer->events, WIRELESS_CONNECTED_BIT, pdFALSE,
+                        pdTRUE, portMAX_DELAY);
+    if (wireless_ota_fetch(pointer, CONFIG_WIRELESS_OTA_URL) == ESP_OK) {
+      ESP_LOGI(TAG, "Restarting into the new image");
+      vTaskDelay(1000 / portTICK_PERIOD_MS);
+      esp_restart();
+    }
+    vTaskDelay(pdMS_TO_TICKS((uint64_t)(CONFIG_WIRELESS_OTA_INTERVAL_S) *
+                             1000));
+  }
+}
+#endif
@@ -0,0 +1,55 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "iic_mux.h"
+#include "sdkconfig.h"
+#include "weather_task_gps_time.h"
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef CONFIG_WEATHER_DIAGNOSTICS
+// Room for the system's tasks and ours, with some to spare
+#define WEATHER_DIAGNOSTICS_TASKS_MAX 24
+
+// A task's run time when it was last seen
+typedef struct {
+  UBaseType_t number;
+  configRUN_TIME_COUNTER_TYPE run_time;
+} weather_diagnostics_task_t;
+
+typedef struct {
+  int64_t since_us;
+  // Counters at the last report, CPU use is reported since then
+  configRUN_TIME_COUNTER_TYPE total_run_time;
+  weather_diagnostics_task_t tasks[WEATHER_DIAGNOSTICS_TASKS_MAX];
+  uint32_t task_count;
+  TaskStatus_t status[WEATHER_DIAGNOSTICS_TASKS_MAX];
+} weather_diagnostics_t;
+
+// Static fill of weather_diagnostics_t structs, the first report starts here
+void weather_diagnostics_fill(weather_diagnostics_t *);
+
+// Encodes a JSON report, its length or 0 if it doesn't fit:
+//   {"uptime_s":..,"heap":{"free":..,"min":..,"largest":..},
+//    "tasks":{"<name>":[CPU %, free stack bytes],..},
+//    "i2c":{"<device>":[errors, retries, overruns],..},
+//    "uart":{"lines":..,"dropped":..,"oversized":..,"ubx_errors":..}}
+size_t weather_diagnostics_encode(weather_diagnostics_t *, const iic_mux_t *,
+                                  const weather_task_gps_time_t *,
+                                  char *buffer, size_t size);
+#endif
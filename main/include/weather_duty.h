@@ -0,0 +1,67 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#pragma once
+#include "gps_time.h"
+#include "sample_ring.h"
+#include "sdkconfig.h"
+#include <stdbool.h>
+#include <stdint.h>
+
+#ifdef CONFIG_WEATHER_DUTY_CYCLE
+// One sample per sensor per wake, kept for every wake between publishes
+#define WEATHER_DUTY_QUEUE_SIZE (CONFIG_WEATHER_DUTY_PUBLISH_EVERY * 2)
+_Static_assert(WEATHER_DUTY_QUEUE_SIZE + 2 <= CONFIG_SAMPLE_RING_CAPACITY,
+               "The ring must hold the queued samples and a wake's own");
+
+// Kept in RTC memory across deep sleep, zeroed on power up and resets
+typedef struct {
+  // Timer wakes so far, the first boot included, and rain gauge wakes
+  uint32_t cycles;
+  uint32_t rain_wakes;
+  // When the last sleep started by the system clock and how long it was
+  // meant to last, rain gauge wakes sleep out the rest
+  int64_t sleep_since_us;
+  int64_t sleep_us;
+  // Samples waiting for a publishing wake, oldest first
+  sample_ring_record_t queue[WEATHER_DUTY_QUEUE_SIZE];
+  uint32_t queued;
+  uint32_t queue_dropped;
+#ifdef CONFIG_GPS_TIME_SYNC
+  gps_time_clock_t clock;
+#endif
+  uint32_t rain_tips;
+  // Awake time of the last cycle, and of every cycle so far
+  uint32_t awake_ms;
+  uint64_t awake_total_ms;
+} weather_duty_t;
+
+weather_duty_t *weather_duty_state(void);
+
+// Starts a cycle, or counts a rain gauge tip and sleeps again
+void weather_duty_wake(weather_duty_t *);
+bool weather_duty_publishing(const weather_duty_t *);
+#ifdef CONFIG_GPS_TIME_SYNC
+bool weather_duty_syncing(const weather_duty_t *);
+#endif
+
+// Moves the queued samples into the ring, ahead of this wake's
+void weather_duty_unqueue(weather_duty_t *, sample_ring_t *);
+// Queues a sample for the next publishing wake, dropping the oldest if full
+void weather_duty_keep(weather_duty_t *, const sample_ring_record_t *);
+
+// Logs the awake time and sleeps until the next cycle
+void weather_duty_sleep(weather_duty_t *) __attribute__((noreturn));
+#endif
@@ -21,11 +21,19 @@
 #include "sdkconfig.h"
 
 #define WEATHER_TASK_GPS_TIME_UART 2
+#define WEATHER_TASK_GPS_TIME_RX_SIZE 1024
+#define WEATHER_TASK_GPS_TIME_QUEUE_SIZE 20
+#define WEATHER_TASK_GPS_TIME_LINE_SIZE 128
 
 typedef struct {
   gps_time_t data;
   uart_config_t uart_config;
-  char uart_buffer[512];
+  QueueHandle_t uart_queue;
+  char uart_buffer[WEATHER_TASK_GPS_TIME_LINE_SIZE];
+
+  uint32_t lines_read;
+  uint32_t lines_dropped;
+  uint32_t lines_oversized;
 } weather_task_gps_time_t;
 
 void weather_task_gps_time_config(weather_task_gps_time_t *);
@@ -14,22 +14,137 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 #pragma once
-#include "cJSON.h"
 #include "driver/uart.h"
 #include "freertos/FreeRTOS.h"
+#include "freertos/event_groups.h"
 #include "freertos/idf_additions.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
 #include "freertos/task.h"
+#include "freertos/timers.h"
 #include "iic_mux.h"
 #include "mqtt_client.h"
+#include "net_supervisor.h"
+#include "payload.h"
+#include "sample_log.h"
+#include "sample_ring.h"
+#include "sample_stats.h"
 #include "sdkconfig.h"
+#include "weather_diagnostics.h"
+#include "weather_meters.h"
+#include "weather_task_gps_time.h"
 #include "wireless.h"
 
 #include <sys/time.h>
 
+// Set while the MQTT client is connected to the broker
+#define WEATHER_TASK_NET_MQTT_CONNECTED_BIT BIT0
+// Set with each QoS 1 acknowledgement, replays wait for their own
+#define WEATHER_TASK_NET_MQTT_ACKED_BIT BIT1
+// How long a replayed message may wait for its acknowledgement
+#define WEATHER_TASK_NET_ACK_TIMEOUT_MS 10000
+
+#define WEATHER_TASK_NET_EVENT_QUEUE_SIZE 8
+
+// Roughly what samples with every channel take in a batch
+#define WEATHER_TASK_NET_BATCH_BYTES(samples) ((samples) * 192 + 128)
+#ifdef CONFIG_WEATHER_PUBLISH_BATCH
+#define WEATHER_TASK_NET_BATCH_POLL_MS 1000
+#define WEATHER_TASK_NET_LIVE_SIZE                                             \
+  WEATHER_TASK_NET_BATCH_BYTES(CONFIG_WEATHER_BATCH_SIZE)
+#else
+#define WEATHER_TASK_NET_LIVE_SIZE 1024
+#endif
+#if defined(CONFIG_SAMPLE_LOG) &&                                              \
+    WEATHER_TASK_NET_BATCH_BYTES(CONFIG_WEATHER_REPLAY_BATCH) >                \
+        WEATHER_TASK_NET_LIVE_SIZE
+#define WEATHER_TASK_NET_PAYLOAD_SIZE                                          \
+  WEATHER_TASK_NET_BATCH_BYTES(CONFIG_WEATHER_REPLAY_BATCH)
+#else
+#define WEATHER_TASK_NET_PAYLOAD_SIZE WEATHER_TASK_NET_LIVE_SIZE
+#endif
+
+// What the Wi-Fi and MQTT event handlers tell the supervisor task
+typedef struct {
+  net_supervisor_event_t event;
+  uint32_t address;
+} weather_task_net_event_t;
+
+// MQTT traffic since the start of the hour, logged and reset hourly
+typedef struct {
+  int64_t since_us;
+  uint32_t samples;
+  uint32_t publishes;
+  uint32_t bytes;
+  uint32_t failures;
+  // Of the samples, how many came from the backlog
+  uint32_t replayed;
+} weather_task_net_traffic_t;
+
 typedef struct {
   wireless_t *wifi;
   iic_mux_t *i2c;
-  char json_cache[512];
+  weather_meters_t *meters;
+  // Only read, for its UART counters
+  const weather_task_gps_time_t *gps_time;
+  // Filled by the sampler, drained here
+  sample_ring_t *ring;
+#ifdef CONFIG_WEATHER_PUBLISH_BATCH
+  // Samples drained but not yet published, and when the first was drained
+  sample_ring_record_t batch[CONFIG_WEATHER_BATCH_SIZE];
+  uint32_t batch_count;
+  int64_t batch_since_us;
+#else
+  // Summary of the report window being published
+  sample_stats_t stats;
+#ifdef CONFIG_WEATHER_DUTY_CYCLE
+  // The window's samples, kept in RTC memory if its summary doesn't get out
+  sample_ring_record_t window[CONFIG_SAMPLE_RING_CAPACITY];
+  uint32_t window_count;
+#endif
+#endif
+#ifdef CONFIG_SAMPLE_LOG
+  // Samples kept while the broker is away, and the replay in progress
+  sample_log_t *log;
+  sample_ring_record_t replay[CONFIG_WEATHER_REPLAY_BATCH];
+  int64_t replay_since_us;
+  uint32_t replay_samples;
+  // Id of the last message the broker acknowledged
+  _Atomic int acked_msg_id;
+#endif
+  // MQTT connection state, driven by the client's events
+  EventGroupHandle_t mqtt_events;
+  // Wi-Fi and MQTT lifecycles, owned by the supervisor task, which gets its
+  // events through the queue. The lock covers the counters, which the
+  // health report reads from another task
+  esp_mqtt_client_handle_t client;
+  net_supervisor_t supervisor;
+  SemaphoreHandle_t supervisor_lock;
+  QueueHandle_t supervisor_events;
+  // Connections made, and since when samples wait for a first publish after
+  // boot or losing the broker, -1 once they are flowing
+  uint32_t connections;
+  _Atomic int64_t waiting_since_us;
+  weather_task_net_traffic_t traffic;
+#ifdef CONFIG_WEATHER_DIAGNOSTICS
+  weather_diagnostics_t diagnostics;
+#endif
+  // JSON text or CBOR, whichever payload encoding is configured
+  char payload_cache[WEATHER_TASK_NET_PAYLOAD_SIZE];
 } weather_task_net_t;
 
+// Static fill of the publishing state, the handles are set by the caller
+void weather_task_net_fill(weather_task_net_t *);
+
+// Publishes samples while the broker is there
 void weather_task_net_task(void *);
+
+// Keeps Wi-Fi and the broker connected, forever
+void weather_task_net_supervisor(void *);
+
+#ifdef CONFIG_WEATHER_DUTY_CYCLE
+// Connects, publishes what the ring holds and waits for the broker to
+// acknowledge it, giving up at the deadline. Returns whether everything got
+// out, otherwise samples are left in the ring, the batch or the sample log.
+bool weather_task_net_once(weather_task_net_t *, int64_t deadline_us);
+#endif
@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "weather_diagnostics.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+
+#ifdef CONFIG_WEATHER_DIAGNOSTICS
+static const char *TAG = "diagnostics";
+
+typedef struct {
+  char *data;
+  size_t size;
+  size_t length;
+  bool full;
+} weather_diagnostics_buffer_t;
+
+// Appends to the buffer, marking it full once something doesn't fit
+__attribute__((format(printf, 2, 3))) static void
+weather_diagnostics_append(weather_diagnostics_buffer_t *buffer,
+                           const char *format, ...) {
+  if (buffer->full) {
+    return;
+  }
+  va_list arguments;
+  va_start(arguments, format);
+  const int length = vsnprintf(buffer->data + buffer->length,
+                               buffer->size - buffer->length, format,
+                               arguments);
+  va_end(arguments);
+  if (length < 0 || (size_t)(length) >= buffer->size - buffer->length) {
+    buffer->full = true;
+    return;
+  }
+  buffer->length += length;
+}
+
+static configRUN_TIME_COUNTER_TYPE
+weather_diagnostics_previous(const weather_diagnostics_t *pointer,
+                             const TaskStatus_t *status) {
+  // Task numbers aren't reused, unlike the handles of deleted tasks
+  for (uint32_t i = 0; i < pointer->task_count; i++) {
+    if (pointer->tasks[i].number == status->xTaskNumber) {
+      return pointer->tasks[i].run_time;
+    }
+  }
+  return 0;
+}
+
+// Every task's CPU use since the last report and its stack high-water mark,
+// then remembers the run times for the next one
+static void weather_diagnostics_tasks(weather_diagnostics_t *pointer,
+                                      weather_diagnostics_buffer_t *buffer) {
+  configRUN_TIME_COUNTER_TYPE total_run_time;
+  const UBaseType_t count = uxTaskGetSystemState(
+      pointer->status, WEATHER_DIAGNOSTICS_TASKS_MAX, &total_run_time);
+  if (count == 0) {
+    ESP_LOGW(TAG, "More than %d tasks, not reporting them",
+             WEATHER_DIAGNOSTICS_TASKS_MAX);
+    pointer->task_count = 0;
+    return;
+  }
+  // Run times add up across cores, the total doesn't
+  const configRUN_TIME_COUNTER_TYPE total_elapsed =
+      total_run_time - pointer->total_run_time;
+  const uint64_t elapsed =
+      (uint64_t)(total_elapsed) * CONFIG_FREERTOS_NUMBER_OF_CORES;
+
+  weather_diagnostics_append(buffer, ",\"tasks\":{");
+  for (UBaseType_t i = 0; i < count; i++) {
+    const TaskStatus_t *status = &pointer->status[i];
+    // Unsigned, so a counter that wrapped once since is still right
+    const configRUN_TIME_COUNTER_TYPE run_time =
+        status->ulRunTimeCounter -
+        weather_diagnostics_previous(pointer, status);
+    const uint32_t permille =
+        (elapsed > 0) ? (uint32_t)((uint64_t)(run_time) * 1000 / elapsed) : 0;
+    weather_diagnostics_append(buffer,
+                               "%s\"%s\":[%" PRIu32 ".%" PRIu32 ",%" PRIu32 "]",
+                               (i > 0) ? "," : "", status->pcTaskName,
+                               permille / 10, permille % 10,
+                               (uint32_t)(status->usStackHighWaterMark));
+  }
+  weather_diagnostics_append(buffer, "}");
+
+  for (UBaseType_t i = 0; i < count; i++) {
+    pointer->tasks[i] = (weather_diagnostics_task_t){
+        .number = pointer->status[i].xTaskNumber,
+        .run_time = pointer->status[i].ulRunTimeCounter,
+    };
+  }
+  pointer->task_count = count;
+  pointer->total_run_time = total_run_time;
+}
+// ============================================================================
+void weather_diagnostics_fill(weather_diagnostics_t *pointer) {
+  pointer->since_us = esp_timer_get_time();
+  pointer->total_run_time = 0;
+  pointer->task_count = 0;
+  // Only to take the run times as a baseline
+  char scratch[1];
+  weather_diagnostics_buffer_t buffer = {
+      .data = scratch, .size = sizeof(scratch), .length = 0, .full = true};
+  weather_diagnostics_tasks(pointer, &buffer);
+}
+
+size_t weather_diagnostics_encode(weather_diagnostics_t *pointer,
+                                  const iic_mux_t *i2c,
+                                  const weather_task_gps_time_t *gps_time,
+                                  char *data, size_t size) {
+  pointer->since_us = esp_timer_get_time();
+  weather_diagnostics_buffer_t buffer = {
+      .data = data, .size = size, .length = 0, .full = false};
+
+  weather_diagnostics_append(
+      &buffer,
+      "{\"uptime_s\":%" PRId64 ",\"heap\":{\"free\":%zu,\"min\":%zu"
+      ",\"largest\":%zu}",
+      pointer->since_us / 1000000, heap_caps_get_free_size(MALLOC_CAP_8BIT),
+      heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT),
+      heap_caps_get_largest_free_block(MALLOC_CAP_8BIT));
+  weather_diagnostics_tasks(pointer, &buffer);
+
+  if (i2c != NULL) {
+    weather_diagnostics_append(&buffer, ",\"i2c\":{");
+    for (uint32_t i = 0; i < i2c->device_count; i++) {
+      const iic_mux_device_t *device = i2c->devices[i];
+      weather_diagnostics_append(
+          &buffer, "%s\"%s\":[%" PRIu32 ",%" PRIu32 ",%" PRIu32 "]",
+          (i > 0) ? "," : "", device->driver->name, device->errors,
+          device->retries, device->overruns);
+    }
+    weather_diagnostics_append(&buffer, "}");
+  }
+  if (gps_time != NULL) {
+    weather_diagnostics_append(
+        &buffer,
+        ",\"uart\":{\"lines\":%" PRIu32 ",\"dropped\":%" PRIu32
+        ",\"oversized\":%" PRIu32 ",\"ubx_errors\":%" PRIu32 "}",
+        gps_time->lines_read, gps_time->lines_dropped,
+        gps_time->lines_oversized, gps_time->data.ubx.errors);
+  }
+  weather_diagnostics_append(&buffer, "}");
+  return buffer.full ? 0 : buffer.length;
+}
+#endif
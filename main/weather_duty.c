@@ -0,0 +1,141 @@
+/*
+ * Copyright (c) 2023-2026 Roland Metivier <metivier.roland@chlorophyt.us>
+ *
+ * Permission to use, copy, modify, and distribute this software for any
+ * purpose with or without fee is hereby granted, provided that the above
+ * copyright notice and this permission notice appear in all copies.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS" AND THE AUTHOR DISCLAIMS ALL WARRANTIES
+ * WITH REGARD TO THIS SOFTWARE INCLUDING ALL IMPLIED WARRANTIES OF
+ * MERCHANTABILITY AND FITNESS. IN NO EVENT SHALL THE AUTHOR BE LIABLE FOR
+ * ANY SPECIAL, DIRECT, INDIRECT, OR CONSEQUENTIAL DAMAGES OR ANY DAMAGES
+ * WHATSOEVER RESULTING FROM LOSS OF USE, DATA OR PROFITS, WHETHER IN AN
+ * ACTION OF CONTRACT, NEGLIGENCE OR OTHER TORTIOUS ACTION, ARISING OUT OF
+ * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
+ */
+#include "weather_duty.h"
+#include "driver/gpio.h"
+#include "driver/rtc_io.h"
+#include "esp_attr.h"
+#include "esp_log.h"
+#include "esp_sleep.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include <inttypes.h>
+#include <string.h>
+#include <sys/time.h>
+
+#ifdef CONFIG_WEATHER_DUTY_CYCLE
+static const char *TAG = "duty";
+
+static RTC_DATA_ATTR weather_duty_t weather_duty;
+
+// The system clock keeps running through deep sleep, esp_timer doesn't
+static int64_t weather_duty_now_us(void) {
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  return (int64_t)(time.tv_sec) * 1000000 + time.tv_usec;
+}
+
+__attribute__((noreturn)) static void
+weather_duty_deep_sleep(weather_duty_t *pointer, int64_t sleep_us) {
+  pointer->sleep_since_us = weather_duty_now_us();
+  pointer->sleep_us = sleep_us;
+  ESP_ERROR_CHECK(esp_sleep_enable_timer_wakeup(sleep_us));
+#ifdef CONFIG_WEATHER_METERS
+  // The gauge's reed switch pulls the pin low for each tip. A bucket resting
+  // on the switch would wake the station straight away, so it only waits for
+  // the timer then.
+  const gpio_num_t rain = CONFIG_WEATHER_METERS_RAIN_GPIO;
+  if (gpio_get_level(rain) == 1) {
+    ESP_ERROR_CHECK(esp_sleep_enable_ext0_wakeup(rain, 0));
+    ESP_ERROR_CHECK(rtc_gpio_pulldown_dis(rain));
+    ESP_ERROR_CHECK(rtc_gpio_pullup_en(rain));
+  } else {
+    ESP_LOGW(TAG, "Rain gauge switch closed, not waking for tips");
+  }
+#endif
+  esp_deep_sleep_start();
+}
+
+weather_duty_t *weather_duty_state(void) { return &weather_duty; }
+
+void weather_duty_wake(weather_duty_t *pointer) {
+#ifdef CONFIG_WEATHER_METERS
+  const gpio_num_t rain = CONFIG_WEATHER_METERS_RAIN_GPIO;
+  // Handed back from the RTC domain so the counter can read it
+  rtc_gpio_deinit(rain);
+  gpio_set_direction(rain, GPIO_MODE_INPUT);
+  gpio_pullup_en(rain);
+  if (esp_sleep_get_wakeup_cause() == ESP_SLEEP_WAKEUP_EXT0) {
+    (pointer->rain_tips)++;
+    (pointer->rain_wakes)++;
+    // Lets the switch open and stop bouncing before sleeping again
+    for (int i = 0; i < 50 && gpio_get_level(rain) == 0; i++) {
+      vTaskDelay(10 / portTICK_PERIOD_MS);
+    }
+    vTaskDelay(20 / portTICK_PERIOD_MS);
+    const int64_t left_us = pointer->sleep_us - (weather_duty_now_us() -
+                                                 pointer->sleep_since_us);
+    if (left_us > 100000) {
+      weather_duty_deep_sleep(pointer, left_us);
+    }
+    // Close enough to the next cycle to start it now
+  }
+#endif
+  (pointer->cycles)++;
+  ESP_LOGI(TAG,
+           "Wake %" PRIu32 ", %" PRIu32 " samples queued, %" PRIu32
+           " rain gauge wakes so far",
+           pointer->cycles, pointer->queued, pointer->rain_wakes);
+}
+
+bool weather_duty_publishing(const weather_duty_t *pointer) {
+  return (pointer->cycles - 1) % CONFIG_WEATHER_DUTY_PUBLISH_EVERY == 0;
+}
+
+#ifdef CONFIG_GPS_TIME_SYNC
+bool weather_duty_syncing(const weather_duty_t *pointer) {
+  return (pointer->cycles - 1) % CONFIG_WEATHER_DUTY_GPS_EVERY == 0;
+}
+#endif
+
+void weather_duty_unqueue(weather_duty_t *pointer, sample_ring_t *ring) {
+  for (uint32_t i = 0; i < pointer->queued; i++) {
+    sample_ring_push(ring, &pointer->queue[i]);
+  }
+  pointer->queued = 0;
+}
+
+void weather_duty_keep(weather_duty_t *pointer,
+                       const sample_ring_record_t *record) {
+  if (pointer->queued == WEATHER_DUTY_QUEUE_SIZE) {
+    memmove(&pointer->queue[0], &pointer->queue[1],
+            (WEATHER_DUTY_QUEUE_SIZE - 1) * sizeof(sample_ring_record_t));
+    (pointer->queued)--;
+    (pointer->queue_dropped)++;
+  }
+  pointer->queue[pointer->queued] = *record;
+  (pointer->queued)++;
+}
+
+void weather_duty_sleep(weather_duty_t *pointer) {
+  // esp_timer started at this wake, the bootloader's share isn't counted
+  const int64_t awake_us = esp_timer_get_time();
+  pointer->awake_ms = (uint32_t)(awake_us / 1000);
+  pointer->awake_total_ms += pointer->awake_ms;
+  ESP_LOGI(TAG,
+           "Awake %" PRIu32 " ms, %" PRIu64 " ms on average over %" PRIu32
+           " cycles, %" PRIu32 " queued samples dropped",
+           pointer->awake_ms, pointer->awake_total_ms / pointer->cycles,
+           pointer->cycles, pointer->queue_dropped);
+
+  int64_t sleep_us = (int64_t)(CONFIG_WEATHER_DUTY_PERIOD_S) * 1000000 -
+                     awake_us;
+  if (sleep_us < 1000000) {
+    sleep_us = 1000000;
+  }
+  weather_duty_deep_sleep(pointer, sleep_us);
+}
+#endif
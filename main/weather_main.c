@@ -15,19 +15,223 @@
  */
 #include "esp_event.h"
 #include "freertos/idf_additions.h"
+#include "esp_timer.h"
+#include "esp_wifi.h"
+#include "freertos/timers.h"
 #include "iic_mux.h"
+#include "iic_mux_bme280.h"
 #include "nvs_flash.h"
 #include "portmacro.h"
+#include "sample_log.h"
+#include "sample_ring.h"
+#include "weather_duty.h"
+#include "weather_meters.h"
 #include "weather_task_gps_time.h"
 #include "weather_task_net.h"
 #include <inttypes.h>
 #include <stdio.h>
+#include <sys/time.h>
 
 static const char *TAG = "main";
 
-#define TASK_STACK_SIZE 2048
+// Stack sizes in bytes, weather/diagnostics reports how much each leaves unused
+#define WEATHER_MAIN_GPS_TIME_STACK_SIZE 5000
+#define WEATHER_MAIN_SUPERVISOR_STACK_SIZE 4096
+#define WEATHER_MAIN_NET_STACK_SIZE 10000
+#define WEATHER_MAIN_OTA_STACK_SIZE 8192
+
+// Completes a sensor sample and hands it to the net task through the ring
+static void weather_main_sampled(iic_mux_device_t *device, esp_err_t ret,
+                                 void *user_data) {
+  sample_ring_t *ring = user_data;
+  if (ret != ESP_OK) {
+    ESP_LOGW(TAG, "%s sample failed (%" PRIu32 " errors, %" PRIu32
+                  " retries so far)",
+             device->driver->name, device->errors, device->retries);
+    return;
+  }
+  sample_ring_push(ring, &device->record);
+}
+
+#ifdef CONFIG_WEATHER_METERS
+static void weather_main_meters_push(weather_task_net_t *net) {
+  weather_meters_report_t report;
+  weather_meters_report(net->meters, &report);
+
+  struct timeval time;
+  gettimeofday(&time, NULL);
+  sample_ring_record_t record = {
+      .timestamp_us = (int64_t)(time.tv_sec) * 1000000 + time.tv_usec,
+      .mask = SAMPLE_RING_MASK(SAMPLE_RING_WIND_SPEED) |
+              SAMPLE_RING_MASK(SAMPLE_RING_WIND_GUST) |
+              SAMPLE_RING_MASK(SAMPLE_RING_RAIN),
+      .value[SAMPLE_RING_WIND_SPEED] = (int32_t)(report.wind_speed),
+      .value[SAMPLE_RING_WIND_GUST] = (int32_t)(report.wind_gust),
+      .value[SAMPLE_RING_RAIN] = (int32_t)(report.rain_um),
+  };
+  if (report.vane_frames > 0) {
+    record.mask |= SAMPLE_RING_MASK(SAMPLE_RING_WIND_DIRECTION);
+    record.value[SAMPLE_RING_WIND_DIRECTION] =
+        (int32_t)(report.wind_direction);
+  }
+  sample_ring_push(net->ring, &record);
+}
+
+// Runs in the timer service task like the iic_mux completions, so the ring
+// keeps a single producer
+static void weather_main_meters(TimerHandle_t timer) {
+  weather_task_net_t *net = pvTimerGetTimerID(timer);
+  if (weather_meters_sample(net->meters)) {
+    weather_main_meters_push(net);
+  }
+}
+#endif
+
+// Ticks from now until an esp_timer deadline, at least one
+static TickType_t weather_main_ticks_until(int64_t deadline_us) {
+  if (deadline_us == INT64_MAX) {
+    return portMAX_DELAY;
+  }
+  const int64_t wait_ms = (deadline_us - esp_timer_get_time() + 999) / 1000;
+  const int64_t ticks = (wait_ms + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+  return (ticks < 1) ? 1 : (TickType_t)ticks;
+}
+
+#ifdef CONFIG_SAMPLE_LOG
+static void weather_main_log(weather_task_net_t *net) {
+  ESP_LOGI(TAG, "Mounting sample log...");
+  sample_log_flash_t flash;
+  ESP_ERROR_CHECK(sample_log_partition(&flash));
+  sample_log_init(&(net->log), &flash);
+  ESP_ERROR_CHECK(sample_log_mount(net->log));
+  ESP_LOGI(TAG, "%" PRIu32 " samples backlogged", net->log->depth);
+}
+#endif
+
+#ifdef CONFIG_WEATHER_DUTY_CYCLE
+static TaskHandle_t weather_main_task;
+
+#ifdef CONFIG_WEATHER_METERS
+// Reports the wind and rain of the burst from the timer service task, then
+// lets the main task go on
+static void weather_main_meters_burst(void *user_data, uint32_t unused) {
+  weather_task_net_t *net = user_data;
+  weather_meters_sample(net->meters);
+  weather_main_meters_push(net);
+  xTaskNotifyGive(weather_main_task);
+}
+#endif
+
+// One wake of the duty cycle: a burst of samples, then a publish or the
+// samples queued in RTC memory, and deep sleep
+__attribute__((noreturn)) static void
+weather_main_duty(weather_duty_t *duty) {
+  weather_main_task = xTaskGetCurrentTaskHandle();
+  const bool publishing = weather_duty_publishing(duty);
+  static weather_task_net_t net;
+
+#ifdef CONFIG_GPS_TIME_SYNC
+  static weather_task_gps_time_t gps_time;
+  const bool syncing = weather_duty_syncing(duty);
+  if (syncing) {
+    ESP_LOGI(TAG, "Dispatching GPS time task...");
+    weather_task_gps_time_config(&gps_time);
+    // Zeroed RTC memory means a first boot, with a clock yet to be filled
+    if (duty->cycles > 1) {
+      gps_time.data.clock = duty->clock;
+      gps_time_clock_resume(&gps_time.data.clock);
+    }
+    xTaskCreate(weather_task_gps_time_task, "gps_time_task",
+                WEATHER_MAIN_GPS_TIME_STACK_SIZE, &gps_time, 10, NULL);
+  }
+#endif
+  if (publishing) {
+    ESP_LOGI(TAG, "Joining wireless network...");
+    wireless_init(&(net.wifi));
+    wireless_start(net.wifi);
+  }
+
+  sample_ring_init(&(net.ring));
+  weather_task_net_fill(&net);
+  if (publishing) {
+#ifdef CONFIG_SAMPLE_LOG
+    weather_main_log(&net);
+#endif
+    weather_duty_unqueue(duty, net.ring);
+  }
+
+  iic_mux_init(&(net.i2c));
+#ifdef CONFIG_I2CMUX_BME280
+  ESP_ERROR_CHECK(iic_mux_register(net.i2c, &iic_mux_bme280_driver));
+#endif
+  iic_mux_start(net.i2c);
+#ifdef CONFIG_WEATHER_METERS
+  weather_meters_init(&(net.meters));
+  net.meters->rain_tips = duty->rain_tips;
+  weather_meters_start(net.meters);
+#endif
+  const int64_t burst_us =
+      esp_timer_get_time() + (int64_t)(CONFIG_WEATHER_DUTY_BURST_MS) * 1000;
+  while (esp_timer_get_time() < burst_us) {
+    int64_t next_us = iic_mux_service(net.i2c, weather_main_sampled, net.ring);
+    vTaskDelay(weather_main_ticks_until(next_us < burst_us ? next_us
+                                                           : burst_us));
+  }
+#ifdef CONFIG_WEATHER_METERS
+  xTimerPendFunctionCall(weather_main_meters_burst, &net, 0, portMAX_DELAY);
+  ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+  duty->rain_tips = net.meters->rain_tips;
+#endif
+
+  if (publishing) {
+    const int64_t deadline_us =
+        esp_timer_get_time() +
+        (int64_t)(CONFIG_WEATHER_DUTY_PUBLISH_TIMEOUT_S) * 1000000;
+    if (!weather_task_net_once(&net, deadline_us)) {
+      ESP_LOGW(TAG, "Broker not reached, samples wait for the next publish");
+    }
+    esp_wifi_stop();
+  }
+  // Whatever didn't get out waits in RTC memory
+#ifdef CONFIG_WEATHER_PUBLISH_BATCH
+  for (uint32_t i = 0; i < net.batch_count; i++) {
+    weather_duty_keep(duty, &net.batch[i]);
+  }
+#else
+  for (uint32_t i = 0; i < net.window_count; i++) {
+    weather_duty_keep(duty, &net.window[i]);
+  }
+#endif
+  sample_ring_record_t record;
+  while (sample_ring_pop(net.ring, &record)) {
+    weather_duty_keep(duty, &record);
+  }
+
+#ifdef CONFIG_GPS_TIME_SYNC
+  if (syncing) {
+    const uint32_t samples = gps_time.data.clock.samples;
+    const int64_t sync_us =
+        (int64_t)(CONFIG_WEATHER_DUTY_GPS_TIMEOUT_S) * 1000000;
+    while (gps_time.data.clock.samples == samples &&
+           esp_timer_get_time() < sync_us) {
+      vTaskDelay(500 / portTICK_PERIOD_MS);
+    }
+    if (gps_time.data.clock.samples == samples) {
+      ESP_LOGW(TAG, "No GPS time this wake");
+    }
+    duty->clock = gps_time.data.clock;
+  }
+#endif
+  weather_duty_sleep(duty);
+}
+#endif
 
 void app_main(void) {
+#ifdef CONFIG_WEATHER_DUTY_CYCLE
+  // Rain gauge wakes go straight back to sleep from here
+  weather_duty_t *duty = weather_duty_state();
+  weather_duty_wake(duty);
+#endif
   ESP_LOGI(TAG, "Initialize Nonvolatile Storage...");
   esp_err_t ret = nvs_flash_init();
   if (ret == ESP_ERR_NVS_NO_FREE_PAGES ||
@@ -39,35 +243,70 @@ void app_main(void) {
 
   ESP_LOGI(TAG, "Creating default event loop...");
   ESP_ERROR_CHECK(esp_event_loop_create_default());
+#ifdef CONFIG_WEATHER_DUTY_CYCLE
+  weather_main_duty(duty);
+#endif
 
   ESP_LOGI(TAG, "Creating GPS Time task...");
   weather_task_gps_time_t gps_time;
   weather_task_gps_time_config(&gps_time);
 
-  weather_task_net_t net;
+  // Too big for the main task's stack with its payload and replay buffers
+  static weather_task_net_t net;
   ESP_LOGI(TAG, "Initializing wireless system...");
   wireless_init(&(net.wifi));
   ESP_LOGI(TAG, "Joining wireless network...");
   wireless_start(net.wifi);
 
+  ESP_LOGI(TAG, "Initializing sample ring...");
+  sample_ring_init(&(net.ring));
+  weather_task_net_fill(&net);
+  net.gps_time = &gps_time;
+#ifdef CONFIG_SAMPLE_LOG
+  weather_main_log(&net);
+#endif
+
   ESP_LOGI(TAG, "Initializing I2C multiplexing system...");
   iic_mux_init(&(net.i2c));
+#ifdef CONFIG_I2CMUX_BME280
+  ESP_ERROR_CHECK(iic_mux_register(net.i2c, &iic_mux_bme280_driver));
+#endif
   ESP_LOGI(TAG, "Probing I2C multiplexing system...");
   iic_mux_start(net.i2c);
 
+#ifdef CONFIG_WEATHER_METERS
+  ESP_LOGI(TAG, "Starting weather meters...");
+  weather_meters_init(&(net.meters));
+  weather_meters_start(net.meters);
+  TimerHandle_t meters_timer =
+      xTimerCreate("meters", pdMS_TO_TICKS(CONFIG_WEATHER_METERS_GUST_MS),
+                   pdTRUE, &net, weather_main_meters);
+  xTimerStart(meters_timer, portMAX_DELAY);
+#endif
+
   ESP_LOGI(TAG, "Dispatching GPS time task...");
-  xTaskCreate(weather_task_gps_time_task, "gps_time_task", 5000, &gps_time, 10,
-              NULL);
+  xTaskCreate(weather_task_gps_time_task, "gps_time_task",
+              WEATHER_MAIN_GPS_TIME_STACK_SIZE, &gps_time, 10, NULL);
 
   // ESP_LOGI(TAG, "Dispatching I2C task...");
   // xTaskCreate(weather_task_i2c_task, "i2c_task",10000, &i2c, 20, NULL);
 
+  ESP_LOGI(TAG, "Dispatching network supervisor task...");
+  xTaskCreate(weather_task_net_supervisor, "net_supervisor",
+              WEATHER_MAIN_SUPERVISOR_STACK_SIZE, &net, 11, NULL);
   ESP_LOGI(TAG, "Dispatching wireless task...");
-  xTaskCreate(weather_task_net_task, "net_task", 10000, &net, 10, NULL);
+  xTaskCreate(weather_task_net_task, "net_task", WEATHER_MAIN_NET_STACK_SIZE,
+              &net, 10, NULL);
+#ifdef CONFIG_WIRELESS_AUTO_UPDATE
+  ESP_LOGI(TAG, "Dispatching update task...");
+  xTaskCreate(wireless_ota_task, "ota_task", WEATHER_MAIN_OTA_STACK_SIZE,
+              net.wifi, 5, NULL);
+#endif
 
-  // Sensors are monitored in the main section
+  // Sensors are monitored in the main section, each on its own period
   while(1) {
-    iic_mux_refresh(net.i2c);
-    vTaskDelay(CONFIG_WEATHER_POLL_SENSORS_INTERVAL / portTICK_PERIOD_MS);
+    const int64_t next_us =
+        iic_mux_service(net.i2c, weather_main_sampled, net.ring);
+    vTaskDelay(weather_main_ticks_until(next_us));
   }
 }
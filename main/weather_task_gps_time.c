@@ -17,8 +17,54 @@
 
 static const char *TAG = "task_gps_time";
 
+#ifdef CONFIG_GPS_TIME_PROTOCOL_UBX
+// Sends the same setup to the SAM-M8Q at the baud rate we're on
+static void weather_task_gps_time_send_ubx(weather_task_gps_time_t *pointer) {
+  uint8_t *frame = (uint8_t *)(pointer->uart_buffer);
+  size_t size;
+
+  // Turn off the default NMEA set, GGA, GLL, GSA, GSV, RMC and VTG
+  for (uint8_t id = 0x00; id <= 0x05; id++) {
+    size = gps_time_ubx_cfg_msg(frame, GPS_TIME_UBX_CLASS_NMEA, id, 0);
+    uart_write_bytes(WEATHER_TASK_GPS_TIME_UART, frame, size);
+  }
+#ifdef CONFIG_GPS_TIME_UBX_NAV_TIMEUTC
+  size = gps_time_ubx_cfg_msg(frame, GPS_TIME_UBX_CLASS_NAV,
+                              GPS_TIME_UBX_NAV_TIMEUTC, 1);
+#else
+  size = gps_time_ubx_cfg_msg(frame, GPS_TIME_UBX_CLASS_NAV,
+                              GPS_TIME_UBX_NAV_PVT, 1);
+#endif
+  uart_write_bytes(WEATHER_TASK_GPS_TIME_UART, frame, size);
+
+  size = gps_time_ubx_cfg_prt(frame, CONFIG_GPS_TIME_UBX_BAUD_RATE);
+  uart_write_bytes(WEATHER_TASK_GPS_TIME_UART, frame, size);
+  ESP_ERROR_CHECK(
+      uart_wait_tx_done(WEATHER_TASK_GPS_TIME_UART, 1000 / portTICK_PERIOD_MS));
+  // The receiver finishes sending at the old rate before switching over
+  vTaskDelay(100 / portTICK_PERIOD_MS);
+}
+
+static void weather_task_gps_time_configure_ubx(weather_task_gps_time_t *pointer) {
+  ESP_LOGI(TAG, "Configuring receiver for UBX at %d baud",
+           CONFIG_GPS_TIME_UBX_BAUD_RATE);
+  // The receiver keeps its port settings across our resets as long as it's
+  // powered, so it could be listening on either rate.
+  weather_task_gps_time_send_ubx(pointer);
+  ESP_ERROR_CHECK(uart_set_baudrate(WEATHER_TASK_GPS_TIME_UART,
+                                    CONFIG_GPS_TIME_UBX_BAUD_RATE));
+  pointer->uart_config.baud_rate = CONFIG_GPS_TIME_UBX_BAUD_RATE;
+  weather_task_gps_time_send_ubx(pointer);
+  uart_flush_input(WEATHER_TASK_GPS_TIME_UART);
+  xQueueReset(pointer->uart_queue);
+}
+#endif
+
 void weather_task_gps_time_config(weather_task_gps_time_t *pointer) {
   gps_time_fill(&(pointer->data));
+  pointer->lines_read = 0;
+  pointer->lines_dropped = 0;
+  pointer->lines_oversized = 0;
   pointer->uart_config = (uart_config_t){.baud_rate = 9600,
                           .data_bits = UART_DATA_8_BITS,
                           .parity = UART_PARITY_DISABLE,
@@ -28,30 +74,117 @@ void weather_task_gps_time_config(weather_task_gps_time_t *pointer) {
 
   int interrupt_alloc_flags = 0;
 
-  ESP_ERROR_CHECK(uart_driver_install(WEATHER_TASK_GPS_TIME_UART,
-                                      sizeof(pointer->uart_buffer), 0, 0, NULL,
-                                      interrupt_alloc_flags));
+  ESP_ERROR_CHECK(uart_driver_install(
+      WEATHER_TASK_GPS_TIME_UART, WEATHER_TASK_GPS_TIME_RX_SIZE, 0,
+      WEATHER_TASK_GPS_TIME_QUEUE_SIZE, &(pointer->uart_queue),
+      interrupt_alloc_flags));
   ESP_ERROR_CHECK(
       uart_param_config(WEATHER_TASK_GPS_TIME_UART, &(pointer->uart_config)));
   ESP_ERROR_CHECK(uart_set_pin(WEATHER_TASK_GPS_TIME_UART, 17, 16,
                                UART_PIN_NO_CHANGE, UART_PIN_NO_CHANGE));
+
+#ifdef CONFIG_GPS_TIME_PROTOCOL_UBX
+  weather_task_gps_time_configure_ubx(pointer);
+#else
+  // Let the driver find the line breaks, we only wake up once per sentence
+  ESP_ERROR_CHECK(uart_enable_pattern_det_baud_intr(WEATHER_TASK_GPS_TIME_UART,
+                                                    '\n', 1, 9, 0, 0));
+  ESP_ERROR_CHECK(uart_pattern_queue_reset(WEATHER_TASK_GPS_TIME_UART,
+                                           WEATHER_TASK_GPS_TIME_QUEUE_SIZE));
+#endif
+}
+
+#ifdef CONFIG_GPS_TIME_PROTOCOL_UBX
+// Hands everything buffered to the UBX frame parser
+static void weather_task_gps_time_read_ubx(weather_task_gps_time_t *pointer,
+                                           size_t length) {
+  while (length > 0) {
+    size_t chunk = sizeof(pointer->uart_buffer);
+    if (chunk > length) {
+      chunk = length;
+    }
+    int len = uart_read_bytes(WEATHER_TASK_GPS_TIME_UART, pointer->uart_buffer,
+                              chunk, 0);
+    if (len <= 0) {
+      break;
+    }
+    gps_time_ubx_read(&(pointer->data), (const uint8_t *)(pointer->uart_buffer),
+                      len);
+    length -= len;
+  }
+}
+#endif
+
+// Discards a line too long to be NMEA without overrunning the buffer
+static void weather_task_gps_time_skip(weather_task_gps_time_t *pointer,
+                                       size_t length) {
+  while (length > 0) {
+    size_t chunk = sizeof(pointer->uart_buffer);
+    if (chunk > length) {
+      chunk = length;
+    }
+    int len = uart_read_bytes(WEATHER_TASK_GPS_TIME_UART, pointer->uart_buffer,
+                              chunk, 0);
+    if (len <= 0) {
+      break;
+    }
+    length -= len;
+  }
 }
 
 void weather_task_gps_time_task(void *user_data) {
   weather_task_gps_time_t *pointer = user_data;
 
-  char *data_current = pointer->uart_buffer;
+  uart_event_t event;
   while (1) {
-    int len = uart_read_bytes(WEATHER_TASK_GPS_TIME_UART, data_current, 1,
-                              10 / portTICK_PERIOD_MS);
-    if (len == 1) {
-      if (*data_current == '\n') {
-        *data_current = '\0';
-        data_current = pointer->uart_buffer;
-        gps_time_nmea_read(&(pointer->data), pointer->uart_buffer);
-      } else {
-        data_current++;
+    if (xQueueReceive(pointer->uart_queue, &event, portMAX_DELAY) != pdTRUE) {
+      continue;
+    }
+    switch (event.type) {
+#ifdef CONFIG_GPS_TIME_PROTOCOL_UBX
+    case UART_DATA: {
+      weather_task_gps_time_read_ubx(pointer, event.size);
+      break;
+    }
+#endif
+    case UART_PATTERN_DET: {
+      int position = uart_pattern_pop_pos(WEATHER_TASK_GPS_TIME_UART);
+      if (position < 0) {
+        // The position queue overflowed, we can't tell where lines begin
+        uart_flush_input(WEATHER_TASK_GPS_TIME_UART);
+        (pointer->lines_dropped)++;
+        break;
+      }
+      // Include the line feed itself
+      const size_t length = position + 1;
+      if (length > sizeof(pointer->uart_buffer)) {
+        weather_task_gps_time_skip(pointer, length);
+        (pointer->lines_oversized)++;
+        ESP_LOGW(TAG, "Dropped a %u byte line", (unsigned)length);
+        break;
+      }
+      int len = uart_read_bytes(WEATHER_TASK_GPS_TIME_UART, pointer->uart_buffer,
+                                length, 0);
+      if (len != (int)length) {
+        (pointer->lines_dropped)++;
+        break;
       }
+      pointer->uart_buffer[length - 1] = '\0';
+      gps_time_nmea_read(&(pointer->data), pointer->uart_buffer);
+      (pointer->lines_read)++;
+      break;
+    }
+    case UART_FIFO_OVF:
+    case UART_BUFFER_FULL: {
+      ESP_LOGW(TAG, "UART overflowed, flushing");
+      uart_flush_input(WEATHER_TASK_GPS_TIME_UART);
+      xQueueReset(pointer->uart_queue);
+      (pointer->lines_dropped)++;
+      break;
+    }
+    default: {
+      break;
+    }
     }
   }
   // return gracefully in case something happens
@@ -14,83 +14,624 @@
  * OR IN CONNECTION WITH THE USE OR PERFORMANCE OF THIS SOFTWARE.
  */
 #include "weather_task_net.h"
-#include "cJSON.h"
+#include "esp_random.h"
+#include "esp_timer.h"
 #include "freertos/idf_additions.h"
 #include "iic_mux.h"
+#include "payload.h"
+#include "payload_json.h"
+#include "sample_log.h"
+#include "sample_ring.h"
+#include "sample_stats.h"
+#include <inttypes.h>
 #include <stdint.h>
+#include <stdio.h>
 
 static const char *TAG = "task_net";
-uint32_t mqtt_connected = 0;
+
+static TickType_t weather_task_net_ticks_until(int64_t deadline_us) {
+  if (deadline_us == INT64_MAX) {
+    return portMAX_DELAY;
+  }
+  const int64_t left_us = deadline_us - esp_timer_get_time();
+  return (left_us > 0) ? pdMS_TO_TICKS(left_us / 1000) : 0;
+}
+
+#ifdef CONFIG_SAMPLE_LOG
+static bool weather_task_net_online(weather_task_net_t *pointer) {
+  return (xEventGroupGetBits(pointer->mqtt_events) &
+          WEATHER_TASK_NET_MQTT_CONNECTED_BIT) != 0;
+}
+#endif
+
+// Hands an event to the supervisor task, if there is one
+static void weather_task_net_supervise(weather_task_net_t *pointer,
+                                       net_supervisor_event_t event,
+                                       uint32_t address) {
+  if (pointer->supervisor_events == NULL) {
+    return;
+  }
+  const weather_task_net_event_t message = {
+      .event = event,
+      .address = address,
+  };
+  if (xQueueSend(pointer->supervisor_events, &message, 0) != pdTRUE) {
+    ESP_LOGW(TAG, "Supervisor queue full, event %d lost", event);
+  }
+}
+
+// Tells the supervisor about the link. Registered after the wireless
+// component's handler, so that one has had its go at the event.
+static void weather_task_net_link_handler(void *user_data,
+                                          esp_event_base_t base,
+                                          int32_t event_id, void *event_data) {
+  weather_task_net_t *pointer = user_data;
+  if (base == WIFI_EVENT && event_id == WIFI_EVENT_STA_DISCONNECTED) {
+    const bool failed =
+        (xEventGroupGetBits(pointer->wifi->events) & WIRELESS_FAIL_BIT) != 0;
+    weather_task_net_supervise(
+        pointer, failed ? NET_SUPERVISOR_LINK_FAILED : NET_SUPERVISOR_LINK_LOST,
+        0);
+  } else if (base == IP_EVENT && event_id == IP_EVENT_STA_GOT_IP) {
+    const ip_event_got_ip_t *event = event_data;
+    weather_task_net_supervise(pointer, NET_SUPERVISOR_LINK_UP,
+                               event->ip_info.ip.addr);
+  } else if (base == IP_EVENT && event_id == IP_EVENT_STA_LOST_IP) {
+    weather_task_net_supervise(pointer, NET_SUPERVISOR_LINK_LOST, 0);
+  }
+}
 
 static void weather_task_net_event_handler(void *handler_args,
                                            esp_event_base_t base,
                                            int32_t event_id, void *event_data) {
-  esp_mqtt_event_handle_t event = event_data;
-  esp_mqtt_client_handle_t client = event->client;
+  weather_task_net_t *pointer = handler_args;
   esp_mqtt_event_id_t idx = event_id;
 
   switch (idx) {
   case MQTT_EVENT_CONNECTED: {
-    esp_mqtt_client_subscribe(client, "weather/status", 0);
-    mqtt_connected = 1;
+    ESP_LOGI(TAG, "MQTT connected!");
+    (pointer->connections)++;
+    xEventGroupSetBits(pointer->mqtt_events,
+                       WEATHER_TASK_NET_MQTT_CONNECTED_BIT);
+    weather_task_net_supervise(pointer, NET_SUPERVISOR_BROKER_UP, 0);
     break;
   }
   case MQTT_EVENT_DISCONNECTED: {
-    mqtt_connected = 0;
+    const EventBits_t bits = xEventGroupClearBits(
+        pointer->mqtt_events, WEATHER_TASK_NET_MQTT_CONNECTED_BIT);
+    if ((bits & WEATHER_TASK_NET_MQTT_CONNECTED_BIT) != 0) {
+      ESP_LOGW(TAG, "MQTT disconnected");
+      atomic_store(&pointer->waiting_since_us, esp_timer_get_time());
+    }
+    weather_task_net_supervise(pointer, NET_SUPERVISOR_BROKER_DOWN, 0);
+    break;
+  }
+#ifdef CONFIG_SAMPLE_LOG
+  case MQTT_EVENT_PUBLISHED: {
+    const esp_mqtt_event_handle_t event = event_data;
+    atomic_store(&pointer->acked_msg_id, event->msg_id);
+    xEventGroupSetBits(pointer->mqtt_events, WEATHER_TASK_NET_MQTT_ACKED_BIT);
     break;
   }
+#endif
   default: {
     break;
   }
   }
 }
-// ============================================================================
-void weather_task_net_task(void *user_data) {
-  weather_task_net_t *pointer = user_data;
 
-  EventBits_t bits = xEventGroupWaitBits(
-      pointer->wifi->events, WIRELESS_CONNECTED_BIT | WIRELESS_FAIL_BIT,
-      pdFALSE, pdFALSE, portMAX_DELAY);
-  if ((bits & WIRELESS_CONNECTED_BIT) == WIRELESS_CONNECTED_BIT) {
-    const esp_mqtt_client_config_t mqtt_config = {
-        .broker.address.uri = CONFIG_WEATHER_MQTT_BROKER,
+// Publishes the payload cache holding some samples, counting the traffic.
+// Returns the message id, negative if it didn't go out.
+static int weather_task_net_publish(weather_task_net_t *pointer,
+                                    esp_mqtt_client_handle_t client,
+                                    const char *topic, int qos, size_t length,
+                                    uint32_t samples) {
+  weather_task_net_traffic_t *traffic = &pointer->traffic;
+  if (length == 0) {
+    ESP_LOGW(TAG, "Payload of %" PRIu32 " samples is over %d bytes", samples,
+             WEATHER_TASK_NET_PAYLOAD_SIZE);
+    (traffic->failures)++;
+    return -1;
+  }
+  (traffic->publishes)++;
+  const int msg_id = esp_mqtt_client_publish(client, topic,
+                                             pointer->payload_cache,
+                                             (int)length, qos, 0);
+  if (msg_id < 0) {
+    (traffic->failures)++;
+    return msg_id;
+  }
+  traffic->samples += samples;
+  traffic->bytes += length;
+
+  const int64_t waiting_since_us = atomic_load(&pointer->waiting_since_us);
+  if (waiting_since_us >= 0) {
+    ESP_LOGI(TAG, "First publish %" PRId64 " ms after %s",
+             (esp_timer_get_time() - waiting_since_us) / 1000,
+             (pointer->connections > 1) ? "losing the broker" : "boot");
+    atomic_store(&pointer->waiting_since_us, -1);
+#ifdef CONFIG_WIRELESS_AUTO_UPDATE
+    // Reaching the broker is what a new image has to prove
+    wireless_ota_confirm(true);
+#endif
+  }
+  return msg_id;
+}
+
+#if defined(CONFIG_WEATHER_PUBLISH_BATCH) || defined(CONFIG_SAMPLE_LOG)
+// Encodes a batch of samples into the payload cache, its length
+static size_t weather_task_net_encode(weather_task_net_t *pointer,
+                                      const payload_header_t *header,
+                                      const sample_ring_record_t *records,
+                                      uint32_t count) {
+#ifdef CONFIG_WEATHER_PAYLOAD_CBOR
+  return payload_encode_batch(header, records, count,
+                              (uint8_t *)(pointer->payload_cache),
+                              sizeof(pointer->payload_cache));
+#else
+  return payload_json_encode_batch(header, records, count,
+                                   pointer->payload_cache,
+                                   sizeof(pointer->payload_cache));
+#endif
+}
+#endif
+
+// Uptime and how the network held up since boot. JSON whatever the payload
+// encoding, people read it more than dashboards do.
+static void weather_task_net_health(weather_task_net_t *pointer) {
+  // A copy, so the figures all come from one moment, 64-bit ones included
+  xSemaphoreTake(pointer->supervisor_lock, portMAX_DELAY);
+  const net_supervisor_t snapshot = pointer->supervisor;
+  xSemaphoreGive(pointer->supervisor_lock);
+  const net_supervisor_t *supervisor = &snapshot;
+  const int length = snprintf(
+      pointer->payload_cache, sizeof(pointer->payload_cache),
+      "{\"uptime_s\":%" PRId64 ",\"connections\":%" PRIu32
+      ",\"link_losses\":%" PRIu32 ",\"broker_losses\":%" PRIu32
+      ",\"address_changes\":%" PRIu32 ",\"rejoins\":%" PRIu32
+      ",\"reconnects\":%" PRIu32 ",\"recoveries\":%" PRIu32
+      ",\"offline_mean_ms\":%" PRId64 ",\"offline_max_ms\":%" PRId64
+      ",\"mttr_ms\":%" PRId64 ",\"recovery_max_ms\":%" PRId64 "}",
+      esp_timer_get_time() / 1000000, supervisor->connections,
+      supervisor->link_losses, supervisor->broker_losses,
+      supervisor->address_changes, supervisor->joins, supervisor->reconnects,
+      supervisor->recoveries,
+      net_supervisor_offline_mean_us(supervisor) / 1000,
+      supervisor->offline_max_us / 1000,
+      net_supervisor_mttr_us(supervisor) / 1000,
+      supervisor->recovery_max_us / 1000);
+  ESP_LOGI(TAG, "Health: %s", pointer->payload_cache);
+  if ((xEventGroupGetBits(pointer->mqtt_events) &
+       WEATHER_TASK_NET_MQTT_CONNECTED_BIT) != 0) {
+    weather_task_net_publish(
+        pointer, pointer->client, "weather/health", 0,
+        (length > 0 && length < (int)(sizeof(pointer->payload_cache)))
+            ? (size_t)(length)
+            : 0,
+        0);
+  }
+}
+
+#ifdef CONFIG_WEATHER_DIAGNOSTICS
+// Task, heap and bus figures for sizing stacks and catching leaks, on their
+// own topic at a slow rate
+static void weather_task_net_diagnostics(weather_task_net_t *pointer) {
+  if (esp_timer_get_time() - pointer->diagnostics.since_us <
+      (int64_t)(CONFIG_WEATHER_DIAGNOSTICS_INTERVAL_S) * 1000000) {
+    return;
+  }
+  const size_t length = weather_diagnostics_encode(
+      &pointer->diagnostics, pointer->i2c, pointer->gps_time,
+      pointer->payload_cache, sizeof(pointer->payload_cache));
+  if (length > 0) {
+    ESP_LOGI(TAG, "Diagnostics: %s", pointer->payload_cache);
+  }
+  if ((xEventGroupGetBits(pointer->mqtt_events) &
+       WEATHER_TASK_NET_MQTT_CONNECTED_BIT) != 0) {
+    weather_task_net_publish(pointer, pointer->client, "weather/diagnostics",
+                             0, length, 0);
+  }
+}
+#endif
+
+static void weather_task_net_hourly(weather_task_net_t *pointer) {
+  weather_task_net_traffic_t *traffic = &pointer->traffic;
+  const int64_t now = esp_timer_get_time();
+  if (now - traffic->since_us < 3600000000LL) {
+    return;
+  }
+  ESP_LOGI(TAG,
+           "Last hour: %" PRIu32 " samples, %" PRIu32 " bytes in %" PRIu32
+           " publishes, %" PRIu32 " failed",
+           traffic->samples, traffic->bytes, traffic->publishes,
+           traffic->failures);
+#ifdef CONFIG_SAMPLE_LOG
+  const sample_log_t *log = pointer->log;
+  ESP_LOGI(TAG,
+           "Backlog: %" PRIu32 " samples, %" PRIu32 " replayed, %" PRIu32
+           " stored and %" PRIu32 " dropped since boot, wear %" PRIu32,
+           log->depth, traffic->replayed, log->appended, log->dropped,
+           log->wear);
+#endif
+  wireless_report(pointer->wifi);
+  weather_task_net_health(pointer);
+  *traffic = (weather_task_net_traffic_t){.since_us = now};
+}
+
+#ifdef CONFIG_WEATHER_PUBLISH_BATCH
+// Publishes every full batch, and a partial one once it has waited long enough
+// or when flushing
+static void weather_task_net_batch(weather_task_net_t *pointer,
+                                   esp_mqtt_client_handle_t client,
+                                   bool flush) {
+  while (1) {
+    while (pointer->batch_count < CONFIG_WEATHER_BATCH_SIZE &&
+           sample_ring_pop(pointer->ring,
+                           &pointer->batch[pointer->batch_count])) {
+      if (pointer->batch_count == 0) {
+        pointer->batch_since_us = esp_timer_get_time();
+      }
+      (pointer->batch_count)++;
+    }
+    if (pointer->batch_count == 0) {
+      return;
+    }
+    if (!flush && pointer->batch_count < CONFIG_WEATHER_BATCH_SIZE &&
+        esp_timer_get_time() - pointer->batch_since_us <
+            (int64_t)(CONFIG_WEATHER_BATCH_LATENCY_MS) * 1000) {
+      return;
+    }
+
+    const payload_header_t header = {
+        .dropped = atomic_load(&pointer->ring->dropped),
+        .overwritten = atomic_load(&pointer->ring->overwritten),
     };
-    ESP_LOGI(TAG, "Trying broker '%s'", CONFIG_WEATHER_MQTT_BROKER);
+    const size_t length = weather_task_net_encode(
+        pointer, &header, pointer->batch, pointer->batch_count);
+    if (weather_task_net_publish(pointer, client, "weather/status", 0, length,
+                                 pointer->batch_count) < 0 &&
+        length > 0) {
+      // Kept for the next try, or for the backlog
+      return;
+    }
+    pointer->batch_count = 0;
+  }
+}
+#else
+// Publishes the window's summary, false if it didn't go out
+static bool weather_task_net_summary(weather_task_net_t *pointer,
+                                     esp_mqtt_client_handle_t client) {
+  // Every sample of the window is summarised, channels sampled at their
+  // own rates each get their own count
+  sample_stats_fill(&pointer->stats);
+#ifdef CONFIG_WEATHER_DUTY_CYCLE
+  pointer->window_count = 0;
+#endif
+  sample_ring_record_t record;
+  while (sample_ring_pop(pointer->ring, &record)) {
+    sample_stats_add(&pointer->stats, &record);
+#ifdef CONFIG_WEATHER_DUTY_CYCLE
+    if (pointer->window_count < CONFIG_SAMPLE_RING_CAPACITY) {
+      pointer->window[pointer->window_count] = record;
+      (pointer->window_count)++;
+    }
+#endif
+  }
+  if (pointer->stats.records == 0) {
+    ESP_LOGI(TAG, "No samples in this window");
+    return true;
+  }
+  const sample_stats_t *stats = &pointer->stats;
 
-    esp_mqtt_client_handle_t client = esp_mqtt_client_init(&mqtt_config);
-    esp_mqtt_client_register_event(client, ESP_EVENT_ANY_ID,
-                                   weather_task_net_event_handler, NULL);
-    esp_mqtt_client_start(client);
+  const payload_header_t header = {
+      .dropped = atomic_load(&pointer->ring->dropped),
+      .overwritten = atomic_load(&pointer->ring->overwritten),
+  };
+#ifdef CONFIG_WEATHER_PAYLOAD_CBOR
+  const size_t length = payload_encode_summary(
+      &header, stats, (uint8_t *)(pointer->payload_cache),
+      sizeof(pointer->payload_cache));
+#else
+  const size_t length = payload_json_encode_summary(
+      &header, stats, pointer->payload_cache, sizeof(pointer->payload_cache));
+#endif
+  if (weather_task_net_publish(pointer, client, "weather/status", 0, length,
+                               stats->records) < 0) {
+    return false;
+  }
+#ifdef CONFIG_WEATHER_DUTY_CYCLE
+  pointer->window_count = 0;
+#endif
+  return true;
+}
+#endif
 
-    while (mqtt_connected != 1) {
-      ESP_LOGI(TAG, "Waiting for MQTT");
-      vTaskDelay(5000 / portTICK_PERIOD_MS);
+#ifdef CONFIG_SAMPLE_LOG
+// Moves every sample waiting to be published into the log, oldest first
+static void weather_task_net_store(weather_task_net_t *pointer) {
+  sample_ring_record_t record;
+  uint32_t lost = 0;
+#ifdef CONFIG_WEATHER_PUBLISH_BATCH
+  for (uint32_t i = 0; i < pointer->batch_count; i++) {
+    lost += sample_log_append(pointer->log, &pointer->batch[i]) != ESP_OK;
+  }
+  pointer->batch_count = 0;
+#endif
+  while (sample_ring_pop(pointer->ring, &record)) {
+    lost += sample_log_append(pointer->log, &record) != ESP_OK;
+  }
+  if (lost > 0) {
+    ESP_LOGW(TAG, "%" PRIu32 " samples lost writing the sample log", lost);
+  }
+}
+
+// Stores samples while the broker is away. Once it is back, replays the
+// backlog at a steady pace with new samples queued behind it, until the
+// deadline.
+// Waits for the broker to acknowledge a replayed message, while it's there
+static bool weather_task_net_acked(weather_task_net_t *pointer, int msg_id,
+                                   int64_t deadline_us) {
+  const int64_t timeout_us =
+      esp_timer_get_time() + WEATHER_TASK_NET_ACK_TIMEOUT_MS * 1000LL;
+  if (timeout_us < deadline_us) {
+    deadline_us = timeout_us;
+  }
+  while (atomic_load(&pointer->acked_msg_id) != msg_id) {
+    if (!weather_task_net_online(pointer) ||
+        esp_timer_get_time() >= deadline_us) {
+      return false;
     }
+    // Sliced, a disconnect doesn't set the bit
+    TickType_t ticks = weather_task_net_ticks_until(deadline_us);
+    if (ticks > pdMS_TO_TICKS(1000)) {
+      ticks = pdMS_TO_TICKS(1000);
+    }
+    xEventGroupWaitBits(pointer->mqtt_events, WEATHER_TASK_NET_MQTT_ACKED_BIT,
+                        pdTRUE, pdTRUE, ticks);
+  }
+  return true;
+}
 
-    ESP_LOGI(TAG, "MQTT connected!");
+static void weather_task_net_backlog(weather_task_net_t *pointer,
+                                     esp_mqtt_client_handle_t client,
+                                     int64_t deadline_us) {
+  sample_log_t *log = pointer->log;
+  while (1) {
+    weather_task_net_store(pointer);
+    if (!weather_task_net_online(pointer) || log->depth == 0 ||
+        esp_timer_get_time() >= deadline_us) {
+      break;
+    }
+    if (pointer->replay_samples == 0) {
+      pointer->replay_since_us = esp_timer_get_time();
+      ESP_LOGI(TAG, "Replaying %" PRIu32 " backlogged samples", log->depth);
+    }
 
-    while (1) {
-      vTaskDelay(CONFIG_WEATHER_MQTT_INTERVAL / portTICK_PERIOD_MS);
+    const uint32_t count =
+        sample_log_peek(log, pointer->replay, CONFIG_WEATHER_REPLAY_BATCH);
+    if (count > 0) {
+      // Samples lost to the log wrapping around count as dropped
+      const payload_header_t header = {
+          .dropped = atomic_load(&pointer->ring->dropped) + log->dropped,
+          .overwritten = atomic_load(&pointer->ring->overwritten),
+      };
+      const size_t length =
+          weather_task_net_encode(pointer, &header, pointer->replay, count);
+      const int msg_id = weather_task_net_publish(
+          pointer, client, "weather/backlog", 1, length, count);
+      if (msg_id < 0) {
+        break;
+      }
+      // The samples leave flash only once the broker has them
+      if (!weather_task_net_acked(pointer, msg_id, deadline_us)) {
+        ESP_LOGW(TAG, "Replayed samples weren't acknowledged, keeping them");
+        break;
+      }
+    }
+    if (sample_log_consume(log) != ESP_OK) {
+      ESP_LOGW(TAG, "Couldn't consume replayed samples");
+      break;
+    }
+    pointer->traffic.replayed += count;
+    pointer->replay_samples += count;
+    vTaskDelay(CONFIG_WEATHER_REPLAY_INTERVAL_MS / portTICK_PERIOD_MS);
+  }
 
-      struct timeval time;
-      gettimeofday(&time, NULL);
+  if (log->depth == 0 && pointer->replay_samples > 0) {
+    const int64_t elapsed_ms =
+        (esp_timer_get_time() - pointer->replay_since_us) / 1000;
+    ESP_LOGI(TAG,
+             "Replayed %" PRIu32 " samples in %" PRId64 " ms, %" PRId64
+             " samples/s",
+             pointer->replay_samples, elapsed_ms,
+             (int64_t)(pointer->replay_samples) * 1000 /
+                 (elapsed_ms > 0 ? elapsed_ms : 1));
+    pointer->replay_samples = 0;
+  }
+}
+#endif
 
-      cJSON *root = cJSON_CreateObject();
-      cJSON_AddNumberToObject(root, "unix_time", time.tv_sec);
-      cJSON *weather_data = cJSON_AddObjectToObject(root, "data");
+static void weather_task_net_client(weather_task_net_t *pointer,
+                                    int reconnect_timeout_ms) {
+  const esp_mqtt_client_config_t mqtt_config = {
+      .broker.address.uri = CONFIG_WEATHER_MQTT_BROKER,
+      .network.reconnect_timeout_ms = reconnect_timeout_ms,
+  };
+  ESP_LOGI(TAG, "Trying broker '%s'", CONFIG_WEATHER_MQTT_BROKER);
 
-      cJSON_AddNumberToObject(weather_data, "pressure", pointer->i2c->bme280_pressure);
-      cJSON_AddNumberToObject(weather_data, "temperature", pointer->i2c->bme280_temperature);
+  pointer->client = esp_mqtt_client_init(&mqtt_config);
+  esp_mqtt_client_register_event(pointer->client, ESP_EVENT_ANY_ID,
+                                 weather_task_net_event_handler, pointer);
+  esp_mqtt_client_start(pointer->client);
+}
 
-      memset(pointer->json_cache, 0, sizeof(pointer->json_cache));
-      cJSON_PrintPreallocated(root, pointer->json_cache, sizeof(pointer->json_cache) - 1, 0);
-      esp_mqtt_client_publish(client, "weather/status", pointer->json_cache, strlen(pointer->json_cache), 0, 0);
-      cJSON_Delete(root);
+#ifdef CONFIG_WEATHER_DUTY_CYCLE
+bool weather_task_net_once(weather_task_net_t *pointer, int64_t deadline_us) {
+  const EventBits_t bits = xEventGroupWaitBits(
+      pointer->wifi->events, WIRELESS_CONNECTED_BIT | WIRELESS_FAIL_BIT,
+      pdFALSE, pdFALSE, weather_task_net_ticks_until(deadline_us));
+  bool online = false;
+  if ((bits & WIRELESS_CONNECTED_BIT) == WIRELESS_CONNECTED_BIT) {
+    // No supervisor in a wake this short, the client retries on its own
+    weather_task_net_client(pointer,
+                            CONFIG_NET_SUPERVISOR_BROKER_BACKOFF_MIN_MS);
+    online = (xEventGroupWaitBits(pointer->mqtt_events,
+                                  WEATHER_TASK_NET_MQTT_CONNECTED_BIT, pdFALSE,
+                                  pdTRUE,
+                                  weather_task_net_ticks_until(deadline_us)) &
+              WEATHER_TASK_NET_MQTT_CONNECTED_BIT) != 0;
+  }
+#ifdef CONFIG_SAMPLE_LOG
+  if (!online || pointer->log->depth > 0) {
+    weather_task_net_backlog(pointer, pointer->client, deadline_us);
+    online = weather_task_net_online(pointer) && pointer->log->depth == 0;
+  }
+#endif
+  if (online) {
+#ifdef CONFIG_WEATHER_PUBLISH_BATCH
+    weather_task_net_batch(pointer, pointer->client, true);
+    online = pointer->batch_count == 0;
+#else
+    online = weather_task_net_summary(pointer, pointer->client);
+#endif
+  }
+  if (pointer->client != NULL) {
+    // QoS 1 messages are only safe once the broker acknowledged them
+    while (esp_mqtt_client_get_outbox_size(pointer->client) > 0 &&
+           esp_timer_get_time() < deadline_us) {
+      vTaskDelay(100 / portTICK_PERIOD_MS);
+    }
+    esp_mqtt_client_stop(pointer->client);
+  }
+  return online;
+}
+#endif
+
+void weather_task_net_fill(weather_task_net_t *pointer) {
+#ifdef CONFIG_WEATHER_PUBLISH_BATCH
+  pointer->batch_count = 0;
+  pointer->batch_since_us = 0;
+#else
+  sample_stats_fill(&pointer->stats);
+#ifdef CONFIG_WEATHER_DUTY_CYCLE
+  pointer->window_count = 0;
+#endif
+#endif
+#ifdef CONFIG_SAMPLE_LOG
+  pointer->replay_since_us = 0;
+  pointer->replay_samples = 0;
+#endif
+  pointer->mqtt_events = xEventGroupCreate();
+  pointer->client = NULL;
+  pointer->supervisor_events = NULL;
+  pointer->supervisor_lock = xSemaphoreCreateMutex();
+  net_supervisor_fill(&pointer->supervisor, esp_timer_get_time(),
+                      esp_random());
+  pointer->connections = 0;
+#ifdef CONFIG_SAMPLE_LOG
+  atomic_store(&pointer->acked_msg_id, -1);
+#endif
+  atomic_store(&pointer->waiting_since_us, esp_timer_get_time());
+  pointer->traffic =
+      (weather_task_net_traffic_t){.since_us = esp_timer_get_time()};
+#ifdef CONFIG_WEATHER_DIAGNOSTICS
+  weather_diagnostics_fill(&pointer->diagnostics);
+#endif
+}
+
+// ============================================================================
+void weather_task_net_task(void *user_data) {
+  weather_task_net_t *pointer = user_data;
+
+  while (1) {
+#ifdef CONFIG_WEATHER_PUBLISH_BATCH
+    vTaskDelay(WEATHER_TASK_NET_BATCH_POLL_MS / portTICK_PERIOD_MS);
+#else
+    vTaskDelay(CONFIG_WEATHER_MQTT_INTERVAL / portTICK_PERIOD_MS);
+#endif
+#ifdef CONFIG_SAMPLE_LOG
+    // Live samples wait until the backlog is gone, so they stay in order
+    if (!weather_task_net_online(pointer) || pointer->log->depth > 0) {
+      weather_task_net_backlog(pointer, pointer->client, INT64_MAX);
+      weather_task_net_hourly(pointer);
+#ifdef CONFIG_WEATHER_DIAGNOSTICS
+      weather_task_net_diagnostics(pointer);
+#endif
+      continue;
     }
-  } else if ((bits & WIRELESS_FAIL_BIT) == WIRELESS_FAIL_BIT) {
-    ESP_LOGW(TAG, "Wireless connection failed.");
+#else
+    // Samples wait in the ring while the broker is away
+    xEventGroupWaitBits(pointer->mqtt_events,
+                        WEATHER_TASK_NET_MQTT_CONNECTED_BIT, pdFALSE, pdTRUE,
+                        portMAX_DELAY);
+#endif
+#ifdef CONFIG_WEATHER_PUBLISH_BATCH
+    weather_task_net_batch(pointer, pointer->client, false);
+#else
+    weather_task_net_summary(pointer, pointer->client);
+#endif
+    weather_task_net_hourly(pointer);
+#ifdef CONFIG_WEATHER_DIAGNOSTICS
+    weather_task_net_diagnostics(pointer);
+#endif
   }
+}
+
+void weather_task_net_supervisor(void *user_data) {
+  weather_task_net_t *pointer = user_data;
+  net_supervisor_t *supervisor = &pointer->supervisor;
+
+  pointer->supervisor_events = xQueueCreate(
+      WEATHER_TASK_NET_EVENT_QUEUE_SIZE, sizeof(weather_task_net_event_t));
+  esp_event_handler_instance_t instance_disconnected;
+  esp_event_handler_instance_t instance_ip;
+  ESP_ERROR_CHECK(esp_event_handler_instance_register(
+      WIFI_EVENT, WIFI_EVENT_STA_DISCONNECTED, weather_task_net_link_handler,
+      pointer, &instance_disconnected));
+  ESP_ERROR_CHECK(esp_event_handler_instance_register(
+      IP_EVENT, ESP_EVENT_ANY_ID, weather_task_net_link_handler, pointer,
+      &instance_ip));
+  // Catches up with a join that finished before the handlers were there
+  const EventBits_t bits = xEventGroupGetBits(pointer->wifi->events);
+  esp_netif_ip_info_t ip_info;
+  if ((bits & WIRELESS_CONNECTED_BIT) != 0 &&
+      esp_netif_get_ip_info(esp_netif_get_handle_from_ifkey("WIFI_STA_DEF"),
+                            &ip_info) == ESP_OK) {
+    weather_task_net_supervise(pointer, NET_SUPERVISOR_LINK_UP,
+                               ip_info.ip.addr);
+  } else if ((bits & WIRELESS_FAIL_BIT) != 0) {
+    weather_task_net_supervise(pointer, NET_SUPERVISOR_LINK_FAILED, 0);
+  }
+
+  while (1) {
+    weather_task_net_event_t message;
+    uint32_t actions = NET_SUPERVISOR_NONE;
+    const BaseType_t received =
+        xQueueReceive(pointer->supervisor_events, &message,
+                      weather_task_net_ticks_until(
+                          net_supervisor_next_us(supervisor)));
+    xSemaphoreTake(pointer->supervisor_lock, portMAX_DELAY);
+    if (received == pdTRUE) {
+      actions = net_supervisor_event(supervisor, message.event,
+                                     message.address, esp_timer_get_time());
+    }
+    actions |= net_supervisor_poll(supervisor, esp_timer_get_time());
+    xSemaphoreGive(pointer->supervisor_lock);
 
-  // return gracefully in case something happens
-  vTaskDelete(NULL);
+    if ((actions & NET_SUPERVISOR_JOIN) != 0) {
+      wireless_rejoin(pointer->wifi);
+    }
+    if ((actions & NET_SUPERVISOR_MQTT_START) != 0) {
+      // The supervisor's backoff goes first, the client's own is a fallback
+      weather_task_net_client(pointer,
+                              CONFIG_NET_SUPERVISOR_BROKER_BACKOFF_MAX_MS);
+    }
+    if ((actions & NET_SUPERVISOR_MQTT_RESTART) != 0) {
+      esp_mqtt_client_stop(pointer->client);
+      esp_mqtt_client_start(pointer->client);
+    }
+    if ((actions & NET_SUPERVISOR_MQTT_RECONNECT) != 0) {
+      esp_mqtt_client_reconnect(pointer->client);
+    }
+  }
 }
@@ -24,10 +24,10 @@ from pytest_embedded_qemu.dut import QemuDut
 
 @pytest.mark.supported_targets
 @pytest.mark.generic
-def test_hello_world(
+def test_weather_boot(
     dut: IdfDut, log_minimum_free_heap_size: Callable[..., None]
 ) -> None:
-    dut.expect('Hello world!')
+    dut.expect('Dispatching wireless task...')
     log_minimum_free_heap_size()
 
 
@@ -48,10 +48,12 @@ def verify_elf_sha256_embedding(app: QemuApp, sha256_reported: str) -> None:
 @pytest.mark.esp32  # we only support qemu on esp32 for now
 @pytest.mark.host_test
 @pytest.mark.qemu
-def test_hello_world_host(app: QemuApp, dut: QemuDut) -> None:
+def test_weather_boot_host(app: QemuApp, dut: QemuDut) -> None:
     sha256_reported = (
         dut.expect(r'ELF file SHA256:\s+([a-f0-9]+)').group(1).decode('utf-8')
     )
     verify_elf_sha256_embedding(app, sha256_reported)
 
-    dut.expect('Hello world!')
+    # There's no Wi-Fi or sensors under QEMU, only get as far as bringing up
+    # storage
+    dut.expect('Creating default event loop...')